@@ -1,11 +1,14 @@
 #include "Frame.h"
 #include "utils.h"
+#include "Logger.h"
+#include "Profiler.h"
+#include <algorithm>
 #include <exception>
 namespace MVSO {
 
-	int Frame::FRAME_COUNT = 0;
+	std::atomic<long> Frame::TRACK_COUNT(0);
 
-	Frame::Frame(cv::Mat imgLeft, cv::Mat imgRight) : frameId_(FRAME_COUNT++)
+	Frame::Frame(cv::Mat imgLeft, cv::Mat imgRight, int frameId) : frameId_(frameId)
 	{
 		if (imgLeft.channels() == 1 && imgRight.channels() == 1)
 		{
@@ -23,6 +26,9 @@ namespace MVSO {
 	{
 		keyPoints_ = keypoints;
 		pointAges_ = std::vector<int>(keypoints.size(), 0);
+		// new tracks until setInterframeMatching links them
+		baseKeyPointIndex_ = std::vector<int>(keypoints.size(), -1);
+		trackIds_ = std::vector<long>(keypoints.size(), -1);
 	}
 
 	cv::Mat Frame::getLeftImg()
@@ -37,6 +43,7 @@ namespace MVSO {
 
 	void Frame::prepareFeature()
 	{
+		newTrackIdBegin_ = TRACK_COUNT;
 		if (keyPoints_.size() < 2000)
 		{
 			std::vector<cv::Point2f>  points_new;
@@ -45,16 +52,77 @@ namespace MVSO {
 
 			pointAges_.resize(keyPoints_.size(), -1);
 			baseKeyPointIndex_.resize(keyPoints_.size(), -1);
+
+			// every new feature starts a track, the ids are claimed as one block
+			trackIds_.resize(keyPoints_.size(), -1);
+			long id = TRACK_COUNT.fetch_add(static_cast<long>(std::count(trackIds_.begin(), trackIds_.end(), -1)));
+			newTrackIdBegin_ = id;
+			for (long& trackId : trackIds_)
+				if (trackId == -1)
+					trackId = id++;
 		}
 	}
 
 	void Frame::featureDetection(std::vector<cv::Point2f>& points)
 	{
-		std::vector<cv::KeyPoint> keypoints;
-		int fast_threshold = 23;
-		bool nonmaxSuppression = true;
-		cv::FAST(grayImgLeft_, keypoints, fast_threshold, nonmaxSuppression);
-		cv::KeyPoint::convert(keypoints, points, std::vector<int>());
+		if (!detected_)
+		{
+			MVSO_SCOPED_TIMER(Stage::DETECTION);
+			std::vector<cv::KeyPoint> keypoints;
+			int fast_threshold = 23;
+			bool nonmaxSuppression = true;
+			cv::FAST(grayImgLeft_, keypoints, fast_threshold, nonmaxSuppression);
+			cv::KeyPoint::convert(keypoints, candidates_, std::vector<int>());
+			detected_ = true;
+		}
+		points = candidates_;
+	}
+
+	void Frame::prepareImages()
+	{
+		getLeftPyramid();
+		getRightPyramid();
+		std::vector<cv::Point2f> points;
+		featureDetection(points);
+	}
+
+	// large enough for the 21x21 temporal and 31x21 stereo LK windows
+	static const cv::Size pyramidWindow(31, 21);
+	static const int pyramidLevels = 3;
+
+	const std::vector<cv::Mat>& Frame::getLeftPyramid()
+	{
+		if (pyramidLeft_.empty())
+		{
+			MVSO_SCOPED_TIMER(Stage::PYRAMID);
+			cv::buildOpticalFlowPyramid(grayImgLeft_, pyramidLeft_, pyramidWindow, pyramidLevels);
+		}
+		return pyramidLeft_;
+	}
+
+	const std::vector<cv::Mat>& Frame::getRightPyramid()
+	{
+		if (pyramidRight_.empty())
+		{
+			MVSO_SCOPED_TIMER(Stage::PYRAMID);
+			cv::buildOpticalFlowPyramid(grayImgRight_, pyramidRight_, pyramidWindow, pyramidLevels);
+		}
+		return pyramidRight_;
+	}
+
+	cv::Mat Frame::getLeftLevel(int level)
+	{
+		// the pyramid holds an (image, derivatives) pair per level
+		if (!pyramidLeft_.empty() && level <= pyramidLevels)
+			return pyramidLeft_[2 * level];
+		if (leftLevelIndex_ != level)
+		{
+			leftLevel_ = grayImgLeft_;
+			for (int i = 0; i < level; i++)
+				cv::pyrDown(leftLevel_, leftLevel_);
+			leftLevelIndex_ = level;
+		}
+		return leftLevel_;
 	}
 
 	std::vector<cv::Point2f> Frame::getKeypoints()
@@ -74,7 +142,7 @@ namespace MVSO {
 		int bucketHeight = grayImgLeft_.rows / bucketSize + 1;
 
 		std::vector<std::vector<int> > buckets(bucketHeight*bucketWidth);
-		std::cout << buckets.size() << std::endl;
+		MVSO_LOG_TRACE("buckets: " << buckets.size());
 		for (int i = 0; i < keyPoints_.size(); i++)
 		{
 			cv::Point2f pt = keyPoints_[i];
@@ -92,6 +160,7 @@ namespace MVSO {
 		std::vector<cv::Point2f> newKeypoints;
 		std::vector<int> newAges;
 		std::vector<int> newKeypointIndex;
+		std::vector<long> newTrackIds;
 		//newKeypoints.reserve(count);
 		//newAges.reserve(count);
 		//newKeypointIndex.reserve(count);
@@ -108,6 +177,7 @@ namespace MVSO {
 						newKeypoints.push_back(keyPoints_[i]);
 						newAges.push_back(pointAges_[i]);
 						newKeypointIndex.push_back(baseKeyPointIndex_[i]);
+						newTrackIds.push_back(trackIds_[i]);
 					}
 				}
 				else {
@@ -126,6 +196,7 @@ namespace MVSO {
 					newKeypoints.push_back(keyPoints_[best]);
 					newAges.push_back(pointAges_[best]);
 					newKeypointIndex.push_back(baseKeyPointIndex_[best]);
+					newTrackIds.push_back(trackIds_[best]);
 				}
 				
 
@@ -136,6 +207,7 @@ namespace MVSO {
 		keyPoints_ = newKeypoints;
 		pointAges_ = newAges;
 		baseKeyPointIndex_ = newKeypointIndex;
+		trackIds_ = newTrackIds;
 	}
 
 	void Frame::removeInvalidNewFeature(std::vector<bool>& status)
@@ -151,6 +223,7 @@ namespace MVSO {
 		removeInvalidElement(keyPoints_, status);
 		removeInvalidElement(pointAges_, status);
 		removeInvalidElement(baseKeyPointIndex_, status);
+		removeInvalidElement(trackIds_, status);
 	}
 
 	void Frame::addStereoMatch(std::vector<cv::Point2f>& keypoints, std::vector<cv::Point3f>& keypoints3D)
@@ -169,12 +242,89 @@ namespace MVSO {
 	{
 		baseKeyPointIndex_ = matchId;
 		pointAges_ = std::vector<int>(matchId.size(), -1);
+		trackIds_ = std::vector<long>(matchId.size(), -1);
 		for (int i = 0; i < matchId.size(); i++)
 		{
 			if (matchId[i] != -1)
+			{
 				pointAges_[i] = refFrame->pointAges_[matchId[i]] + 1;
+				trackIds_[i] = refFrame->trackIds_[matchId[i]];
+			}
 		}
 	}
 
+	void Frame::addObservations(const std::vector<cv::Point2f>& left, const std::vector<cv::Point2f>& right,
+		const std::vector<long>& trackIds, long minTrackId)
+	{
+		for (size_t i = 0; i < left.size(); i++)
+		{
+			if (trackIds[i] < minTrackId)
+				continue;
+			StereoObservation obs;
+			obs.trackId = trackIds[i];
+			obs.uL = left[i].x;
+			obs.v = left[i].y;
+			obs.uR = right[i].x;
+			observations_.push_back(obs);
+		}
+	}
+
+	const std::vector<StereoObservation>& Frame::getObservations() const
+	{
+		return observations_;
+	}
+
+	std::vector<long> Frame::getTrackIds(const std::vector<int>& keypointIds) const
+	{
+		std::vector<long> ids(keypointIds.size());
+		for (size_t i = 0; i < keypointIds.size(); i++)
+			ids[i] = trackIds_[keypointIds[i]];
+		return ids;
+	}
+
+	void Frame::releaseImages()
+	{
+		grayImgLeft_.release();
+		grayImgRight_.release();
+		imgLeft_.release();
+		pyramidLeft_.clear();
+		pyramidRight_.clear();
+		leftLevel_.release();
+		leftLevelIndex_ = -1;
+		std::vector<cv::Point2f>().swap(candidates_);
+	}
+
+	int Frame::getFrameId() const
+	{
+		return frameId_;
+	}
+
+	long Frame::getNewTrackIdBegin() const
+	{
+		return newTrackIdBegin_;
+	}
+
+	bool Frame::isKeyframe() const
+	{
+		return keyframe_;
+	}
+
+	void Frame::setKeyframe()
+	{
+		keyframe_ = true;
+	}
+
+	void Frame::setPose(const Eigen::Matrix3d & Rwc, const Eigen::Vector3d & twc)
+	{
+		Rwc_ = Rwc;
+		twc_ = twc;
+	}
+
+	void Frame::getPose(Eigen::Matrix3d & Rwc, Eigen::Vector3d & twc) const
+	{
+		Rwc = Rwc_;
+		twc = twc_;
+	}
+
 }
 
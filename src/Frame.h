@@ -1,14 +1,24 @@
 #ifndef FRAME_H
 #define FRAME_H
 
+#include <atomic>
 #include <vector>
 #include <string>
 #include <iostream>
 
 #include <opencv2/opencv.hpp>
+#include <Eigen/Core>
 
 namespace MVSO {
 
+// left/right observation of one feature track in a rectified pair, uR < 0
+// when the track was not matched into the right image
+struct StereoObservation
+{
+	long trackId;
+	float uL, v, uR;
+};
+
 
 class Frame
 {
@@ -16,11 +26,14 @@ class Frame
 
   public:
 
-    static int FRAME_COUNT;
+    static std::atomic<long> TRACK_COUNT;   // shared by the rigs tracking concurrently
     const int bucketSize = 20;
 
     Frame() = default;
-    Frame(cv::Mat imgLeft, cv::Mat imgRight);
+
+	// frameId is the index of the image pair, counted by the odometry that
+	// grabs it; the frames of the auxiliary rigs share the primary frame's
+	Frame(cv::Mat imgLeft, cv::Mat imgRight, int frameId);
     void setFeature(const std::vector<cv::Point2f> &keypoints);
     cv::Mat getLeftImg();
     cv::Mat getRightImg();
@@ -34,6 +47,36 @@ class Frame
 	void addStereoMatch(std::vector<cv::Point2f>& keypoints, cv::Mat& keypoints3D);
 	void setInterframeMatching(std::vector<int>& matchId, Frame* refFrame);
 
+	// stereo observations of matched tracks, used by the local bundle adjustment
+	void addObservations(const std::vector<cv::Point2f>& left, const std::vector<cv::Point2f>& right,
+		const std::vector<long>& trackIds, long minTrackId = 0);
+	const std::vector<StereoObservation>& getObservations() const;
+	std::vector<long> getTrackIds(const std::vector<int>& keypointIds) const;
+
+	// only the last and the current frame need their images
+	void releaseImages();
+
+	// LK pyramids of both images (window 31x21, 3 levels) and the FAST
+	// candidates; built ahead of tracking by the pipelined odometry, lazily
+	// on first use otherwise
+	void prepareImages();
+	const std::vector<cv::Mat>& getLeftPyramid();
+	const std::vector<cv::Mat>& getRightPyramid();
+
+	// left image at a pyramid level: the LK pyramid's when it is built,
+	// otherwise pyrDown'ed once and cached, so probing a frame stays cheap
+	cv::Mat getLeftLevel(int level);
+
+	int getFrameId() const;
+	long getNewTrackIdBegin() const;
+
+	bool isKeyframe() const;
+	void setKeyframe();
+
+	// camera to world
+	void setPose(const Eigen::Matrix3d& Rwc, const Eigen::Vector3d& twc);
+	void getPose(Eigen::Matrix3d& Rwc, Eigen::Vector3d& twc) const;
+
 
 	void updateFeatures();
 
@@ -46,6 +89,18 @@ private:
     std::vector<int> pointAges_;
     std::vector<int> baseKeyPointIndex_;
 	std::vector<cv::Point3f> keypoints3D_;
+	std::vector<long> trackIds_;
+	long newTrackIdBegin_ = 0;      // tracks detected in this frame start here
+	std::vector<StereoObservation> observations_;
+	Eigen::Matrix3d Rwc_ = Eigen::Matrix3d::Identity();
+	Eigen::Vector3d twc_ = Eigen::Vector3d::Zero();
+	bool keyframe_ = false;
+	std::vector<cv::Mat> pyramidLeft_;
+	std::vector<cv::Mat> pyramidRight_;
+	std::vector<cv::Point2f> candidates_;
+	bool detected_ = false;
+	cv::Mat leftLevel_;
+	int leftLevelIndex_ = -1;
 };
 
 }
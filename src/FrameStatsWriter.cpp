@@ -0,0 +1,105 @@
+#include "FrameStatsWriter.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdarg>
+
+namespace MVSO
+{
+
+	namespace
+	{
+		// "motion gate" -> motion_gate
+		std::string columnName(const char* name)
+		{
+			std::string column = name;
+			for (char& c : column)
+				c = c == ' ' ? '_' : static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+			return column;
+		}
+	}
+
+	FrameStatsWriter::FrameStatsWriter(const std::string & path) : file_(std::fopen(path.c_str(), "w")),
+		hardwareCounters_(PerfCounters::enabled()), rows_(0)
+	{
+		if (!file_)
+			return;
+		buffer_.reserve(2 * BLOCK);
+		buffer_ += "frame,skipped,keyframe,lost,detected,features,bucketed,"
+			"leg_left_right_t0,leg_right_t0_t1,leg_right_left_t1,leg_left_t1_t0,matched,triangulated,"
+			"ransac_iterations,inliers,inlier_ratio,optimizer_iterations";
+		for (int s = 0; s < static_cast<int>(Stage::COUNT); s++)
+			buffer_ += "," + columnName(stageName(static_cast<Stage>(s))) + "_us";
+		if (hardwareCounters_)
+		{
+			for (int s = 0; s < static_cast<int>(Stage::COUNT); s++)
+				for (int i = 0; i < HARDWARE_COUNTERS; i++)
+					buffer_ += "," + columnName(stageName(static_cast<Stage>(s))) + "_"
+						+ columnName(counterName(static_cast<HardwareCounter>(i)));
+		}
+		buffer_ += '\n';
+	}
+
+	FrameStatsWriter::~FrameStatsWriter()
+	{
+		if (!file_)
+			return;
+		flush();
+		std::fclose(file_);
+	}
+
+	bool FrameStatsWriter::isOpen() const
+	{
+		return file_ != nullptr;
+	}
+
+	void FrameStatsWriter::append(const char * format, ...)
+	{
+		char text[64];
+		va_list args;
+		va_start(args, format);
+		const int n = std::vsnprintf(text, sizeof(text), format, args);
+		va_end(args);
+		if (n > 0)
+			buffer_.append(text, std::min(static_cast<size_t>(n), sizeof(text) - 1));
+	}
+
+	void FrameStatsWriter::write(const FrameStats & stats)
+	{
+		if (!file_)
+			return;
+		append("%d,%d,%d,%d,%d,%d,%d", stats.frameId, stats.skipped, stats.keyframe, stats.lost,
+			stats.detected, stats.features, stats.bucketed);
+		for (int leg : stats.circleLegs)
+			append(",%d", leg);
+		append(",%d,%d,%d,%d,%.4f,%d", stats.matched, stats.triangulated, stats.ransacIterations, stats.inliers,
+			stats.inlierRatio, stats.optimizerIterations);
+		for (double us : stats.stageUs)
+			append(",%.1f", us);
+		if (hardwareCounters_)
+		{
+			for (const auto& counters : stats.stageCounters)
+				for (uint64_t count : counters)
+					append(",%llu", static_cast<unsigned long long>(count));
+		}
+		buffer_ += '\n';
+		rows_++;
+		if (buffer_.size() >= BLOCK)
+			flush();
+	}
+
+	void FrameStatsWriter::flush()
+	{
+		if (!file_ || buffer_.empty())
+			return;
+		std::fwrite(buffer_.data(), 1, buffer_.size(), file_);
+		std::fflush(file_);
+		buffer_.clear();
+	}
+
+	long long FrameStatsWriter::rows() const
+	{
+		return rows_;
+	}
+
+}
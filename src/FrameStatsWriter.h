@@ -0,0 +1,41 @@
+#pragma once
+
+#include "Profiler.h"
+
+#include <cstdio>
+#include <string>
+
+namespace MVSO
+{
+
+	// One CSV row per frame: the counters of FrameStats, the time of every
+	// stage in microseconds and, if PerfCounters were enabled before the
+	// writer was made, the hardware counts of every stage. Rows are buffered
+	// and written in 64 KB blocks, so the tracking thread does not wait on the
+	// disk every frame.
+	class FrameStatsWriter
+	{
+	public:
+		// truncates path and writes the header
+		explicit FrameStatsWriter(const std::string& path);
+		~FrameStatsWriter();
+		FrameStatsWriter(const FrameStatsWriter&) = delete;
+		FrameStatsWriter& operator=(const FrameStatsWriter&) = delete;
+
+		bool isOpen() const;
+		void write(const FrameStats& stats);
+		void flush();
+		long long rows() const;
+
+	private:
+		static const size_t BLOCK = 1 << 16;
+
+		void append(const char* format, ...);
+
+		FILE* file_;
+		bool hardwareCounters_;
+		std::string buffer_;
+		long long rows_;
+	};
+
+}
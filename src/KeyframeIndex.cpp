@@ -0,0 +1,111 @@
+#include "KeyframeIndex.h"
+
+#include <algorithm>
+
+namespace MVSO
+{
+
+	KeyframeIndex::KeyframeIndex(const CameraModel & camera, const Options & options)
+		: options_(options), fx_(camera.fx_), fy_(camera.fy_), cx_(camera.cx_), cy_(camera.cy_), bf_(camera.bf_),
+		matcher_(cv::NORM_HAMMING)
+	{
+		orb_ = cv::ORB::create(options_.features, 1.2f, 1);
+	}
+
+	void KeyframeIndex::add(const std::shared_ptr<Frame>& keyframe)
+	{
+		// stereo observations only, uR = uL + bf / Z
+		std::vector<cv::KeyPoint>& keypoints = keypoints_;
+		keypoints.clear();
+		const std::vector<StereoObservation>& observations = keyframe->getObservations();
+		for (size_t i = 0; i < observations.size(); i++)
+		{
+			const StereoObservation& obs = observations[i];
+			if (obs.uR < 0 || obs.uL - obs.uR <= 0.f)
+				continue;
+			keypoints.push_back(cv::KeyPoint(obs.uL, obs.v, 31.f, 0.f, 0.f, 0, static_cast<int>(i)));
+		}
+		if (static_cast<int>(keypoints.size()) < options_.minMatches)
+			return;
+
+		// ORB drops the points too close to the border, class_id keeps the link
+		Entry entry;
+		entry.keyframe = keyframe;
+		orb_->compute(keyframe->getLeftImg(), keypoints, entry.descriptors);
+		for (const cv::KeyPoint& kp : keypoints)
+		{
+			const StereoObservation& obs = observations[kp.class_id];
+			const double Z = bf_ / (obs.uR - obs.uL);
+			entry.points.push_back(cv::Point2f(obs.uL, obs.v));
+			entry.points3D.push_back(cv::Point3f((obs.uL - cx_) * Z / fx_, (obs.v - cy_) * Z / fy_, Z));
+		}
+		if (static_cast<int>(entry.points.size()) < options_.minMatches)
+			return;
+
+		entries_.push_back(std::move(entry));
+		while (static_cast<int>(entries_.size()) > options_.capacity)
+			entries_.pop_front();
+	}
+
+	bool KeyframeIndex::query(Frame & frame, Match & match)
+	{
+		match.keyframe.reset();
+		if (entries_.empty())
+			return false;
+
+		// upright, as the keyframe side
+		cv::Mat image = frame.getLeftImg();
+		cv::Mat descriptors;
+		orb_->detect(image, keypoints_);
+		for (cv::KeyPoint& kp : keypoints_)
+			kp.angle = 0.f;
+		orb_->compute(image, keypoints_, descriptors);
+		if (keypoints_.empty())
+			return false;
+
+		size_t best = 0;
+		for (auto entry = entries_.rbegin(); entry != entries_.rend(); ++entry)
+		{
+			matcher_.knnMatch(descriptors, entry->descriptors, knn_, 2);
+
+			// ratio test, then one query point per keyframe point
+			trainUsed_.assign(entry->points.size(), -1);
+			for (size_t i = 0; i < knn_.size(); i++)
+			{
+				if (knn_[i].empty())
+					continue;
+				const cv::DMatch& m = knn_[i][0];
+				if (m.distance > options_.maxDistance)
+					continue;
+				if (knn_[i].size() > 1 && m.distance >= options_.ratio * knn_[i][1].distance)
+					continue;
+				int& used = trainUsed_[m.trainIdx];
+				if (used < 0 || m.distance < knn_[used][0].distance)
+					used = static_cast<int>(i);
+			}
+			const size_t matches = trainUsed_.size() - std::count(trainUsed_.begin(), trainUsed_.end(), -1);
+			if (matches <= best)
+				continue;
+
+			best = matches;
+			match.keyframe = entry->keyframe;
+			match.keyframePoints.clear();
+			match.points3D.clear();
+			match.points.clear();
+			for (size_t j = 0; j < trainUsed_.size(); j++)
+			{
+				if (trainUsed_[j] < 0)
+					continue;
+				match.keyframePoints.push_back(entry->points[j]);
+				match.points3D.push_back(entry->points3D[j]);
+				match.points.push_back(keypoints_[knn_[trainUsed_[j]][0].queryIdx].pt);
+			}
+
+			// the newest keyframes are the likely ones, stop once one is clearly good
+			if (static_cast<int>(best) >= 3 * options_.minMatches)
+				break;
+		}
+		return static_cast<int>(best) >= options_.minMatches;
+	}
+
+}
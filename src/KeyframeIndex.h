@@ -0,0 +1,74 @@
+#pragma once
+
+#include <deque>
+#include <memory>
+#include <vector>
+
+#include <opencv2/features2d.hpp>
+
+#include "Frame.h"
+#include "cameramodel.h"
+
+namespace MVSO
+{
+
+	// Binary descriptors of the newest keyframes, for relocalization. Every
+	// stereo observation of a keyframe gets a 256 bit ORB descriptor and the
+	// 3D point its disparity gives, in the keyframe camera; a lost frame is
+	// matched against the keyframes newest first, by Hamming distance with a
+	// ratio test, and the best keyframe's 2D-3D correspondences are returned
+	// for a PnP solve. Both sides are described upright on the full resolution
+	// image only: the keyframes searched are seconds old, not a different
+	// scale or roll.
+	class KeyframeIndex
+	{
+	public:
+		struct Options
+		{
+			int capacity = 10;            // keyframes kept, the oldest is dropped
+			int features = 1000;          // ORB features of the query frame
+			float ratio = 0.8f;           // best / second best distance
+			int maxDistance = 64;         // of 256 bits
+			int minMatches = 30;          // to return a keyframe
+		};
+
+		struct Match
+		{
+			std::shared_ptr<Frame> keyframe;
+			std::vector<cv::Point2f> keyframePoints;     // left image of the keyframe
+			std::vector<cv::Point3f> points3D;           // keyframe camera
+			std::vector<cv::Point2f> points;             // left image of the query frame
+		};
+
+		KeyframeIndex(const CameraModel& camera, const Options& options);
+
+		// describes the keyframe's stereo observations, its left image must
+		// still be loaded
+		void add(const std::shared_ptr<Frame>& keyframe);
+
+		// false when no keyframe has minMatches matches
+		bool query(Frame& frame, Match& match);
+
+		size_t size() const { return entries_.size(); }
+
+		Options options_;
+
+	private:
+		struct Entry
+		{
+			std::shared_ptr<Frame> keyframe;
+			cv::Mat descriptors;                         // one 32 byte row per point
+			std::vector<cv::Point2f> points;
+			std::vector<cv::Point3f> points3D;
+		};
+
+		const double fx_, fy_, cx_, cy_, bf_;
+		cv::Ptr<cv::ORB> orb_;
+		cv::BFMatcher matcher_;
+		std::deque<Entry> entries_;
+		std::vector<cv::KeyPoint> keypoints_;
+		std::vector<std::vector<cv::DMatch>> knn_;
+		std::vector<int> trainUsed_;
+	};
+
+}
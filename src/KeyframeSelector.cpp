@@ -0,0 +1,83 @@
+#include "KeyframeSelector.h"
+
+#include <algorithm>
+
+namespace MVSO
+{
+
+	KeyframeSelector::KeyframeSelector(const Options & options) : options_(options)
+	{
+	}
+
+	void KeyframeSelector::setKeyframe(const std::shared_ptr<Frame>& keyframe)
+	{
+		keyframe_ = keyframe;
+		frames_ = 0;
+		keyframeTracks_.clear();
+		indexedObservations_ = 0;
+		indexKeyframeTracks();
+	}
+
+	void KeyframeSelector::indexKeyframeTracks()
+	{
+		const std::vector<StereoObservation>& observations = keyframe_->getObservations();
+		for (; indexedObservations_ < observations.size(); indexedObservations_++)
+		{
+			const StereoObservation& obs = observations[indexedObservations_];
+			keyframeTracks_[obs.trackId] = Eigen::Vector2f(obs.uL, obs.v);
+		}
+	}
+
+	KeyframeSelector::Decision KeyframeSelector::evaluate(const Frame & frame)
+	{
+		trackIds_.clear();
+		points_.clear();
+		for (const StereoObservation& obs : frame.getObservations())
+		{
+			trackIds_.push_back(obs.trackId);
+			points_.push_back(cv::Point2f(obs.uL, obs.v));
+		}
+		return evaluate(frame, trackIds_, points_);
+	}
+
+	KeyframeSelector::Decision KeyframeSelector::evaluate(const Frame & frame, const std::vector<long>& trackIds,
+		const std::vector<cv::Point2f>& points)
+	{
+		Decision decision;
+		if (!keyframe_)
+		{
+			decision.keyframe = true;
+			return decision;
+		}
+		indexKeyframeTracks();
+
+		parallax_.clear();
+		for (size_t i = 0; i < trackIds.size(); i++)
+		{
+			auto it = keyframeTracks_.find(trackIds[i]);
+			if (it != keyframeTracks_.end())
+				parallax_.push_back((Eigen::Vector2f(points[i].x, points[i].y) - it->second).norm());
+		}
+		if (!keyframeTracks_.empty())
+			decision.trackedRatio = float(parallax_.size()) / keyframeTracks_.size();
+		if (!parallax_.empty())
+		{
+			std::nth_element(parallax_.begin(), parallax_.begin() + parallax_.size() / 2, parallax_.end());
+			decision.parallax = parallax_[parallax_.size() / 2];
+		}
+
+		Eigen::Matrix3d Rwk, Rwc;
+		Eigen::Vector3d twk, twc;
+		keyframe_->getPose(Rwk, twk);
+		frame.getPose(Rwc, twc);
+		decision.translation = (twc - twk).norm();
+		decision.frames = ++frames_;
+
+		decision.keyframe = decision.trackedRatio < options_.minTrackedRatio
+			|| decision.parallax > options_.maxParallax
+			|| decision.translation > options_.maxTranslation
+			|| decision.frames >= options_.maxFrames;
+		return decision;
+	}
+
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <Eigen/Core>
+
+#include "Frame.h"
+
+namespace MVSO
+{
+
+	// Decides which tracked frames become keyframes. A frame is promoted once it
+	// has drifted far enough from the reference keyframe in any of four ways:
+	// too few of the keyframe's tracks are still seen, the image motion of the
+	// shared tracks is large, the camera has moved far, or too many frames have
+	// passed. Only keyframes enter the Map and the local BA, so their cost
+	// follows the camera motion instead of the frame rate.
+	class KeyframeSelector
+	{
+	public:
+		struct Options
+		{
+			float minTrackedRatio = 0.6f;     // of the keyframe's tracks seen by the frame
+			float maxParallax = 40.f;         // median track displacement, in pixels
+			double maxTranslation = 3.0;      // distance to the keyframe, in meters
+			int maxFrames = 10;               // frames evaluated since the keyframe, skipped ones not counted
+		};
+
+		struct Decision
+		{
+			bool keyframe = false;
+			float trackedRatio = 1.f;
+			float parallax = 0.f;
+			double translation = 0.0;
+			int frames = 0;
+		};
+
+		KeyframeSelector() = default;
+		explicit KeyframeSelector(const Options& options);
+
+		void setKeyframe(const std::shared_ptr<Frame>& keyframe);
+		const std::shared_ptr<Frame>& getKeyframe() const { return keyframe_; }
+
+		// measures the frame, through its stereo observations, against the
+		// reference keyframe, whose pose and observations must be up to date
+		Decision evaluate(const Frame& frame);
+
+		// same with the tracks given explicitly, for frames tracked on the left
+		// image only
+		Decision evaluate(const Frame& frame, const std::vector<long>& trackIds, const std::vector<cv::Point2f>& points);
+
+		Options options_;
+
+	private:
+		// the keyframe gets observations of its own new tracks one frame late,
+		// so they are indexed on demand
+		void indexKeyframeTracks();
+
+		std::shared_ptr<Frame> keyframe_;
+		std::unordered_map<long, Eigen::Vector2f> keyframeTracks_;   // track id -> (uL, v)
+		size_t indexedObservations_ = 0;
+		std::vector<float> parallax_;
+		std::vector<long> trackIds_;
+		std::vector<cv::Point2f> points_;
+		int frames_ = 0;                  // evaluated since the keyframe
+	};
+
+}
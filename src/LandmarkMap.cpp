@@ -0,0 +1,117 @@
+#include "LandmarkMap.h"
+
+#include <cmath>
+
+namespace MVSO
+{
+
+	LandmarkMap::LandmarkMap(const CameraModel & camera, const Options & options)
+		: options_(options), fx_(camera.fx_), fy_(camera.fy_), cx_(camera.cx_), cy_(camera.cy_),
+		bf_(std::abs(camera.bf_)), established_(0)
+	{
+	}
+
+	void LandmarkMap::initialize(Landmark & landmark, double invDepth, double invDepthVar, const Eigen::Vector3d & ray,
+		const Eigen::Matrix3d & Rwc, const Eigen::Vector3d & twc)
+	{
+		landmark.invDepth = invDepth;
+		landmark.invDepthVar = invDepthVar;
+		landmark.position = Rwc * (ray / invDepth) + twc;
+	}
+
+	void LandmarkMap::fuse(long trackId, float uL, float v, float uR,
+		const Eigen::Matrix3d & Rwc, const Eigen::Vector3d & twc, int frameId)
+	{
+		// uR = uL - bf / Z with bf = |baseline| * fx, so 1 / Z = (uL - uR) / bf
+		const double disparity = uL - uR;
+		auto it = landmarks_.find(trackId);
+		if (disparity < options_.minDisparity)
+		{
+			if (it != landmarks_.end())
+				it->second.lastSeen = it->second.lastFused = frameId;
+			return;
+		}
+		const double measured = disparity / bf_;
+		const double sigma = options_.disparitySigma / bf_;
+		const double measuredVar = sigma * sigma;
+		const Eigen::Vector3d ray((uL - cx_) / fx_, (v - cy_) / fy_, 1.0);
+
+		if (it == landmarks_.end())
+		{
+			Landmark& landmark = landmarks_[trackId];
+			initialize(landmark, measured, measuredVar, ray, Rwc, twc);
+			landmark.observations = 1;
+			landmark.lastSeen = landmark.lastFused = frameId;
+			landmark.established = false;
+			return;
+		}
+
+		Landmark& landmark = it->second;
+		landmark.lastSeen = landmark.lastFused = frameId;
+		const Eigen::Vector3d Xc = Rwc.transpose() * (landmark.position - twc);
+		const double predicted = Xc.z() > 0 ? 1.0 / Xc.z() : -1.0;
+		const double innovation = measured - predicted;
+		const double innovationVar = landmark.invDepthVar + measuredVar;
+		if (predicted <= 0 || innovation * innovation > options_.gateSigmas * options_.gateSigmas * innovationVar)
+		{
+			// inconsistent with the fused depth, most likely a wrong match: start over
+			initialize(landmark, measured, measuredVar, ray, Rwc, twc);
+			landmark.observations = 1;
+			if (landmark.established)
+				established_--;
+			landmark.established = false;
+			return;
+		}
+
+		const double gain = landmark.invDepthVar / innovationVar;
+		initialize(landmark, predicted + gain * innovation, (1.0 - gain) * landmark.invDepthVar, ray, Rwc, twc);
+		landmark.observations++;
+		if (!landmark.established && landmark.observations >= options_.minObservations
+			&& std::sqrt(landmark.invDepthVar) < options_.maxRelativeSigma * landmark.invDepth)
+		{
+			landmark.established = true;
+			established_++;
+		}
+	}
+
+	void LandmarkMap::touch(long trackId, int frameId)
+	{
+		auto it = landmarks_.find(trackId);
+		if (it != landmarks_.end())
+			it->second.lastSeen = frameId;
+	}
+
+	const LandmarkMap::Landmark * LandmarkMap::find(long trackId) const
+	{
+		auto it = landmarks_.find(trackId);
+		return it == landmarks_.end() ? nullptr : &it->second;
+	}
+
+	bool LandmarkMap::established(long trackId) const
+	{
+		const Landmark* landmark = find(trackId);
+		return landmark && landmark->established;
+	}
+
+	bool LandmarkMap::needsStereo(long trackId, int frameId) const
+	{
+		const Landmark* landmark = find(trackId);
+		return !landmark || !landmark->established || frameId - landmark->lastFused >= options_.refreshInterval;
+	}
+
+	void LandmarkMap::cull(int frameId)
+	{
+		for (auto it = landmarks_.begin(); it != landmarks_.end();)
+		{
+			if (frameId - it->second.lastSeen > options_.maxAge)
+			{
+				if (it->second.established)
+					established_--;
+				it = landmarks_.erase(it);
+			}
+			else
+				++it;
+		}
+	}
+
+}
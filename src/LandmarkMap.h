@@ -0,0 +1,76 @@
+#pragma once
+
+#include <unordered_map>
+#include <Eigen/Core>
+
+#include "cameramodel.h"
+
+namespace MVSO
+{
+
+	// Persistent 3D points keyed by feature track id. Each stereo observation of
+	// a track is fused into its landmark by a scalar Kalman filter on inverse
+	// depth along the current viewing ray, so the point gets sharper instead of
+	// being re-triangulated from one disparity every frame. Once enough
+	// observations agree, the landmark is established and tracking stops
+	// matching it into the right image, except every refreshInterval frames,
+	// when a stereo observation re-checks it against the innovation gate.
+	class LandmarkMap
+	{
+	public:
+		struct Options
+		{
+			float disparitySigma = 0.5f;       // stereo matching noise, in pixels
+			float minDisparity = 0.5f;         // to initialize a landmark, in pixels
+			int minObservations = 3;           // fused observations to become established
+			float maxRelativeSigma = 0.1f;     // inverse depth std / inverse depth to become established
+			float gateSigmas = 3.f;            // innovation gate, a failing observation restarts the filter
+			int maxAge = 5;                    // frames a landmark survives without being observed
+			int refreshInterval = 5;           // frames an established landmark goes without stereo
+		};
+
+		struct Landmark
+		{
+			Eigen::Vector3d position;          // world
+			double invDepth;                   // in the camera that observed it last
+			double invDepthVar;
+			int observations;
+			int lastSeen;                      // frame id
+			int lastFused;                     // frame id of the last stereo observation
+			bool established;
+		};
+
+		LandmarkMap(const CameraModel& camera, const Options& options);
+
+		// fuses the stereo observation (uL, v, uR) made by the camera at (Rwc, twc)
+		void fuse(long trackId, float uL, float v, float uR,
+			const Eigen::Matrix3d& Rwc, const Eigen::Vector3d& twc, int frameId);
+
+		// keeps a landmark alive while it is tracked without stereo
+		void touch(long trackId, int frameId);
+
+		const Landmark* find(long trackId) const;
+		bool established(long trackId) const;
+
+		// whether the track should be matched into the right image at frameId:
+		// not established yet, or established and due for a refresh
+		bool needsStereo(long trackId, int frameId) const;
+
+		// drops landmarks not observed within maxAge frames of frameId
+		void cull(int frameId);
+
+		size_t size() const { return landmarks_.size(); }
+		int numEstablished() const { return established_; }
+
+		Options options_;
+
+	private:
+		void initialize(Landmark& landmark, double invDepth, double invDepthVar, const Eigen::Vector3d& ray,
+			const Eigen::Matrix3d& Rwc, const Eigen::Vector3d& twc);
+
+		const double fx_, fy_, cx_, cy_, bf_;
+		std::unordered_map<long, Landmark> landmarks_;
+		int established_;
+	};
+
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cmath>
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+
+namespace MVSO
+{
+
+	inline Eigen::Matrix3d skew(const Eigen::Vector3d& v)
+	{
+		Eigen::Matrix3d S;
+		S << 0, -v(2), v(1),
+			v(2), 0, -v(0),
+			-v(1), v(0), 0;
+		return S;
+	}
+
+	// T <- exp([rho, phi]) * T
+	inline void applyLeftIncrement(const Eigen::Matrix<double, 6, 1>& delta, Eigen::Matrix3d& R, Eigen::Vector3d& t)
+	{
+		const Eigen::Vector3d rho = delta.head<3>();
+		const Eigen::Vector3d phi = delta.tail<3>();
+		const double theta = phi.norm();
+		const Eigen::Matrix3d Phi = skew(phi);
+
+		Eigen::Matrix3d dR, V;
+		if (theta < 1e-10)
+		{
+			dR = Eigen::Matrix3d::Identity() + Phi;
+			V = Eigen::Matrix3d::Identity() + 0.5 * Phi;
+		}
+		else
+		{
+			dR = Eigen::AngleAxisd(theta, phi / theta).toRotationMatrix();
+			V = Eigen::Matrix3d::Identity()
+				+ (1.0 - std::cos(theta)) / (theta * theta) * Phi
+				+ (theta - std::sin(theta)) / (theta * theta * theta) * Phi * Phi;
+		}
+
+		R = dR * R;
+		t = dR * t + V * rho;
+	}
+
+}
@@ -0,0 +1,395 @@
+#include "LocalBundleAdjuster.h"
+#include "Lie.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <unordered_map>
+#include <Eigen/Cholesky>
+#include <Eigen/LU>
+
+namespace MVSO
+{
+
+	namespace
+	{
+		typedef Eigen::Matrix<double, 6, 6> Matrix6d;
+		typedef Eigen::Matrix<double, 6, 1> Vector6d;
+		typedef Eigen::Matrix<double, 6, 3> Matrix63d;
+		typedef Eigen::Matrix<double, 3, 6> Matrix36d;
+
+		struct Residual
+		{
+			int camera;
+			int landmark;
+			Eigen::Vector3d z;     // uL, v, uR
+		};
+
+		// world to camera poses and landmark positions
+		struct State
+		{
+			std::vector<Eigen::Matrix3d> Rcw;
+			std::vector<Eigen::Vector3d> tcw;
+			std::vector<Eigen::Vector3d> points;
+		};
+
+		// Huber weight and cost for squared error e2
+		inline void huber(double e2, double delta, double& weight, double& rho)
+		{
+			if (e2 <= delta * delta)
+			{
+				weight = 1.0;
+				rho = e2;
+			}
+			else
+			{
+				double e = std::sqrt(e2);
+				weight = delta / e;
+				rho = 2.0 * delta * e - delta * delta;
+			}
+		}
+	}
+
+	LocalBundleAdjuster::LocalBundleAdjuster(const CameraModel & camera, const Options & options, TaskScheduler & scheduler)
+		: options_(options), fx_(camera.fx_), fy_(camera.fy_), cx_(camera.cx_), cy_(camera.cy_), bf_(camera.bf_),
+		scheduler_(scheduler), hasPending_(false), running_(false), hasResult_(false)
+	{
+	}
+
+	LocalBundleAdjuster::~LocalBundleAdjuster()
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		hasPending_ = false;
+		finished_.wait(lock, [this] { return !running_; });
+	}
+
+	bool LocalBundleAdjuster::idle()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		return !hasPending_ && !running_ && !hasResult_;
+	}
+
+	void LocalBundleAdjuster::submit(std::vector<WindowFrame>&& window)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			pending_ = std::move(window);
+			hasPending_ = true;
+			// a running task picks the new window up when it is done
+			if (running_)
+				return;
+			running_ = true;
+		}
+		scheduler_.spawn([this] { run(); });
+	}
+
+	bool LocalBundleAdjuster::fetchResult(Result & result)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (!hasResult_)
+			return false;
+		std::swap(result, result_);
+		hasResult_ = false;
+		return true;
+	}
+
+	void LocalBundleAdjuster::run()
+	{
+		std::vector<WindowFrame> window;
+		Result result;
+		while (true)
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				if (!hasPending_)
+				{
+					running_ = false;
+					finished_.notify_all();
+					return;
+				}
+				window.swap(pending_);
+				hasPending_ = false;
+			}
+
+			{
+				// beside the frames, not part of the one that runs it
+				MVSO_PROFILE_FRAME(nullptr);
+				MVSO_SCOPED_TIMER(Stage::LOCAL_BA);
+				optimize(window, result);
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				std::swap(result_, result);
+				hasResult_ = true;
+			}
+		}
+	}
+
+	Eigen::Vector3d LocalBundleAdjuster::project(const Eigen::Vector3d & X) const
+	{
+		const double zinv = 1.0 / X.z();
+		const double uL = fx_ * X.x() * zinv + cx_;
+		return Eigen::Vector3d(uL, fy_ * X.y() * zinv + cy_, uL + bf_ * zinv);
+	}
+
+	void LocalBundleAdjuster::jacobians(const Eigen::Matrix3d & Rcw, const Eigen::Vector3d & X, bool stereo,
+		Matrix36d & Jc, Eigen::Matrix3d & Jp) const
+	{
+		const double zinv = 1.0 / X.z();
+		const double xz = X.x() * zinv, yz = X.y() * zinv;
+		Eigen::Matrix3d Jproj;
+		Jproj << fx_ * zinv, 0, -fx_ * xz * zinv,
+			0, fy_ * zinv, -fy_ * yz * zinv,
+			fx_ * zinv, 0, (-fx_ * xz - bf_ * zinv) * zinv;
+		if (!stereo)
+			Jproj.row(2).setZero();
+
+		// dX = [I, -[X]x] * [rho, phi] for the left perturbation of T_cw
+		Matrix36d dX;
+		dX.leftCols<3>().setIdentity();
+		dX.rightCols<3>() = -skew(X);
+		Jc = Jproj * dX;
+		Jp = Jproj * Rcw;
+	}
+
+	void LocalBundleAdjuster::optimize(const std::vector<WindowFrame>& window, Result & result) const
+	{
+		typedef std::chrono::steady_clock Clock;
+		const Clock::time_point start = Clock::now();
+		const int numCameras = static_cast<int>(window.size());
+
+		result = Result();
+		for (const WindowFrame& frame : window)
+		{
+			result.frameIds.push_back(frame.frameId);
+			result.Rwc.push_back(frame.Rwc);
+			result.twc.push_back(frame.twc);
+		}
+		if (numCameras < 2)
+			return;
+
+		State state;
+		for (const WindowFrame& frame : window)
+		{
+			state.Rcw.push_back(frame.Rwc.transpose());
+			state.tcw.push_back(-frame.Rwc.transpose() * frame.twc);
+		}
+
+		// ------------------------------------------------
+		// landmarks: tracks seen by enough frames, placed at their first stereo
+		// observation with a usable disparity (uR = uL + bf / Z); observations
+		// without a right match (uR < 0) only constrain (uL, v)
+		// ------------------------------------------------
+		std::unordered_map<long, int> trackFrames;
+		for (const WindowFrame& frame : window)
+			for (const StereoObservation& obs : frame.observations)
+				trackFrames[obs.trackId]++;
+
+		std::unordered_map<long, int> landmarkIndex;
+		std::vector<Residual> residuals;
+		for (int c = 0; c < numCameras; c++)
+		{
+			for (const StereoObservation& obs : window[c].observations)
+			{
+				if (trackFrames[obs.trackId] < options_.minObservations)
+					continue;
+
+				auto it = landmarkIndex.find(obs.trackId);
+				if (it == landmarkIndex.end())
+				{
+					const double disparity = obs.uL - obs.uR;
+					if (obs.uR < 0 || disparity < options_.minDisparity)
+						continue;
+					const double Z = -bf_ / disparity;
+					const Eigen::Vector3d X((obs.uL - cx_) * Z / fx_, (obs.v - cy_) * Z / fy_, Z);
+					it = landmarkIndex.emplace(obs.trackId, static_cast<int>(state.points.size())).first;
+					state.points.push_back(window[c].Rwc * X + window[c].twc);
+				}
+
+				Residual r;
+				r.camera = c;
+				r.landmark = it->second;
+				r.z = Eigen::Vector3d(obs.uL, obs.v, obs.uR);
+				residuals.push_back(r);
+			}
+		}
+
+		const int numLandmarks = static_cast<int>(state.points.size());
+		std::vector<std::vector<int> > byLandmark(numLandmarks);
+		for (int k = 0; k < static_cast<int>(residuals.size()); k++)
+			byLandmark[residuals[k].landmark].push_back(k);
+		result.landmarks = numLandmarks;
+		result.observations = static_cast<int>(residuals.size());
+		if (residuals.empty())
+			return;
+
+		const double delta = options_.pixelHuber;
+		auto error = [&](const Eigen::Vector3d& X, const Residual& r) {
+			Eigen::Vector3d e = project(X) - r.z;
+			if (r.z(2) < 0)
+				e(2) = 0.0;
+			return e;
+		};
+		auto evaluate = [&](const State& s) {
+			double cost = 0.0;
+			for (const Residual& r : residuals)
+			{
+				const Eigen::Vector3d X = s.Rcw[r.camera] * s.points[r.landmark] + s.tcw[r.camera];
+				if (X.z() <= 1e-3)
+					continue;
+				double w, rho;
+				huber(error(X, r).squaredNorm(), delta, w, rho);
+				cost += rho;
+			}
+			return cost;
+		};
+
+		// ------------------------------------------------
+		// Levenberg-Marquardt on the Schur complement
+		// ------------------------------------------------
+		const int numFree = numCameras - 1;          // camera 0 fixes the gauge
+		const int dim = 6 * numFree;
+		std::vector<Matrix6d> U(numCameras);
+		std::vector<Vector6d> gc(numCameras);
+		std::vector<Eigen::Matrix3d> V(numLandmarks), Vinv(numLandmarks);
+		std::vector<Eigen::Vector3d> gp(numLandmarks), dp(numLandmarks);
+		std::vector<Matrix63d> W(residuals.size());
+		std::vector<char> usable(numLandmarks);
+		Eigen::MatrixXd S(dim, dim);
+		Eigen::VectorXd rhs(dim);
+
+		double cost = evaluate(state);
+		result.initialCost = cost;
+		double lambda = 1e-4;
+		State trial = state;
+
+		for (int iteration = 0; iteration < options_.maxIterations; iteration++)
+		{
+			result.iterations++;
+
+			// normal equations, camera and landmark blocks
+			std::fill(U.begin(), U.end(), Matrix6d::Zero());
+			std::fill(gc.begin(), gc.end(), Vector6d::Zero());
+			std::fill(V.begin(), V.end(), Eigen::Matrix3d::Zero());
+			std::fill(gp.begin(), gp.end(), Eigen::Vector3d::Zero());
+			for (size_t k = 0; k < residuals.size(); k++)
+			{
+				const Residual& r = residuals[k];
+				const Eigen::Matrix3d& R = state.Rcw[r.camera];
+				const Eigen::Vector3d X = R * state.points[r.landmark] + state.tcw[r.camera];
+				if (X.z() <= 1e-3)
+				{
+					W[k].setZero();
+					continue;
+				}
+				const Eigen::Vector3d e = error(X, r);
+				double w, rho;
+				huber(e.squaredNorm(), delta, w, rho);
+
+				Matrix36d Jc;
+				Eigen::Matrix3d Jp;
+				jacobians(R, X, r.z(2) >= 0, Jc, Jp);
+
+				U[r.camera].noalias() += w * Jc.transpose() * Jc;
+				gc[r.camera].noalias() += w * Jc.transpose() * e;
+				V[r.landmark].noalias() += w * Jp.transpose() * Jp;
+				gp[r.landmark].noalias() += w * Jp.transpose() * e;
+				W[k].noalias() = w * Jc.transpose() * Jp;
+			}
+
+			// reduced camera system S * dc = rhs
+			S.setZero();
+			for (int c = 1; c < numCameras; c++)
+			{
+				Matrix6d Ud = U[c];
+				Ud.diagonal() *= 1.0 + lambda;
+				Ud.diagonal().array() += 1e-9;
+				S.block<6, 6>(6 * (c - 1), 6 * (c - 1)) = Ud;
+				rhs.segment<6>(6 * (c - 1)) = -gc[c];
+			}
+			for (int l = 0; l < numLandmarks; l++)
+			{
+				Eigen::Matrix3d Vd = V[l];
+				Vd.diagonal() *= 1.0 + lambda;
+				Vd.diagonal().array() += 1e-9;
+				bool invertible;
+				double determinant;
+				Vd.computeInverseAndDetWithCheck(Vinv[l], determinant, invertible);
+				usable[l] = invertible;
+				if (!invertible)
+					continue;
+
+				const std::vector<int>& ks = byLandmark[l];
+				for (int a : ks)
+				{
+					const int ca = residuals[a].camera;
+					if (ca == 0)
+						continue;
+					const Matrix63d WV = W[a] * Vinv[l];
+					rhs.segment<6>(6 * (ca - 1)).noalias() += WV * gp[l];
+					for (int b : ks)
+					{
+						const int cb = residuals[b].camera;
+						if (cb == 0)
+							continue;
+						S.block<6, 6>(6 * (ca - 1), 6 * (cb - 1)).noalias() -= WV * W[b].transpose();
+					}
+				}
+			}
+
+			const Eigen::VectorXd dc = S.ldlt().solve(rhs);
+			if (!dc.allFinite())
+				break;
+
+			// back substitution for the landmarks
+			for (int l = 0; l < numLandmarks; l++)
+			{
+				dp[l].setZero();
+				if (!usable[l])
+					continue;
+				Eigen::Vector3d b = -gp[l];
+				for (int k : byLandmark[l])
+				{
+					const int c = residuals[k].camera;
+					if (c > 0)
+						b.noalias() -= W[k].transpose() * dc.segment<6>(6 * (c - 1));
+				}
+				dp[l] = Vinv[l] * b;
+			}
+
+			trial = state;
+			for (int c = 1; c < numCameras; c++)
+				applyLeftIncrement(dc.segment<6>(6 * (c - 1)), trial.Rcw[c], trial.tcw[c]);
+			for (int l = 0; l < numLandmarks; l++)
+				trial.points[l] += dp[l];
+
+			const double trialCost = evaluate(trial);
+			if (trialCost < cost)
+			{
+				const double decrease = (cost - trialCost) / std::max(cost, 1e-12);
+				std::swap(state, trial);
+				cost = trialCost;
+				lambda = std::max(lambda * 0.1, 1e-7);
+				if (decrease < options_.minRelativeDecrease)
+					break;
+			}
+			else
+			{
+				lambda *= 10.0;
+				if (lambda > 1e8)
+					break;
+			}
+		}
+
+		result.finalCost = cost;
+		for (int c = 0; c < numCameras; c++)
+		{
+			result.Rwc[c] = state.Rcw[c].transpose();
+			result.twc[c] = -state.Rcw[c].transpose() * state.tcw[c];
+		}
+		result.solveTimeMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	}
+
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <Eigen/Core>
+
+#include "cameramodel.h"
+#include "Frame.h"
+#include "TaskScheduler.h"
+
+namespace MVSO
+{
+
+	// Sliding-window bundle adjustment over the newest keyframes and the tracks
+	// they share, with stereo (uL, v, uR) residuals and Huber weights. Landmarks
+	// are eliminated with the Schur complement, so each LM step only factorizes
+	// the dense 6(N-1) x 6(N-1) camera system. The oldest pose of the window is
+	// held fixed.
+	//
+	// The solve runs as a task on the odometry's scheduler: submit() hands a
+	// window over and returns at once, fetchResult() picks the finished one up
+	// at a frame boundary.
+	class LocalBundleAdjuster
+	{
+	public:
+		struct Options
+		{
+			int maxIterations = 5;
+			float pixelHuber = 2.80f;          // sqrt(chi2(0.95, 3 dof)), in pixels
+			float minDisparity = 1.0f;         // to initialize a landmark, in pixels
+			int minObservations = 2;           // frames that must see a track
+			double minRelativeDecrease = 1e-6;
+		};
+
+		// a keyframe of the window, pose is camera to world
+		struct WindowFrame
+		{
+			int frameId;
+			Eigen::Matrix3d Rwc;
+			Eigen::Vector3d twc;
+			std::vector<StereoObservation> observations;
+		};
+
+		// optimized poses in window order, and what the solve did
+		struct Result
+		{
+			std::vector<int> frameIds;
+			std::vector<Eigen::Matrix3d> Rwc;
+			std::vector<Eigen::Vector3d> twc;
+			int landmarks = 0;
+			int observations = 0;
+			int iterations = 0;
+			double initialCost = 0.0;
+			double finalCost = 0.0;
+			double solveTimeMs = 0.0;
+		};
+
+		LocalBundleAdjuster(const CameraModel& camera, const Options& options, TaskScheduler& scheduler);
+
+		// waits for a running solve, drops a queued one
+		~LocalBundleAdjuster();
+
+		// nothing queued or running, and the last result has been fetched
+		bool idle();
+
+		// window is ordered oldest first
+		void submit(std::vector<WindowFrame>&& window);
+
+		bool fetchResult(Result& result);
+
+		// the solve itself, on the calling thread
+		void optimize(const std::vector<WindowFrame>& window, Result& result) const;
+
+		// (uL, v, uR) of a point X in camera coordinates
+		Eigen::Vector3d project(const Eigen::Vector3d& X) const;
+
+		// Jacobians of project(X), X = Rcw * P + tcw, for the left perturbation
+		// T_cw <- exp([rho, phi]) * T_cw (Jc) and for the world point P (Jp);
+		// the uR row is zero for an observation without a right match
+		void jacobians(const Eigen::Matrix3d& Rcw, const Eigen::Vector3d& X, bool stereo,
+			Eigen::Matrix<double, 3, 6>& Jc, Eigen::Matrix3d& Jp) const;
+
+	private:
+		void run();
+
+		const Options options_;
+		const double fx_, fy_, cx_, cy_, bf_;
+		TaskScheduler& scheduler_;
+
+		std::mutex mutex_;
+		std::condition_variable finished_;
+		std::vector<WindowFrame> pending_;
+		Result result_;
+		bool hasPending_;
+		bool running_;         // a task is solving or about to
+		bool hasResult_;
+	};
+
+}
@@ -0,0 +1,195 @@
+#include "Logger.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <streambuf>
+
+namespace MVSO
+{
+
+	std::atomic<int> Logger::level_(static_cast<int>(LogLevel::INFO));
+
+	namespace
+	{
+		// fixed buffer, anything past its end is discarded
+		class LineBuffer : public std::streambuf
+		{
+		public:
+			LineBuffer() { reset(); }
+			void reset() { setp(text_, text_ + sizeof(text_)); }
+			const char* data() const { return pbase(); }
+			size_t size() const { return static_cast<size_t>(pptr() - pbase()); }
+		protected:
+			int_type overflow(int_type c) override { return traits_type::not_eof(c); }
+		private:
+			char text_[256];
+		};
+
+		struct LineStream
+		{
+			LineBuffer buffer;
+			std::ostream stream;
+			LineStream() : stream(&buffer) {}
+		};
+
+		LineStream& lineStream()
+		{
+			thread_local LineStream line;
+			return line;
+		}
+
+		const char* prefix(LogLevel level)
+		{
+			switch (level)
+			{
+			case LogLevel::WARN: return "[WARNING] ";
+			case LogLevel::ERROR: return "[ERROR] ";
+			default: return "";
+			}
+		}
+	}
+
+	Logger::Logger() : slots_(new Slot[CAPACITY]), tail_(0), written_(0), dropped_(0), stop_(false)
+	{
+		for (size_t i = 0; i < CAPACITY; i++)
+			slots_[i].sequence.store(i, std::memory_order_relaxed);
+		thread_ = std::thread(&Logger::drain, this);
+	}
+
+	Logger::~Logger()
+	{
+		stop_ = true;
+		thread_.join();
+	}
+
+	Logger & Logger::instance()
+	{
+		static Logger logger;
+		return logger;
+	}
+
+	void Logger::setLevel(LogLevel level)
+	{
+		level_.store(static_cast<int>(level), std::memory_order_relaxed);
+	}
+
+	LogLevel Logger::level()
+	{
+		return static_cast<LogLevel>(level_.load(std::memory_order_relaxed));
+	}
+
+	bool Logger::parseLevel(const std::string & name, LogLevel & level)
+	{
+		std::string lower = name;
+		std::transform(lower.begin(), lower.end(), lower.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+		static const char* names[] = { "trace", "debug", "info", "warn", "error", "off" };
+		for (int i = 0; i < 6; i++)
+		{
+			if (lower == names[i])
+			{
+				level = static_cast<LogLevel>(i);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	std::ostream & Logger::stream()
+	{
+		LineStream& line = lineStream();
+		line.buffer.reset();
+		line.stream.clear();
+		line.stream.flags(std::ios::dec | std::ios::skipws);
+		line.stream.precision(6);
+		return line.stream;
+	}
+
+	void Logger::commit(LogLevel level)
+	{
+		const LineStream& line = lineStream();
+		instance().push(level, line.buffer.data(), line.buffer.size());
+	}
+
+	void Logger::push(LogLevel level, const char * text, size_t length)
+	{
+		// bounded MPMC ring: a slot whose sequence equals the position is free
+		// for that position, and becomes readable at position + 1
+		size_t pos = tail_.load(std::memory_order_relaxed);
+		Slot* slot;
+		while (true)
+		{
+			slot = &slots_[pos & (CAPACITY - 1)];
+			const size_t sequence = slot->sequence.load(std::memory_order_acquire);
+			const std::ptrdiff_t diff = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(pos);
+			if (diff == 0)
+			{
+				if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					break;
+			}
+			else if (diff < 0)
+			{
+				dropped_.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+			else
+				pos = tail_.load(std::memory_order_relaxed);
+		}
+		slot->level = level;
+		slot->length = static_cast<unsigned short>(std::min(length, LINE));
+		std::memcpy(slot->text, text, slot->length);
+		slot->sequence.store(pos + 1, std::memory_order_release);
+	}
+
+	void Logger::drain()
+	{
+		size_t head = 0;
+		while (true)
+		{
+			// lines are written in the order their slots were claimed
+			bool wrote = false, out = false, err = false;
+			while (true)
+			{
+				Slot& slot = slots_[head & (CAPACITY - 1)];
+				if (slot.sequence.load(std::memory_order_acquire) != head + 1)
+					break;
+				FILE* file = slot.level >= LogLevel::WARN ? stderr : stdout;
+				std::fputs(prefix(slot.level), file);
+				std::fwrite(slot.text, 1, slot.length, file);
+				std::fputc('\n', file);
+				(file == stderr ? err : out) = true;
+				slot.sequence.store(head + CAPACITY, std::memory_order_release);
+				head++;
+				wrote = true;
+			}
+			if (out)
+				std::fflush(stdout);
+			if (err)
+				std::fflush(stderr);
+			written_.store(head, std::memory_order_release);
+
+			if (!wrote)
+			{
+				if (stop_.load() && tail_.load() == head)
+					return;
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+		}
+	}
+
+	void Logger::flush()
+	{
+		Logger& logger = instance();
+		const size_t tail = logger.tail_.load();
+		while (logger.written_.load(std::memory_order_acquire) < tail)
+			std::this_thread::sleep_for(std::chrono::microseconds(200));
+	}
+
+	long long Logger::dropped()
+	{
+		return instance().dropped_.load(std::memory_order_relaxed);
+	}
+
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <thread>
+
+namespace MVSO
+{
+
+	enum class LogLevel { TRACE, DEBUG, INFO, WARN, ERROR, OFF };
+
+	// Leveled logging off the calling thread. A line is formatted into a
+	// buffer of the calling thread, copied into a slot of a bounded lock-free
+	// ring and written out by a background thread, which flushes once per
+	// batch instead of once per line. A full ring drops the line and counts
+	// it rather than block. WARN and ERROR go to stderr, the rest to stdout.
+	// Use the MVSO_LOG_* macros: they skip the formatting below the runtime
+	// level, and compile to nothing below MVSO_LOG_MIN_LEVEL.
+	class Logger
+	{
+	public:
+		static bool enabled(LogLevel level)
+		{
+			return static_cast<int>(level) >= level_.load(std::memory_order_relaxed);
+		}
+		static void setLevel(LogLevel level);
+		static LogLevel level();
+
+		// "trace", "debug", "info", "warn", "error" or "off", any case
+		static bool parseLevel(const std::string& name, LogLevel& level);
+
+		// the calling thread's line buffer, emptied
+		static std::ostream& stream();
+
+		// queues what was written to stream()
+		static void commit(LogLevel level);
+
+		// returns once every line queued so far is written
+		static void flush();
+
+		static long long dropped();
+
+		~Logger();
+
+	private:
+		static const size_t CAPACITY = 4096;
+		static const size_t LINE = 240;       // longer lines are cut
+
+		struct Slot
+		{
+			std::atomic<size_t> sequence;
+			LogLevel level;
+			unsigned short length;
+			char text[LINE];
+		};
+
+		Logger();
+		static Logger& instance();
+		void push(LogLevel level, const char* text, size_t length);
+		void drain();
+
+		static std::atomic<int> level_;
+
+		std::unique_ptr<Slot[]> slots_;
+		char padding0_[64];
+		std::atomic<size_t> tail_;            // claimed by the producers
+		char padding1_[64 - sizeof(std::atomic<size_t>)];
+		std::atomic<size_t> written_;         // lines the drain has written
+		std::atomic<long long> dropped_;
+		std::atomic<bool> stop_;
+		std::thread thread_;
+	};
+
+}
+
+#define MVSO_LOG_LEVEL_TRACE 0
+#define MVSO_LOG_LEVEL_DEBUG 1
+#define MVSO_LOG_LEVEL_INFO 2
+#define MVSO_LOG_LEVEL_WARN 3
+#define MVSO_LOG_LEVEL_ERROR 4
+
+// set by the MVSO_LOG_LEVEL CMake cache variable
+#ifndef MVSO_LOG_MIN_LEVEL
+#define MVSO_LOG_MIN_LEVEL MVSO_LOG_LEVEL_DEBUG
+#endif
+
+#define MVSO_LOG(level, ...) \
+	do { \
+		if (::MVSO::Logger::enabled(level)) \
+		{ \
+			::MVSO::Logger::stream() << __VA_ARGS__; \
+			::MVSO::Logger::commit(level); \
+		} \
+	} while (0)
+
+#if MVSO_LOG_MIN_LEVEL <= MVSO_LOG_LEVEL_TRACE
+#define MVSO_LOG_TRACE(...) MVSO_LOG(::MVSO::LogLevel::TRACE, __VA_ARGS__)
+#else
+#define MVSO_LOG_TRACE(...) do {} while (0)
+#endif
+#if MVSO_LOG_MIN_LEVEL <= MVSO_LOG_LEVEL_DEBUG
+#define MVSO_LOG_DEBUG(...) MVSO_LOG(::MVSO::LogLevel::DEBUG, __VA_ARGS__)
+#else
+#define MVSO_LOG_DEBUG(...) do {} while (0)
+#endif
+#if MVSO_LOG_MIN_LEVEL <= MVSO_LOG_LEVEL_INFO
+#define MVSO_LOG_INFO(...) MVSO_LOG(::MVSO::LogLevel::INFO, __VA_ARGS__)
+#else
+#define MVSO_LOG_INFO(...) do {} while (0)
+#endif
+#if MVSO_LOG_MIN_LEVEL <= MVSO_LOG_LEVEL_WARN
+#define MVSO_LOG_WARN(...) MVSO_LOG(::MVSO::LogLevel::WARN, __VA_ARGS__)
+#else
+#define MVSO_LOG_WARN(...) do {} while (0)
+#endif
+#if MVSO_LOG_MIN_LEVEL <= MVSO_LOG_LEVEL_ERROR
+#define MVSO_LOG_ERROR(...) MVSO_LOG(::MVSO::LogLevel::ERROR, __VA_ARGS__)
+#else
+#define MVSO_LOG_ERROR(...) do {} while (0)
+#endif
@@ -5,6 +5,13 @@ namespace MVSO
 	void MVSO::Map::addNewFrame(std::shared_ptr<Frame> frame)
 	{
 		this->frames_.push_back(frame);
+		if (capacity_ > 0 && frames_.size() > capacity_)
+			frames_.erase(frames_.begin(), frames_.end() - capacity_);
+	}
+
+	void MVSO::Map::setCapacity(int capacity)
+	{
+		capacity_ = capacity;
 	}
 
 	std::vector<std::shared_ptr<Frame>> MVSO::Map::getNewestFrames(int num)
@@ -14,8 +14,12 @@ namespace MVSO
 		Map() = default;
 		void addNewFrame(std::shared_ptr<Frame> frame);
 		std::vector<std::shared_ptr<Frame>> getNewestFrames(int num=1);
+
+		// keeps only the newest frames, 0 keeps all
+		void setCapacity(int capacity);
 	private:
 		std::vector<std::shared_ptr<Frame>> frames_;
+		int capacity_ = 0;
 	};
 
 }
@@ -0,0 +1,142 @@
+#include "MotionGate.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <Eigen/SVD>
+
+namespace MVSO
+{
+
+	namespace
+	{
+		float median(std::vector<float>& values)
+		{
+			std::nth_element(values.begin(), values.begin() + values.size() / 2, values.end());
+			return values[values.size() / 2];
+		}
+	}
+
+	MotionGate::MotionGate(const CameraModel & camera, const Options & options)
+		: options_(options), fx_(camera.fx_), fy_(camera.fy_), cx_(camera.cx_), cy_(camera.cy_)
+	{
+	}
+
+	const char * MotionGate::modeName(Mode mode)
+	{
+		switch (mode)
+		{
+		case ROTATION: return "rotation";
+		case SKIP: return "skip";
+		default: return "full";
+		}
+	}
+
+	Eigen::Matrix3d MotionGate::fitRotation(const std::vector<Eigen::Vector3d>& refRays,
+		const std::vector<Eigen::Vector3d>& rays) const
+	{
+		// Kabsch: argmin sum |refRay - R * ray|^2
+		Eigen::Matrix3d H = Eigen::Matrix3d::Zero();
+		for (size_t k = 0; k < rays.size(); k++)
+			H += rays[k] * refRays[k].transpose();
+		Eigen::JacobiSVD<Eigen::Matrix3d> svd(H, Eigen::ComputeFullU | Eigen::ComputeFullV);
+		Eigen::Matrix3d D = Eigen::Matrix3d::Identity();
+		D(2, 2) = (svd.matrixV() * svd.matrixU().transpose()).determinant() < 0 ? -1.0 : 1.0;
+		return svd.matrixV() * D * svd.matrixU().transpose();
+	}
+
+	MotionGate::Decision MotionGate::evaluate(Frame & reference, Frame & frame)
+	{
+		MVSO_SCOPED_TIMER(Stage::MOTION_GATE);
+		Decision decision;
+
+		// probe features: the reference's tracked keypoints, or its FAST
+		// candidates while it has none
+		std::vector<cv::Point2f>& features = features_;
+		features = reference.getKeypoints();
+		if (static_cast<int>(features.size()) < options_.minPoints)
+			reference.featureDetection(features);
+		if (static_cast<int>(features.size()) < options_.minPoints)
+			return decision;
+
+		const float scale = static_cast<float>(1 << options_.level);
+		const size_t step = std::max<size_t>(1, features.size() / options_.maxPoints);
+		refPoints_.clear();
+		for (size_t i = 0; i < features.size() && static_cast<int>(refPoints_.size()) < options_.maxPoints; i += step)
+			refPoints_.push_back(features[i] * (1.f / scale));
+
+		// 低分辨率稀疏光流, 再反向校验
+		cv::Mat refImage = reference.getLeftLevel(options_.level);
+		cv::Mat image = frame.getLeftLevel(options_.level);
+		const cv::Size winSize(9, 9);
+		const cv::TermCriteria termcrit(cv::TermCriteria::COUNT + cv::TermCriteria::EPS, 20, 0.03);
+		cv::calcOpticalFlowPyrLK(refImage, image, refPoints_, points_, status0_, err_, winSize, 1, termcrit);
+		cv::calcOpticalFlowPyrLK(image, refImage, points_, pointsReturn_, status1_, err_, winSize, 1, termcrit);
+
+		values_.clear();
+		refRays_.clear();
+		rays_.clear();
+		for (size_t i = 0; i < refPoints_.size(); i++)
+		{
+			const cv::Point2f& p = points_[i];
+			if (!status0_[i] || !status1_[i] || p.x < 0 || p.y < 0 || p.x >= image.cols || p.y >= image.rows)
+				continue;
+			const cv::Point2f back = pointsReturn_[i] - refPoints_[i];
+			if (back.dot(back) > 0.25f)
+				continue;
+			const cv::Point2f p0 = refPoints_[i] * scale;
+			const cv::Point2f p1 = p * scale;
+			values_.push_back(std::hypot(p1.x - p0.x, p1.y - p0.y));
+			refRays_.push_back(Eigen::Vector3d((p0.x - cx_) / fx_, (p0.y - cy_) / fy_, 1.0).normalized());
+			rays_.push_back(Eigen::Vector3d((p1.x - cx_) / fx_, (p1.y - cy_) / fy_, 1.0).normalized());
+		}
+		decision.points = static_cast<int>(values_.size());
+		if (decision.points < options_.minPoints)
+			return decision;
+
+		decision.flow = median(values_);
+		if (decision.flow < options_.skipFlow)
+		{
+			decision.mode = SKIP;
+			return decision;
+		}
+
+		// derotate, then refit once without the points that do not follow the rotation
+		for (int pass = 0; pass < 2; pass++)
+		{
+			decision.R = fitRotation(refRays_, rays_);
+			values_.resize(rays_.size());
+			for (size_t k = 0; k < rays_.size(); k++)
+			{
+				const Eigen::Vector3d r = decision.R * rays_[k];
+				const Eigen::Vector3d& r0 = refRays_[k];
+				values_[k] = r.z() <= 0 ? 1e6f : static_cast<float>(std::hypot(
+					fx_ * (r.x() / r.z() - r0.x() / r0.z()), fy_ * (r.y() / r.z() - r0.y() / r0.z())));
+			}
+			residuals_ = values_;
+			decision.parallax = median(residuals_);
+			if (pass == 1)
+				break;
+
+			const float gate = 3.f * std::max(decision.parallax, 0.5f);
+			size_t kept = 0;
+			for (size_t k = 0; k < rays_.size(); k++)
+			{
+				if (values_[k] > gate)
+					continue;
+				refRays_[kept] = refRays_[k];
+				rays_[kept] = rays_[k];
+				kept++;
+			}
+			if (static_cast<int>(kept) < options_.minPoints)
+				break;
+			refRays_.resize(kept);
+			rays_.resize(kept);
+		}
+
+		if (decision.parallax < options_.maxParallax)
+			decision.mode = ROTATION;
+		return decision;
+	}
+
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <vector>
+#include <Eigen/Core>
+
+#include "Frame.h"
+#include "cameramodel.h"
+
+namespace MVSO
+{
+
+	// Decides, before any detection or stereo matching, how much work a frame
+	// needs. A few dozen of the reference frame's features are tracked into the
+	// new frame on a coarse pyramid level, and the flow is classified:
+	//
+	//   SKIP      the median flow is under skipFlow: the camera has not moved
+	//   ROTATION  a rotation fitted to the flow leaves a median residual under
+	//             maxParallax: no measurable translation, the rotation is the motion
+	//   FULL      anything else, or too few probe points to tell
+	//
+	// All thresholds are in full resolution pixels.
+	class MotionGate
+	{
+	public:
+		enum Mode { FULL, ROTATION, SKIP };
+
+		struct Options
+		{
+			int level = 2;                 // pyramid level of the probe
+			int maxPoints = 64;            // probe features, spread over the reference's
+			int minPoints = 16;            // tracked probe points to decide anything but FULL
+			float skipFlow = 1.0f;         // median flow, in pixels
+			float maxParallax = 1.0f;      // median residual after derotation, in pixels
+		};
+
+		struct Decision
+		{
+			Mode mode = FULL;
+			int points = 0;
+			float flow = 0.f;              // median flow
+			float parallax = 0.f;          // median residual of the rotation fit
+			Eigen::Matrix3d R = Eigen::Matrix3d::Identity();   // x_ref = R * x_frame
+		};
+
+		MotionGate() = default;
+		MotionGate(const CameraModel& camera, const Options& options);
+
+		// probes the motion from reference to frame, reference being the last
+		// fully processed frame
+		Decision evaluate(Frame& reference, Frame& frame);
+
+		static const char* modeName(Mode mode);
+
+		Options options_;
+
+	private:
+		// closed-form rotation between bearing pairs, refPoints ~ R * points
+		Eigen::Matrix3d fitRotation(const std::vector<Eigen::Vector3d>& refRays,
+			const std::vector<Eigen::Vector3d>& rays) const;
+
+		double fx_ = 1.0, fy_ = 1.0, cx_ = 0.0, cy_ = 0.0;
+		std::vector<cv::Point2f> features_, refPoints_, points_, pointsReturn_;
+		std::vector<uchar> status0_, status1_;
+		std::vector<float> err_;
+		std::vector<float> values_, residuals_;
+		std::vector<Eigen::Vector3d> refRays_, rays_;
+	};
+
+}
@@ -0,0 +1,159 @@
+#include "MultiRigPoseSolver.h"
+#include "Lie.h"
+
+#include <cmath>
+#include <Eigen/Cholesky>
+
+namespace MVSO
+{
+
+	namespace
+	{
+		// Huber weight and cost for squared error e2
+		inline void huber(double e2, double delta, double& weight, double& rho)
+		{
+			if (e2 <= delta * delta)
+			{
+				weight = 1.0;
+				rho = e2;
+			}
+			else
+			{
+				double e = std::sqrt(e2);
+				weight = delta / e;
+				rho = 2.0 * delta * e - delta * delta;
+			}
+		}
+	}
+
+	void MultiRigPoseSolver::clear()
+	{
+		rigs_.clear();
+		observations_.clear();
+	}
+
+	int MultiRigPoseSolver::addRig(const CameraModel & camera, const RigidModel & bodyFromCamera)
+	{
+		Rig rig;
+		rig.fx = camera.fx_;
+		rig.fy = camera.fy_;
+		rig.cx = camera.cx_;
+		rig.cy = camera.cy_;
+		rig.bf = camera.bf_;
+		rig.bodyFromCamera = bodyFromCamera;
+		rig.cameraFromBody = inverse(bodyFromCamera);
+		rigs_.push_back(rig);
+		return static_cast<int>(rigs_.size()) - 1;
+	}
+
+	void MultiRigPoseSolver::addObservation(int rig, const cv::Point3f & X, float uL, float v, float uR, double weight)
+	{
+		// the body frame of the current timestep is fixed, so map the point once
+		const RigidModel& bodyFromCamera = rigs_[rig].bodyFromCamera;
+		Observation observation;
+		observation.rig = rig;
+		observation.P = bodyFromCamera.R * Eigen::Vector3d(X.x, X.y, X.z) + bodyFromCamera.t;
+		observation.z = Eigen::Vector3d(uL, v, uR);
+		observation.weight = weight;
+		observations_.push_back(observation);
+	}
+
+	double MultiRigPoseSolver::linearize(const RigidModel & motion, Matrix6d * H, Vector6d * g, int * inliers) const
+	{
+		if (H)
+		{
+			H->setZero();
+			g->setZero();
+		}
+		if (inliers)
+			*inliers = 0;
+
+		double cost = 0.0;
+		for (const Observation& o : observations_)
+		{
+			const Rig& rig = rigs_[o.rig];
+			const Eigen::Vector3d Y = motion.R * o.P + motion.t;
+			const Eigen::Vector3d Z = rig.cameraFromBody.R * Y + rig.cameraFromBody.t;
+			if (Z.z() <= 1e-6)
+				continue;
+			const double invZ = 1.0 / Z.z();
+			const double uL = rig.fx * Z.x() * invZ + rig.cx;
+			const double v = rig.fy * Z.y() * invZ + rig.cy;
+			const bool stereo = o.z(2) >= 0;
+
+			Eigen::Vector3d r(uL - o.z(0), v - o.z(1), stereo ? uL + rig.bf * invZ - o.z(2) : 0.0);
+			const double e2 = r.squaredNorm();
+			double weight, rho;
+			huber(e2, stereo ? options_.stereoHuber : options_.pixelHuber, weight, rho);
+			cost += o.weight * rho;
+			if (inliers && weight == 1.0)
+				(*inliers)++;
+			if (!H)
+				continue;
+
+			// d(uL, v, uR) / dZ
+			Eigen::Matrix3d dproj;
+			dproj << rig.fx * invZ, 0, -rig.fx * Z.x() * invZ * invZ,
+				0, rig.fy * invZ, -rig.fy * Z.y() * invZ * invZ,
+				rig.fx * invZ, 0, -(rig.fx * Z.x() + rig.bf) * invZ * invZ;
+			if (!stereo)
+				dproj.row(2).setZero();
+
+			// dY / d[rho, phi] = [I, -Y^]
+			Eigen::Matrix<double, 3, 6> dY;
+			dY.leftCols<3>().setIdentity();
+			dY.rightCols<3>() = -skew(Y);
+			const Eigen::Matrix<double, 3, 6> J = dproj * rig.cameraFromBody.R * dY;
+
+			const double w = o.weight * weight;
+			H->noalias() += w * J.transpose() * J;
+			g->noalias() += w * J.transpose() * r;
+		}
+		return cost;
+	}
+
+	MultiRigPoseSolver::Summary MultiRigPoseSolver::solve(RigidModel & motion) const
+	{
+		Summary summary;
+		summary.observations = static_cast<int>(observations_.size());
+		if (observations_.empty())
+			return summary;
+
+		Matrix6d H;
+		Vector6d g;
+		double cost = linearize(motion, &H, &g, nullptr);
+		summary.initialCost = cost;
+		double lambda = options_.initialLambda;
+		for (int it = 0; it < options_.maxIterations; it++)
+		{
+			summary.iterations = it + 1;
+			Matrix6d A = H;
+			A.diagonal() += lambda * H.diagonal().cwiseMax(1e-9);
+			const Vector6d delta = A.ldlt().solve(-g);
+			if (!delta.allFinite())
+				break;
+
+			RigidModel candidate = motion;
+			applyLeftIncrement(delta, candidate.R, candidate.t);
+			const double candidateCost = linearize(candidate, nullptr, nullptr, nullptr);
+			if (candidateCost < cost)
+			{
+				const double decrease = (cost - candidateCost) / cost;
+				motion = candidate;
+				cost = linearize(motion, &H, &g, nullptr);
+				lambda = std::max(lambda * 0.1, 1e-10);
+				if (delta.norm() < options_.minStepNorm || decrease < options_.minRelativeDecrease)
+					break;
+			}
+			else
+			{
+				lambda *= 10.0;
+				if (lambda > 1e8)
+					break;
+			}
+		}
+		summary.finalCost = linearize(motion, nullptr, nullptr, &summary.inliers);
+		return summary;
+	}
+
+}
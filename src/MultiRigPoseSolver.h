@@ -0,0 +1,82 @@
+#pragma once
+
+#include <vector>
+#include <Eigen/Core>
+
+#include "cameramodel.h"
+#include "PoseEstimator.h"
+
+namespace MVSO
+{
+
+	// Pose-only Levenberg-Marquardt of one body motion over the stereo
+	// observations of several rigidly mounted stereo rigs. Rig k sees the body
+	// through its extrinsics bodyFromCamera (x_body = R * x_cam + t); an
+	// observation is a 3D point in the current camera of rig k and its
+	// (uL, v, uR) in the last image pair of the same rig, uR < 0 for a left-only
+	// observation. The motion is in the frame PnP convention, x_lastBody =
+	// R * x_currentBody + t, with Huber weights and the left perturbation
+	// T <- exp([rho, phi]) * T.
+	class MultiRigPoseSolver
+	{
+	public:
+		typedef Eigen::Matrix<double, 6, 6> Matrix6d;
+		typedef Eigen::Matrix<double, 6, 1> Vector6d;
+
+		struct Options
+		{
+			int maxIterations = 10;
+			float pixelHuber = 2.45f;         // sqrt(chi2(0.95, 2 dof)), in pixels
+			float stereoHuber = 2.80f;        // sqrt(chi2(0.95, 3 dof)), in pixels
+			double minStepNorm = 1e-6;
+			double minRelativeDecrease = 1e-6;
+			double initialLambda = 1e-4;
+		};
+
+		struct Summary
+		{
+			int iterations = 0;
+			double initialCost = 0.0;
+			double finalCost = 0.0;
+			int inliers = 0;                  // residuals inside the Huber threshold at the final pose
+			int observations = 0;
+		};
+
+		// drops the rigs and the observations, keeps the buffers
+		void clear();
+
+		// returns the index addObservation() takes
+		int addRig(const CameraModel& camera, const RigidModel& bodyFromCamera);
+
+		void addObservation(int rig, const cv::Point3f& X, float uL, float v, float uR, double weight);
+
+		int numObservations() const { return static_cast<int>(observations_.size()); }
+
+		Summary solve(RigidModel& motion) const;
+
+		// robust cost at motion, with the normal equations J^T W J and J^T W r
+		// when H and g are set
+		double linearize(const RigidModel& motion, Matrix6d* H, Vector6d* g, int* inliers) const;
+
+		Options options_;
+
+	private:
+		struct Rig
+		{
+			double fx, fy, cx, cy, bf;
+			RigidModel bodyFromCamera, cameraFromBody;
+		};
+
+		struct Observation
+		{
+			int rig;
+			Eigen::Vector3d P;                // in the current body frame
+			Eigen::Vector3d z;                // uL, v, uR
+			double weight;
+		};
+
+		std::vector<Rig> rigs_;
+		std::vector<Observation> observations_;
+	};
+
+}
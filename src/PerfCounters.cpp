@@ -0,0 +1,191 @@
+#include "PerfCounters.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace MVSO
+{
+
+	namespace
+	{
+		std::atomic<bool> countersEnabled(false);
+		std::atomic<unsigned> availableMask(0);
+
+#if defined(__linux__)
+		struct EventConfig
+		{
+			uint32_t type;
+			uint64_t config;
+		};
+
+		const EventConfig events[HARDWARE_COUNTERS] = {
+			{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+			{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+			{ PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+			{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+			{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+		};
+
+		int openEvent(const EventConfig& event, int group)
+		{
+			perf_event_attr attr;
+			std::memset(&attr, 0, sizeof(attr));
+			attr.size = sizeof(attr);
+			attr.type = event.type;
+			attr.config = event.config;
+			attr.disabled = group < 0 ? 1 : 0;
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+			attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+			return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, group, 0));
+		}
+
+		// the counters of one thread; slot maps a counter to its place in the
+		// group read, -1 when it did not open
+		struct CounterGroup
+		{
+			int leader = -1;
+			int fds[HARDWARE_COUNTERS];
+			int slot[HARDWARE_COUNTERS];
+			int size = 0;
+			int error = 0;
+
+			CounterGroup()
+			{
+				for (int i = 0; i < HARDWARE_COUNTERS; i++)
+					fds[i] = slot[i] = -1;
+				leader = openEvent(events[0], -1);
+				if (leader < 0)
+				{
+					error = errno;
+					return;
+				}
+				fds[0] = leader;
+				slot[0] = size++;
+				for (int i = 1; i < HARDWARE_COUNTERS; i++)
+				{
+					fds[i] = openEvent(events[i], leader);
+					if (fds[i] >= 0)
+						slot[i] = size++;
+				}
+				ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+				ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+			}
+
+			~CounterGroup()
+			{
+				for (int fd : fds)
+					if (fd >= 0)
+						close(fd);
+			}
+
+			bool read(CounterReading& reading) const
+			{
+				if (leader < 0)
+					return false;
+				// { nr, time_enabled, time_running, value[nr] }
+				uint64_t data[3 + HARDWARE_COUNTERS];
+				const ssize_t bytes = ::read(leader, data, sizeof(data));
+				if (bytes < static_cast<ssize_t>(sizeof(uint64_t) * (3 + size)))
+					return false;
+				reading.enabled = data[1];
+				reading.running = data[2];
+				for (int i = 0; i < HARDWARE_COUNTERS; i++)
+					reading.values[i] = slot[i] >= 0 ? data[3 + slot[i]] : 0;
+				return true;
+			}
+		};
+
+		const CounterGroup& threadGroup()
+		{
+			thread_local CounterGroup group;
+			return group;
+		}
+#endif
+	}
+
+	const char * counterName(HardwareCounter counter)
+	{
+		switch (counter)
+		{
+		case HardwareCounter::CYCLES: return "cycles";
+		case HardwareCounter::INSTRUCTIONS: return "instructions";
+		case HardwareCounter::L1D_MISSES: return "L1D misses";
+		case HardwareCounter::LLC_MISSES: return "LLC misses";
+		case HardwareCounter::BRANCH_MISSES: return "branch misses";
+		default: return "?";
+		}
+	}
+
+	bool PerfCounters::enable(std::string & reason)
+	{
+#if defined(__linux__)
+		const CounterGroup& group = threadGroup();
+		if (group.leader < 0)
+		{
+			reason = std::string("perf_event_open: ") + std::strerror(group.error);
+			if (group.error == EACCES || group.error == EPERM)
+				reason += " (perf_event_paranoid)";
+			else if (group.error == ENOENT || group.error == EOPNOTSUPP)
+				reason += " (no hardware counters, virtual machine?)";
+			return false;
+		}
+		unsigned mask = 0;
+		for (int i = 0; i < HARDWARE_COUNTERS; i++)
+			if (group.slot[i] >= 0)
+				mask |= 1u << i;
+		availableMask.store(mask);
+		countersEnabled.store(true);
+		return true;
+#else
+		reason = "hardware counters need Linux perf_event_open";
+		return false;
+#endif
+	}
+
+	bool PerfCounters::enabled()
+	{
+		return countersEnabled.load(std::memory_order_relaxed);
+	}
+
+	bool PerfCounters::available(HardwareCounter counter)
+	{
+		return (availableMask.load(std::memory_order_relaxed) >> static_cast<int>(counter)) & 1u;
+	}
+
+	bool PerfCounters::read(CounterReading& reading)
+	{
+#if defined(__linux__)
+		return threadGroup().read(reading);
+#else
+		(void)reading;
+		return false;
+#endif
+	}
+
+	void PerfCounters::delta(const CounterReading& start, const CounterReading& end, uint64_t values[HARDWARE_COUNTERS])
+	{
+		// the kernel multiplexes the group when other events want the PMU
+		// too; the counts of the interval are then extrapolated to its enabled
+		// time, as perf stat does for a whole run. Scaling each reading by its
+		// own cumulative ratio instead would skew the difference, even below
+		// zero, whenever the ratio changes inside the interval.
+		const uint64_t enabled = end.enabled - start.enabled;
+		const uint64_t running = end.running - start.running;
+		const double scale = running < enabled ? static_cast<double>(enabled) / running : 1.0;
+		for (int i = 0; i < HARDWARE_COUNTERS; i++)
+		{
+			const uint64_t raw = end.values[i] > start.values[i] ? end.values[i] - start.values[i] : 0;
+			values[i] = running > 0 ? static_cast<uint64_t>(raw * scale) : 0;
+		}
+	}
+
+}
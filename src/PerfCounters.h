@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace MVSO
+{
+
+	enum class HardwareCounter
+	{
+		CYCLES,
+		INSTRUCTIONS,
+		L1D_MISSES,       // L1 data cache read misses
+		LLC_MISSES,       // last level cache misses
+		BRANCH_MISSES,
+		COUNT
+	};
+
+	const int HARDWARE_COUNTERS = static_cast<int>(HardwareCounter::COUNT);
+
+	const char* counterName(HardwareCounter counter);
+
+	// Raw counts of one group read with the nanoseconds the group was enabled
+	// and actually counting (running) so far
+	struct CounterReading
+	{
+		uint64_t values[HARDWARE_COUNTERS];
+		uint64_t enabled;
+		uint64_t running;
+	};
+
+	// Hardware counters of the calling thread, user space only, through Linux
+	// perf_event_open. Every thread opens one group of its own on first use
+	// and reads all of it with a single read(); the kernel schedules a group
+	// as a whole, so ratios inside a frame stay consistent. A counter the CPU
+	// or the kernel does not offer (virtual machines, perf_event_paranoid > 2)
+	// stays zero, and without cycles nothing is counted at all. While the
+	// group is multiplexed with other perf users it only counts part of the
+	// time, so the counts of an interval are scaled by the time it was enabled
+	// over the time it ran within that interval and are estimates.
+	class PerfCounters
+	{
+	public:
+		// probes on the calling thread; reason explains a failure
+		static bool enable(std::string& reason);
+		static bool enabled();
+
+		// counter opened by the probe
+		static bool available(HardwareCounter counter);
+
+		// raw counts of the calling thread so far, false when its group is not open
+		static bool read(CounterReading& reading);
+
+		// counts between two readings of one thread, extrapolated to the
+		// enabled time between them; zero when the group never ran in between
+		static void delta(const CounterReading& start, const CounterReading& end, uint64_t values[HARDWARE_COUNTERS]);
+	};
+
+}
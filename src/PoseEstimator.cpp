@@ -1,37 +1,42 @@
 #include "PoseEstimator.h"
 #include "PoseOptimizer.h"
+#include "Profiler.h"
+#include "Ransac.h"
 
 #include <Eigen/Core>
 #include <Eigen/Geometry>
 #include <Eigen/SVD>
 
+#include <bitset>
+#if defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+#endif
+
 #include <opencv2/core/eigen.hpp>
 
 namespace MVSO
 {
-	void solveICP(std::vector<cv::Point3f>& points3D_t0, std::vector<cv::Point3f>& points3D_t1, cv::Mat& R, cv::Mat& t)
+	void solveICP(const std::vector<cv::Point3f>& points3D_t0, const std::vector<cv::Point3f>& points3D_t1,
+		const int* ids, int N, Eigen::Matrix3d& R, Eigen::Vector3d& t)
 	{
-		cv::Point3f p1, p2;     // center of mass
-		int N = points3D_t0.size();
+		Eigen::Vector3d p1 = Eigen::Vector3d::Zero(), p2 = Eigen::Vector3d::Zero();     // center of mass
 		for (int i = 0; i < N; i++)
 		{
-			p1 += points3D_t0[i];
-			p2 += points3D_t1[i];
-		}
-		p1 = cv::Point3f(cv::Vec3f(p1) / N);
-		p2 = cv::Point3f(cv::Vec3f(p2) / N);
-		std::vector<cv::Point3f>     q1(N), q2(N); // remove the center
-		for (int i = 0; i < N; i++)
-		{
-			q1[i] = points3D_t0[i] - p1;
-			q2[i] = points3D_t1[i] - p2;
+			const cv::Point3f& a = points3D_t0[ids ? ids[i] : i];
+			const cv::Point3f& b = points3D_t1[ids ? ids[i] : i];
+			p1 += Eigen::Vector3d(a.x, a.y, a.z);
+			p2 += Eigen::Vector3d(b.x, b.y, b.z);
 		}
+		p1 /= N;
+		p2 /= N;
 
-		// compute q1*q2^T
+		// compute q1*q2^T, with the center removed
 		Eigen::Matrix3d W = Eigen::Matrix3d::Zero();
 		for (int i = 0; i < N; i++)
 		{
-			W += Eigen::Vector3d(q1[i].x, q1[i].y, q1[i].z) * Eigen::Vector3d(q2[i].x, q2[i].y, q2[i].z).transpose();
+			const cv::Point3f& a = points3D_t0[ids ? ids[i] : i];
+			const cv::Point3f& b = points3D_t1[ids ? ids[i] : i];
+			W += (Eigen::Vector3d(a.x, a.y, a.z) - p1) * (Eigen::Vector3d(b.x, b.y, b.z) - p2).transpose();
 		}
 
 		// SVD on W
@@ -47,123 +52,371 @@ namespace MVSO
 			}
 		}
 
-		Eigen::Matrix3d R_ = U * (V.transpose());
-		Eigen::Vector3d t_ = Eigen::Vector3d(p1.x, p1.y, p1.z) - R_ * Eigen::Vector3d(p2.x, p2.y, p2.z);
+		R = U * (V.transpose());
+		t = p1 - R * p2;
+	}
+
+	void solveICP(std::vector<cv::Point3f>& points3D_t0, std::vector<cv::Point3f>& points3D_t1, cv::Mat& R, cv::Mat& t)
+	{
+		Eigen::Matrix3d R_;
+		Eigen::Vector3d t_;
+		solveICP(points3D_t0, points3D_t1, nullptr, static_cast<int>(points3D_t0.size()), R_, t_);
 
 		cv::eigen2cv(R_, R);
 		cv::eigen2cv(t_, t);
 	}
 
+	void PointPairsSoA::assign(const std::vector<cv::Point3f>& pts1, const std::vector<cv::Point3f>& pts2)
+	{
+		const size_t n = pts1.size();
+		x1.resize(n); y1.resize(n); z1.resize(n);
+		x2.resize(n); y2.resize(n); z2.resize(n);
+		for (size_t i = 0; i < n; i++)
+		{
+			x1[i] = pts1[i].x; y1[i] = pts1[i].y; z1[i] = pts1[i].z;
+			x2[i] = pts2[i].x; y2[i] = pts2[i].y; z2[i] = pts2[i].z;
+		}
+	}
 
-	void solveICPRansac(std::vector<cv::Point3f>& pts1, std::vector<cv::Point3f>& pts2,
-		cv::Mat& R, cv::Mat& t,std::vector<int>& inliers,
-		int iterationCount, float reprojectionError)
+	// Counts the pairs with |R * p2 + t - p1|^2 < threshold2. If ids is not null,
+	// the inlier indices are written to it in increasing order.
+	int countICPInliers(const PointPairsSoA& pts, const RigidModel& model, float threshold2, int* ids)
 	{
-		cv::Mat bestR = (cv::Mat_<double>(3, 3) << 1, 0, 0, 0, 1, 0, 0, 0, 1);
-		cv::Mat bestT = (cv::Mat_<double>(3, 1) << 0, 0, 0);
-		std::vector<int> bestInliers;
-		cv::Mat ptsMat1(pts1);
-		cv::Mat ptsMat2(pts2);
-		for (int it = 0; it < iterationCount; it++)
+		const Eigen::Matrix3f R = model.R.cast<float>();
+		const Eigen::Vector3f t = model.t.cast<float>();
+		const int n = pts.size();
+		int count = 0;
+		int i = 0;
+
+#if defined(__AVX2__) && defined(__FMA__)
+		const __m256 r00 = _mm256_set1_ps(R(0, 0)), r01 = _mm256_set1_ps(R(0, 1)), r02 = _mm256_set1_ps(R(0, 2));
+		const __m256 r10 = _mm256_set1_ps(R(1, 0)), r11 = _mm256_set1_ps(R(1, 1)), r12 = _mm256_set1_ps(R(1, 2));
+		const __m256 r20 = _mm256_set1_ps(R(2, 0)), r21 = _mm256_set1_ps(R(2, 1)), r22 = _mm256_set1_ps(R(2, 2));
+		const __m256 tx = _mm256_set1_ps(t(0)), ty = _mm256_set1_ps(t(1)), tz = _mm256_set1_ps(t(2));
+		const __m256 thresh = _mm256_set1_ps(threshold2);
+		for (; i + 8 <= n; i += 8)
 		{
-			std::vector<cv::Point3f> subset1;
-			std::vector<cv::Point3f> subset2;
-			for (int i = 0; i < 5; i++)
+			const __m256 x = _mm256_loadu_ps(&pts.x2[i]);
+			const __m256 y = _mm256_loadu_ps(&pts.y2[i]);
+			const __m256 z = _mm256_loadu_ps(&pts.z2[i]);
+			const __m256 ex = _mm256_sub_ps(_mm256_fmadd_ps(r00, x, _mm256_fmadd_ps(r01, y, _mm256_fmadd_ps(r02, z, tx))), _mm256_loadu_ps(&pts.x1[i]));
+			const __m256 ey = _mm256_sub_ps(_mm256_fmadd_ps(r10, x, _mm256_fmadd_ps(r11, y, _mm256_fmadd_ps(r12, z, ty))), _mm256_loadu_ps(&pts.y1[i]));
+			const __m256 ez = _mm256_sub_ps(_mm256_fmadd_ps(r20, x, _mm256_fmadd_ps(r21, y, _mm256_fmadd_ps(r22, z, tz))), _mm256_loadu_ps(&pts.z1[i]));
+			const __m256 d2 = _mm256_fmadd_ps(ex, ex, _mm256_fmadd_ps(ey, ey, _mm256_mul_ps(ez, ez)));
+			const int mask = _mm256_movemask_ps(_mm256_cmp_ps(d2, thresh, _CMP_LT_OQ));
+			if (ids)
 			{
-				int id = rand() % pts1.size();
-
-				subset1.push_back(pts1[id]);
-				subset2.push_back(pts2[id]);
+				for (int b = 0; b < 8; b++)
+				{
+					if (mask & (1 << b))
+						ids[count++] = i + b;
+				}
 			}
+			else
+			{
+				count += static_cast<int>(std::bitset<8>(mask).count());
+			}
+		}
+#endif
 
-			cv::Mat tmpR, tmpT;
-			solveICP(subset1, subset2, tmpR, tmpT);
-
-			std::vector<int> inliers;
-			for (int i = 0; i < pts1.size(); i++)
+		for (; i < n; i++)
+		{
+			float ex = R(0, 0) * pts.x2[i] + R(0, 1) * pts.y2[i] + R(0, 2) * pts.z2[i] + t(0) - pts.x1[i];
+			float ey = R(1, 0) * pts.x2[i] + R(1, 1) * pts.y2[i] + R(1, 2) * pts.z2[i] + t(1) - pts.y1[i];
+			float ez = R(2, 0) * pts.x2[i] + R(2, 1) * pts.y2[i] + R(2, 2) * pts.z2[i] + t(2) - pts.z1[i];
+			if (ex * ex + ey * ey + ez * ez < threshold2)
 			{
-				cv::Point3f& p1 = pts1[i];
-				cv::Point3f& p2 = pts2[i];
-				cv::Point3f ep2;
-	
-				ep2.x = tmpR.at<double>(0, 0) * p1.x + tmpR.at<double>(0, 1) * p1.y + tmpR.at<double>(0, 2) * p1.z + tmpT.at<double>(0);
-				ep2.y = tmpR.at<double>(1, 0) * p1.x + tmpR.at<double>(1, 1) * p1.y + tmpR.at<double>(1, 2) * p1.z + tmpT.at<double>(1);
-				ep2.z = tmpR.at<double>(2, 0) * p1.x + tmpR.at<double>(2, 1) * p1.y + tmpR.at<double>(2, 2) * p1.z + tmpT.at<double>(2);
-
-				float err = sqrt((p2.x - ep2.x)*(p2.x - ep2.x) + (p2.y - ep2.y)*(p2.y - ep2.y) + (p2.z - ep2.z));
-				if (err < reprojectionError)
-				{
-					inliers.push_back(i);
-				}
+				if (ids)
+					ids[count] = i;
+				count++;
 			}
-			if (inliers.size() > bestInliers.size())
+		}
+		return count;
+	}
+
+	// 3D-3D alignment: pts1 = R * pts2 + t
+	struct ICPRansacProblem
+	{
+		typedef RigidModel Model;
+		static const int kSampleSize = 5;
+
+		const PointPairsSoA& soa;
+		const std::vector<cv::Point3f>& pts1;
+		const std::vector<cv::Point3f>& pts2;
+		float threshold2;
+
+		int size() const { return soa.size(); }
+
+		bool fit(const int* sample, Model& model) const
+		{
+			solveICP(pts1, pts2, sample, kSampleSize, model.R, model.t);
+			return true;
+		}
+
+		bool isInlier(const Model& model, int i) const
+		{
+			Eigen::Vector3d e = model.R * Eigen::Vector3d(soa.x2[i], soa.y2[i], soa.z2[i]) + model.t
+				- Eigen::Vector3d(soa.x1[i], soa.y1[i], soa.z1[i]);
+			return e.squaredNorm() < threshold2;
+		}
+
+		int score(const Model& model) const
+		{
+			return countICPInliers(soa, model, threshold2, nullptr);
+		}
+
+		void inliers(const Model& model, std::vector<int>& ids) const
+		{
+			ids.resize(size());
+			ids.resize(countICPInliers(soa, model, threshold2, ids.data()));
+		}
+	};
+
+	// 3D-2D: pts2d ~ K * (R * pts3d + t), minimal EPnP on 5 points
+	struct PnPRansacProblem
+	{
+		typedef RigidModel Model;
+		static const int kSampleSize = 5;
+
+		const std::vector<cv::Point3f>& pts3d;
+		const std::vector<cv::Point2f>& pts2d;
+		const CameraModel& camera;
+		double threshold2;
+
+		int size() const { return static_cast<int>(pts3d.size()); }
+
+		bool fit(const int* sample, Model& model) const
+		{
+			cv::Point3f obj[kSampleSize];
+			cv::Point2f img[kSampleSize];
+			for (int i = 0; i < kSampleSize; i++)
 			{
-				bestInliers = inliers;
-				bestR = tmpR;
-				bestT = tmpT;
+				obj[i] = pts3d[sample[i]];
+				img[i] = pts2d[sample[i]];
 			}
+			cv::Mat objMat(kSampleSize, 1, CV_32FC3, obj);
+			cv::Mat imgMat(kSampleSize, 1, CV_32FC2, img);
+			cv::Mat rvec, tvec, rmat;
+			if (!cv::solvePnP(objMat, imgMat, camera.intrinsicMat_, cv::Mat(), rvec, tvec, false, cv::SOLVEPNP_EPNP))
+				return false;
+			cv::Rodrigues(rvec, rmat);
+			cv::cv2eigen(rmat, model.R);
+			cv::cv2eigen(tvec, model.t);
+			return true;
+		}
+
+		bool isInlier(const Model& model, int i) const
+		{
+			const cv::Point3f& X = pts3d[i];
+			Eigen::Vector3d x = model.R * Eigen::Vector3d(X.x, X.y, X.z) + model.t;
+			if (x.z() <= 0)
+				return false;
+			double du = camera.fx_ * x.x() / x.z() + camera.cx_ - pts2d[i].x;
+			double dv = camera.fy_ * x.y() / x.z() + camera.cy_ - pts2d[i].y;
+			return du * du + dv * dv < threshold2;
+		}
+
+		int score(const Model& model) const
+		{
+			int count = 0;
+			for (int i = 0; i < size(); i++)
+				count += isInlier(model, i);
+			return count;
+		}
 
+		void inliers(const Model& model, std::vector<int>& ids) const
+		{
+			ids.clear();
+			for (int i = 0; i < size(); i++)
+				if (isInlier(model, i))
+					ids.push_back(i);
 		}
-		R = bestR;
-		t = bestT;
-		inliers = bestInliers;
+	};
+
+	float solveICPRansac(const PointPairsSoA& soa, const std::vector<cv::Point3f>& pts1, const std::vector<cv::Point3f>& pts2,
+		const RansacParams& params, RansacCostModel& cost, const RigidModel* prior, float priorInlierRatio,
+		RansacResult<RigidModel>& result, RansacScratch<RigidModel>& scratch)
+	{
+		MVSO_SCOPED_TIMER(Stage::RANSAC);
+		ICPRansacProblem problem{ soa, pts1, pts2, params.threshold * params.threshold };
+		float priorRatio = prior ? scorePriorModel(problem, *prior, priorInlierRatio, result) : 0.f;
+		if (!result.fromPrior)
+			runRansac(problem, params, cost, result, scratch);
+		return priorRatio;
 	}
 
+	float solvePnPRansac(const std::vector<cv::Point3f>& pts3d, const std::vector<cv::Point2f>& pts2d,
+		const CameraModel& camera, const RansacParams& params, RansacCostModel& cost,
+		const RigidModel* prior, float priorInlierRatio,
+		RansacResult<RigidModel>& result, RansacScratch<RigidModel>& scratch)
+	{
+		MVSO_SCOPED_TIMER(Stage::RANSAC);
+		PnPRansacProblem problem{ pts3d, pts2d, camera, double(params.threshold) * params.threshold };
+		float priorRatio = prior ? scorePriorModel(problem, *prior, priorInlierRatio, result) : 0.f;
+		if (!result.fromPrior)
+			runRansac(problem, params, cost, result, scratch);
+		return priorRatio;
+	}
 
-	MVSO::PoseEstimator::PoseEstimator(CameraModel & camera): camera_(camera)
+	// capacity only grows
+	template<class T>
+	static void growTo(std::vector<T>& v, size_t n)
 	{
+		if (v.capacity() < n)
+			v.reserve(n + n / 2);
 	}
 
-	cv::Mat PoseEstimator::estimatePose(std::vector<cv::Point2f>& pointsLeft_t0, std::vector<cv::Point2f>& pointsLeft_t1, std::vector<cv::Point3f>& points3D_t0)
+	template<class Model>
+	static void growTo(RansacScratch<Model>& scratch, const RansacParams& params, size_t n)
 	{
-		// Calculate frame to frame transformation
-		cv::Mat pose;
-		cv::Mat rotation, translation;
+		size_t hypotheses = std::max(params.blockSize * params.blocksPerRound,
+			std::max(params.maxIterations, params.minHypotheses));
+		growTo(scratch.models, hypotheses);
+		growTo(scratch.valid, hypotheses);
+		growTo(scratch.alive, hypotheses);
+		growTo(scratch.order, n);
+	}
 
-		// -----------------------------------------------------------
-		// Rotation(R) estimation using Nister's Five Points Algorithm
-		// -----------------------------------------------------------
-		double focal = camera_.fx_;
-		cv::Point2d principle_point(camera_.cx_, camera_.cy_);
 
-		//recovering the pose and the essential cv::matrix
-		cv::Mat E, mask;
-		cv::Mat translation_mono = cv::Mat::zeros(3, 1, CV_64F);
-		E = cv::findEssentialMat(pointsLeft_t1, pointsLeft_t0, focal, principle_point, cv::RANSAC, 0.999, 1.0, mask);
-		cv::recoverPose(E, pointsLeft_t1, pointsLeft_t0, rotation, translation_mono, focal, principle_point, mask);
-		// std::cout << "recoverPose rotation: " << rotation << std::endl;
+	// [R^T | -t], a new matrix per call
+	static cv::Mat composePose(const cv::Mat& R, const cv::Mat& t)
+	{
+		cv::Mat pose(3, 4, CV_64F);
+		for (int r = 0; r < 3; r++)
+		{
+			for (int c = 0; c < 3; c++)
+				pose.at<double>(r, c) = R.at<double>(c, r);
+			pose.at<double>(r, 3) = -t.at<double>(r, 0);
+		}
+		return pose;
+	}
+
+
+	MVSO::PoseEstimator::PoseEstimator(CameraModel & camera): camera_(camera), optimizer_(camera),
+		rotation_(3, 3, CV_64F), translation_(3, 1, CV_64F), hasPrior_(false)
+	{
+		pnpRansacParams_.maxIterations = 100;
+		pnpRansacParams_.threshold = 1.0f;
+		pnpRansacParams_.confidence = 0.98f;
+
+		icpRansacParams_.maxIterations = 100;
+		icpRansacParams_.threshold = 1.0f;
+
+		motionPriorInlierRatio_ = 0.8f;
 
-		// ------------------------------------------------
-		// Translation (t) estimation by use solvePnPRansac
-		// ------------------------------------------------
-		cv::Mat distCoeffs = cv::Mat::zeros(4, 1, CV_64FC1);
-		cv::Mat inliers;
-		cv::Mat rvec = cv::Mat::zeros(3, 1, CV_64FC1);
+		// ThDepth default, 35 baselines
+		closeDepth_ = static_cast<float>(35.0 * std::abs(camera_.bf_) / camera_.fx_);
+	}
+
+	void PoseEstimator::setMotionPrior(const RigidModel & prior)
+	{
+		prior_ = prior;
+		hasPrior_ = true;
+	}
+
+	bool PoseEstimator::getMotionPrior(RigidModel & prior) const
+	{
+		if (!hasPrior_)
+			return false;
+		prior = prior_;
+		return true;
+	}
 
-		int iterationsCount = 100;        // number of Ransac iterations.
-		float reprojectionError = 1.0;    // maximum allowed distance to consider it an inlier.
-		float confidence = 0.98;          // RANSAC successful confidence.
-		bool useExtrinsicGuess = false;
-		int flags = cv::SOLVEPNP_EPNP;
+	void PoseEstimator::getRefinedModel(RigidModel & model) const
+	{
+		cv::cv2eigen(rotation_, model.R);
+		cv::cv2eigen(translation_, model.t);
+	}
 
-		//cv::Rodrigues(rotation, rvec);
-		cv::solvePnPRansac(points3D_t0, pointsLeft_t1, camera_.intrinsicMat_, distCoeffs, rvec, translation,
-			useExtrinsicGuess, iterationsCount, reprojectionError, confidence,
-			inliers, flags);
+	cv::Mat PoseEstimator::fallbackPose(const RigidModel* prior)
+	{
+		const RigidModel model = prior ? *prior : RigidModel();
+		cv::eigen2cv(model.R, rotation_);
+		cv::eigen2cv(model.t, translation_);
+		stats_.refinement = PoseOptimizer::Result();
+		return composePose(rotation_, translation_);
+	}
 
+	void PoseEstimator::reserveWorkspace(size_t n)
+	{
+		growTo(icpPoints_.x1, n); growTo(icpPoints_.y1, n); growTo(icpPoints_.z1, n);
+		growTo(icpPoints_.x2, n); growTo(icpPoints_.y2, n); growTo(icpPoints_.z2, n);
+		growTo(icpResult_.inliers, n);
+		growTo(pnpResult_.inliers, n);
+		growTo(icpScratch_, icpRansacParams_, n);
+		growTo(pnpScratch_, pnpRansacParams_, n);
+		growTo(inlierPoints3d_, n);
+		growTo(inlierPoints3dRef_, n);
+		growTo(inlierPoints2d_, n);
+		growTo(inlierRightU_, n);
+		growTo(inlierWeights_, n);
+	}
 
-		std::vector<cv::Point3f> points3d;
-		std::vector<cv::Point2f> points2d;
-		std::vector<double> weights;
+	cv::Mat PoseEstimator::estimatePose(std::vector<cv::Point2f>& pointsLeft_t0, std::vector<cv::Point2f>& pointsLeft_t1,
+		std::vector<cv::Point2f>& pointsRight_t1, std::vector<cv::Point3f>& points3D_t0)
+	{
+		MVSO_SCOPED_TIMER(Stage::POSE);
+		reserveWorkspace(points3D_t0.size());
 
-		for (int i = 0; i < inliers.rows; i++)
+		// -----------------------------------------------------------
+		// Constant-velocity prior: skip sampling if it already fits
+		// -----------------------------------------------------------
+		RigidModel prior;
+		bool hasPrior = getMotionPrior(prior);
+		stats_.motionPriorInlierRatio = solvePnPRansac(points3D_t0, pointsLeft_t1, camera_,
+			pnpRansacParams_, pnpRansacCost_, hasPrior ? &prior : nullptr, motionPriorInlierRatio_,
+			pnpResult_, pnpScratch_);
+		const std::vector<int>& inliers = pnpResult_.inliers;
+		stats_.motionPriorUsed = pnpResult_.fromPrior;
+		stats_.ransacIterations = pnpResult_.iterations;
+		stats_.inliers = static_cast<int>(inliers.size());
+		if (!pnpResult_.found)
+			return fallbackPose(hasPrior ? &prior : nullptr);
+
+		if (pnpResult_.fromPrior)
 		{
-			int id = inliers.at<int>(i, 0);
+			cv::eigen2cv(pnpResult_.model.R, rotation_);
+			cv::eigen2cv(pnpResult_.model.t, translation_);
+		}
+		else
+		{
+			// -----------------------------------------------------------
+			// Rotation(R) estimation using Nister's Five Points Algorithm
+			// -----------------------------------------------------------
+			double focal = camera_.fx_;
+			cv::Point2d principle_point(camera_.cx_, camera_.cy_);
+
+			//recovering the pose and the essential cv::matrix
+			cv::Mat E, mask;
+			cv::Mat translation_mono = cv::Mat::zeros(3, 1, CV_64F);
+			{
+				MVSO_SCOPED_TIMER(Stage::RANSAC);
+				E = cv::findEssentialMat(pointsLeft_t1, pointsLeft_t0, focal, principle_point, cv::RANSAC, 0.999, 1.0, mask);
+				cv::recoverPose(E, pointsLeft_t1, pointsLeft_t0, rotation_, translation_mono, focal, principle_point, mask);
+			}
+			// std::cout << "recoverPose rotation: " << rotation << std::endl;
+
+			// ------------------------------------------------
+			// Translation (t) estimation by parallel PnP RANSAC
+			// ------------------------------------------------
+			cv::eigen2cv(pnpResult_.model.t, translation_);
+		}
 
+		inlierPoints3d_.clear();
+		inlierPoints2d_.clear();
+		inlierRightU_.clear();
+		inlierWeights_.clear();
+		for (int id : inliers)
+		{
 			cv::Point3f p3d = points3D_t0[id];
 			cv::Point2f p0 = pointsLeft_t0[id], p1 = pointsLeft_t1[id];
-			points3d.push_back(p3d);
-			points2d.push_back(p1);
+			inlierPoints3d_.push_back(p3d);
+			inlierPoints2d_.push_back(p1);
+
+			// the right observation only helps while the disparity is well above noise
+			float uR = pointsRight_t1[id].x;
+			bool stereo = p3d.z > 0 && p3d.z < closeDepth_ && uR >= 0 && uR < p1.x;
+			inlierRightU_.push_back(stereo ? uR : -1.f);
 
 			double w = sqrt((p0.x - p1.x)*(p0.x - p1.x) + (p0.y - p1.y)*(p0.y - p1.y));
 			//w *= 1/(1+exp(abs(p3d.z - 5)));
@@ -171,43 +424,55 @@ namespace MVSO
 				w = 7;
 			else if (w < 1.0)
 				w = 1.0;
-			weights.push_back(exp(-w));
+			// triangulation error grows with z^2
+			double depth = p3d.z / closeDepth_;
+			inlierWeights_.push_back(exp(-w) / (1.0 + depth * depth));
 		}
 
-		PoseOptimizer optimizer(camera_);
-		//cv::Rodrigues(rvec, rotation);
-		//optimizer.optimizePose(points3d, points2d, rotation, translation);
-		optimizer.optimizePose(points3d, points2d, weights,rotation, translation);
-
+		{
+			MVSO_SCOPED_TIMER(Stage::REFINEMENT);
+			stats_.refinement = optimizer_.optimizePose(inlierPoints3d_, inlierPoints2d_, inlierRightU_, inlierWeights_,
+				rotation_, translation_);
+		}
 
-		//cv::Rodrigues(rvec, rotation);
-		rotation = rotation.t();
-		translation = -translation;
-		// std::cout << "inliers size: " << inliers.size() << std::endl;
-		cv::hconcat(rotation, translation, pose);
-		return pose;
+		return composePose(rotation_, translation_);
 	}
 
 	cv::Mat PoseEstimator::estimatePose(std::vector<cv::Point2f>& points_t0, std::vector<cv::Point2f>& points_t1, std::vector<cv::Point3f>& points3D_t0, std::vector<cv::Point3f>& points3D_t1)
 	{
-		
-		cv::Mat R, t;
-		std::vector<int> inliers;
-		solveICPRansac(points3D_t0, points3D_t1, R, t, inliers, 100, 1.0);
-
-		std::vector<cv::Point3f> pts1, pts2;
+		MVSO_SCOPED_TIMER(Stage::POSE);
+		reserveWorkspace(points3D_t0.size());
+
+		RigidModel prior;
+		bool hasPrior = getMotionPrior(prior);
+		icpPoints_.assign(points3D_t0, points3D_t1);
+		stats_.motionPriorInlierRatio = solveICPRansac(icpPoints_, points3D_t0, points3D_t1,
+			icpRansacParams_, icpRansacCost_, hasPrior ? &prior : nullptr, motionPriorInlierRatio_,
+			icpResult_, icpScratch_);
+		const std::vector<int>& inliers = icpResult_.inliers;
+		stats_.motionPriorUsed = icpResult_.fromPrior;
+		stats_.ransacIterations = icpResult_.iterations;
+		stats_.inliers = static_cast<int>(inliers.size());
+		if (!icpResult_.found)
+			return fallbackPose(hasPrior ? &prior : nullptr);
+		cv::eigen2cv(icpResult_.model.R, rotation_);
+		cv::eigen2cv(icpResult_.model.t, translation_);
+
+		inlierPoints3dRef_.clear();
+		inlierPoints3d_.clear();
 		for (int n : inliers)
 		{
-			pts1.push_back(points3D_t0[n]);
-			pts2.push_back(points3D_t1[n]);
+			inlierPoints3dRef_.push_back(points3D_t0[n]);
+			inlierPoints3d_.push_back(points3D_t1[n]);
 		}
 
+		{
+			MVSO_SCOPED_TIMER(Stage::REFINEMENT);
+			stats_.refinement = optimizer_.optimizePose(inlierPoints3dRef_, inlierPoints3d_, rotation_, translation_);
+		}
 
-		PoseOptimizer optimizer(camera_);
-		optimizer.optimizePose(pts1, pts2, R, t);
-		cv::Mat pose;
-		cv::hconcat(R, t, pose);
-		return pose;
+		// same output convention as the 2D-3D path
+		return composePose(rotation_, translation_);
 
 	}
 
@@ -2,22 +2,91 @@
 
 #include <opencv2/opencv.hpp>
 #include <vector>
+#include <Eigen/Core>
 
 #include "cameramodel.h"
+#include "Ransac.h"
+#include "PoseOptimizer.h"
 
 namespace MVSO
 {
 
+	// x_ref = R * x + t
+	struct RigidModel
+	{
+		Eigen::Matrix3d R = Eigen::Matrix3d::Identity();
+		Eigen::Vector3d t = Eigen::Vector3d::Zero();
+	};
+
+	// a * b: x_a = a.R * (b.R * x + b.t) + a.t
+	inline RigidModel compose(const RigidModel& a, const RigidModel& b)
+	{
+		RigidModel ab;
+		ab.R = a.R * b.R;
+		ab.t = a.R * b.t + a.t;
+		return ab;
+	}
+
+	inline RigidModel inverse(const RigidModel& a)
+	{
+		RigidModel inv;
+		inv.R = a.R.transpose();
+		inv.t = -(inv.R * a.t);
+		return inv;
+	}
+
+	// Matched 3D point pairs in structure-of-arrays layout, for the SIMD ICP scorer.
+	struct PointPairsSoA
+	{
+		std::vector<float> x1, y1, z1;
+		std::vector<float> x2, y2, z2;
+
+		void assign(const std::vector<cv::Point3f>& pts1, const std::vector<cv::Point3f>& pts2);
+		int size() const { return static_cast<int>(x1.size()); }
+	};
+
+	// The RANSAC stages of estimatePose(): the prior is scored first and, when
+	// it holds priorInlierRatio of the points, sampling is skipped. Both return
+	// the prior's inlier ratio. PnP: pts3d into the camera of pts2d; ICP: pts2
+	// into the frame of pts1, soa holding the same pairs.
+	float solvePnPRansac(const std::vector<cv::Point3f>& pts3d, const std::vector<cv::Point2f>& pts2d,
+		const CameraModel& camera, const RansacParams& params, RansacCostModel& cost,
+		const RigidModel* prior, float priorInlierRatio,
+		RansacResult<RigidModel>& result, RansacScratch<RigidModel>& scratch);
+	float solveICPRansac(const PointPairsSoA& soa, const std::vector<cv::Point3f>& pts1, const std::vector<cv::Point3f>& pts2,
+		const RansacParams& params, RansacCostModel& cost, const RigidModel* prior, float priorInlierRatio,
+		RansacResult<RigidModel>& result, RansacScratch<RigidModel>& scratch);
+
+	enum class PoseMethod { PNP, ICP };
+
 	class PoseEstimator
 	{
 	public:
+		struct Stats
+		{
+			bool motionPriorUsed = false;
+			float motionPriorInlierRatio = 0.f;
+			int ransacIterations = 0;
+			int inliers = 0;
+			PoseOptimizer::Result refinement;
+		};
+
 		PoseEstimator(CameraModel& camera);
 
+		// Motion hypothesis scored before RANSAC, in the same convention as the
+		// RANSAC model (3D points of the current frame into the reference camera).
+		void setMotionPrior(const RigidModel& prior);
+
+		// 2D-3D RANSAC, then one joint refinement on the left and right
+		// observations (pointsLeft_t1, pointsRight_t1) of the points3D_t0.
 		cv::Mat estimatePose(
 			std::vector<cv::Point2f>&  pointsLeft_t0,
 			std::vector<cv::Point2f>&  pointsLeft_t1,
+			std::vector<cv::Point2f>&  pointsRight_t1,
 			std::vector<cv::Point3f>& points3D_t0);
 
+		// 3D-3D alternative to the PnP path: vectorized ICP RANSAC on stereo points
+		// of both frames. Returns the pose in the same convention.
 		cv::Mat estimatePose(
 			std::vector<cv::Point2f>&  pointsLeft_t0,
 			std::vector<cv::Point2f>&  pointsLeft_t1,
@@ -27,7 +96,50 @@ namespace MVSO
 
 		~PoseEstimator();
 
-		CameraModel camera_;
+		bool getMotionPrior(RigidModel& prior) const;
+
+		// (R, t) of the last estimatePose(), after refinement, in the RANSAC
+		// model convention; what the next frame should use as its motion prior
+		void getRefinedModel(RigidModel& model) const;
+
+		// pose of a frame RANSAC found no model for (too few or degenerate
+		// correspondences): the motion prior when there is one, identity
+		// otherwise, unrefined. Zero inliers tell the caller the frame is lost.
+		cv::Mat fallbackPose(const RigidModel* prior);
+
+		// Grows every reusable buffer to hold n correspondences. The estimator is
+		// meant to live as long as the odometry, so its own buffers settle at
+		// their high-water mark. OpenCV still allocates per frame: cv::solvePnP
+		// and cv::Rodrigues in every PnP hypothesis, the essential matrix, and
+		// the returned pose; vo_microbench reports the allocations per call.
+		void reserveWorkspace(size_t n);
+
+		CameraModel camera_;              // a copy, a reference would dangle once the estimator is moved
+		PoseOptimizer optimizer_;
+		RansacParams pnpRansacParams_;
+		RansacParams icpRansacParams_;
+		RansacCostModel pnpRansacCost_;
+		RansacCostModel icpRansacCost_;
+
+		PointPairsSoA icpPoints_;
+		RansacResult<RigidModel> icpResult_;
+		RansacScratch<RigidModel> icpScratch_;
+		RansacResult<RigidModel> pnpResult_;
+		RansacScratch<RigidModel> pnpScratch_;
+
+		// inlier correspondences handed to the optimizer
+		std::vector<cv::Point3f> inlierPoints3d_;
+		std::vector<cv::Point3f> inlierPoints3dRef_;
+		std::vector<cv::Point2f> inlierPoints2d_;
+		std::vector<float> inlierRightU_;
+		std::vector<double> inlierWeights_;
+		cv::Mat rotation_, translation_;   // CV_64F, refined in place
+
+		RigidModel prior_;
+		bool hasPrior_;
+		float motionPriorInlierRatio_;   // accept the motion prior above this inlier ratio
+		float closeDepth_;               // meters; closer points use the right observation too
+		Stats stats_;
 	};
 
 }
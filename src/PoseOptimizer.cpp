@@ -1,17 +1,23 @@
 #include "PoseOptimizer.h"
+#include "PoseSolver.h"
 #include <Eigen/Core>
 #include <Eigen/Geometry>
+#ifdef MVSO_WITH_G2O
 #include <g2o/core/base_vertex.h>
 #include <g2o/core/base_unary_edge.h>
 #include <g2o/core/block_solver.h>
 #include <g2o/core/optimization_algorithm_levenberg.h>
 #include <g2o/solvers/eigen/linear_solver_eigen.h>
 #include <g2o/types/sba/types_six_dof_expmap.h>
+#include <g2o/core/sparse_optimizer_terminate_action.h>
+#endif
 #include <opencv2/core/eigen.hpp>
 #include "utils.h"
+#include <chrono>
 
 namespace MVSO
 {
+#ifdef MVSO_WITH_G2O
 
 	class EdgeProjectXYZRGBDPoseOnly : public g2o::BaseUnaryEdge<3, Eigen::Vector3d, g2o::VertexSE3Expmap>
 	{
@@ -63,14 +69,66 @@ namespace MVSO
 		Eigen::Vector3d _point;
 	};
 
+	// runs g2o with the iteration cap and relative-decrease threshold of the
+	// options (no time cap here) and fills the summary
+	static PoseSolver::Summary runOptimizer(g2o::SparseOptimizer& optimizer, const PoseSolver::Options& options, double inlierChi2)
+	{
+		typedef std::chrono::steady_clock Clock;
+		const Clock::time_point start = Clock::now();
+		PoseSolver::Summary summary;
+		g2o::SparseOptimizerTerminateAction terminate;
+		terminate.setGainThreshold(options.minRelativeDecrease);
+		terminate.setMaxIterations(options.maxIterations);
+		optimizer.addPostIterationAction(&terminate);
+		optimizer.setVerbose(false);
+		optimizer.initializeOptimization();
+		optimizer.computeActiveErrors();
+		summary.initialCost = optimizer.activeChi2();
+		summary.iterations = optimizer.optimize(options.maxIterations);
+		optimizer.removePostIterationAction(&terminate);
+		summary.finalCost = optimizer.activeChi2();
+		for (g2o::OptimizableGraph::Edge* edge : optimizer.activeEdges())
+		{
+			summary.observations++;
+			summary.inliers += edge->chi2() < inlierChi2;
+		}
+		summary.termination = summary.iterations < options.maxIterations ?
+			PoseSolver::Termination::RELATIVE_DECREASE : PoseSolver::Termination::MAX_ITERATIONS;
+		summary.solveTimeUs = std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+		return summary;
+	}
+#else
+	// runs the pose-only solver from (R, t) and writes the result back
+	static PoseSolver::Summary solvePose(PoseSolver& solver, cv::Mat& R, cv::Mat& t)
+	{
+		Eigen::Matrix3d R_mat;
+		Eigen::Vector3d t_vec;
+		cv::cv2eigen(R, R_mat);
+		cv::cv2eigen(t, t_vec);
+
+		PoseSolver::Summary summary = solver.solve(R_mat, t_vec);
+
+		cv::eigen2cv(R_mat, R);
+		t.at<double>(0, 0) = t_vec(0);
+		t.at<double>(1, 0) = t_vec(1);
+		t.at<double>(2, 0) = t_vec(2);
+		return summary;
+	}
+#endif
+
 
 
 MVSO::PoseOptimizer::PoseOptimizer(CameraModel & camera): camera_(camera)
 {
+	// hard cap only, typical frames stop on the thresholds much earlier
+	options_.maxIterations = 100;
+	solver_.setIntrinsics(camera_.fx_, camera_.fy_, camera_.cx_, camera_.cy_);
+	solver_.setStereo(camera_.bf_);
 }
 
-void PoseOptimizer::optimizePose(const std::vector<cv::Point3f> points_3d, const std::vector<cv::Point2f> points_2d, cv::Mat & R, cv::Mat & t)
+PoseOptimizer::Result PoseOptimizer::optimizePose(const std::vector<cv::Point3f>& points_3d, const std::vector<cv::Point2f>& points_2d, cv::Mat & R, cv::Mat & t)
 {
+#ifdef MVSO_WITH_G2O
 
 
 	// ʼg2o
@@ -127,23 +185,32 @@ void PoseOptimizer::optimizePose(const std::vector<cv::Point3f> points_3d, const
 		index++;
 	}
 
-	TicTok tic;
-	optimizer.setVerbose(false);
-	optimizer.initializeOptimization();
-	optimizer.optimize(100);
-	
-	std::cout << "optimization costs time: " << tic.tok() << " ms" << std::endl;
+	Result result = runOptimizer(optimizer, options_, 5.991);
 
 	auto pose_optimal = Eigen::Isometry3d(pose->estimate());
 	cv::eigen2cv(pose_optimal.rotation(), R);
 	t.at<double>(0, 0) = pose_optimal.translation()(0);
 	t.at<double>(1, 0) = pose_optimal.translation()(1);
 	t.at<double>(2, 0) = pose_optimal.translation()(2);
-
+	return result;
+
+#else
+	PoseSolver& solver = solver_;
+	solver.clear();
+	solver.reserve(static_cast<int>(points_3d.size()), 0);
+	solver.options_ = options_;
+	for (size_t i = 0; i < points_3d.size(); i++)
+	{
+		const cv::Point3f& p = points_3d[i];
+		solver.addProjection(p.x, p.y, p.z, points_2d[i].x, points_2d[i].y);
+	}
+	return solvePose(solver, R, t);
+#endif
 }
 
-void PoseOptimizer::optimizePose(const std::vector<cv::Point3f> points_3d, const std::vector<cv::Point2f> points_2d, const std::vector<double>& weights, cv::Mat & R, cv::Mat & t)
+PoseOptimizer::Result PoseOptimizer::optimizePose(const std::vector<cv::Point3f>& points_3d, const std::vector<cv::Point2f>& points_2d, const std::vector<double>& weights, cv::Mat & R, cv::Mat & t)
 {
+#ifdef MVSO_WITH_G2O
 
 	// ʼg2o
 	typedef g2o::BlockSolver< g2o::BlockSolverTraits<6, 3> > Block;  // pose άΪ 6, landmark άΪ 3
@@ -200,26 +267,126 @@ void PoseOptimizer::optimizePose(const std::vector<cv::Point3f> points_3d, const
 		index++;
 	}
 
-	TicTok tic;
-	optimizer.setVerbose(false);
-	optimizer.initializeOptimization();
-	optimizer.optimize(100);
-
-	std::cout << "optimization costs time: " << tic.tok() << " ms" << std::endl;
+	Result result = runOptimizer(optimizer, options_, 5.991);
 
 	auto pose_optimal = Eigen::Isometry3d(pose->estimate());
 	cv::eigen2cv(pose_optimal.rotation(), R);
 	t.at<double>(0, 0) = pose_optimal.translation()(0);
 	t.at<double>(1, 0) = pose_optimal.translation()(1);
 	t.at<double>(2, 0) = pose_optimal.translation()(2);
+	return result;
+#else
+	PoseSolver& solver = solver_;
+	solver.clear();
+	solver.reserve(static_cast<int>(points_3d.size()), 0);
+	solver.options_ = options_;
+	for (size_t i = 0; i < points_3d.size(); i++)
+	{
+		const cv::Point3f& p = points_3d[i];
+		solver.addProjection(p.x, p.y, p.z, points_2d[i].x, points_2d[i].y, static_cast<float>(weights[i]));
+	}
+	return solvePose(solver, R, t);
+#endif
 }
 
 
-void PoseOptimizer::optimizePose(
-	const std::vector< cv::Point3f > points3d_t0,
-	const std::vector< cv::Point3f > points3d_t1,
+PoseOptimizer::Result PoseOptimizer::optimizePose(
+	const std::vector< cv::Point3f >& points_3d,
+	const std::vector< cv::Point2f >& points_left,
+	const std::vector< float >& right_u,
+	const std::vector< double >& weights,
 	cv::Mat& R, cv::Mat& t)
 {
+#ifdef MVSO_WITH_G2O
+	typedef g2o::BlockSolver< g2o::BlockSolverTraits<6, 3> > Block;
+	Block::LinearSolverType* linearSolver = new g2o::LinearSolverEigen<Block::PoseMatrixType>();
+	Block* solver_ptr = new Block(linearSolver);
+	g2o::OptimizationAlgorithmLevenberg* solver = new g2o::OptimizationAlgorithmLevenberg(solver_ptr);
+	g2o::SparseOptimizer optimizer;
+	optimizer.setAlgorithm(solver);
+
+	Eigen::Matrix3d R_mat;
+	cv::cv2eigen(R, R_mat);
+	g2o::VertexSE3Expmap* pose = new g2o::VertexSE3Expmap();
+	pose->setId(0);
+	pose->setEstimate(g2o::SE3Quat(
+		R_mat,
+		Eigen::Vector3d(t.at<double>(0, 0), t.at<double>(1, 0), t.at<double>(2, 0))
+	));
+	optimizer.addVertex(pose);
+
+	// g2o maps uR = uL - fx * baseline / z, so the baseline is -bf / fx here
+	g2o::CameraParameters* camera = new g2o::CameraParameters(
+		camera_.fx_, Eigen::Vector2d(camera_.cx_, camera_.cy_), -camera_.bf_ / camera_.fx_
+	);
+	camera->setId(0);
+	optimizer.addParameter(camera);
+
+	// landmarks are fixed, only the pose is refined
+	for (size_t i = 0; i < points_3d.size(); i++)
+	{
+		const cv::Point3f& p = points_3d[i];
+		g2o::VertexSBAPointXYZ* point = new g2o::VertexSBAPointXYZ();
+		point->setId(static_cast<int>(i) + 1);
+		point->setEstimate(Eigen::Vector3d(p.x, p.y, p.z));
+		point->setFixed(true);
+		optimizer.addVertex(point);
+
+		const cv::Point2f& uv = points_left[i];
+		g2o::OptimizableGraph::Edge* edge;
+		if (right_u[i] >= 0)
+		{
+			g2o::EdgeProjectXYZ2UVU* stereo = new g2o::EdgeProjectXYZ2UVU();
+			stereo->setMeasurement(Eigen::Vector3d(uv.x, uv.y, right_u[i]));
+			stereo->setInformation(Eigen::Matrix3d::Identity() * weights[i]);
+			edge = stereo;
+		}
+		else
+		{
+			g2o::EdgeProjectXYZ2UV* mono = new g2o::EdgeProjectXYZ2UV();
+			mono->setMeasurement(Eigen::Vector2d(uv.x, uv.y));
+			mono->setInformation(Eigen::Matrix2d::Identity() * weights[i]);
+			edge = mono;
+		}
+		edge->setId(static_cast<int>(i) + 1);
+		edge->setVertex(0, point);
+		edge->setVertex(1, pose);
+		edge->setParameterId(0, 0);
+		optimizer.addEdge(edge);
+	}
+
+	Result result = runOptimizer(optimizer, options_, 7.815);
+
+	auto pose_optimal = Eigen::Isometry3d(pose->estimate());
+	cv::eigen2cv(pose_optimal.rotation(), R);
+	t.at<double>(0, 0) = pose_optimal.translation()(0);
+	t.at<double>(1, 0) = pose_optimal.translation()(1);
+	t.at<double>(2, 0) = pose_optimal.translation()(2);
+	return result;
+#else
+	PoseSolver& solver = solver_;
+	solver.clear();
+	solver.reserve(static_cast<int>(points_3d.size()), 0, static_cast<int>(points_3d.size()));
+	solver.options_ = options_;
+	for (size_t i = 0; i < points_3d.size(); i++)
+	{
+		const cv::Point3f& p = points_3d[i];
+		const float w = static_cast<float>(weights[i]);
+		if (right_u[i] >= 0)
+			solver.addStereoProjection(p.x, p.y, p.z, points_left[i].x, points_left[i].y, right_u[i], w);
+		else
+			solver.addProjection(p.x, p.y, p.z, points_left[i].x, points_left[i].y, w);
+	}
+	return solvePose(solver, R, t);
+#endif
+}
+
+PoseOptimizer::Result PoseOptimizer::optimizePose(
+	const std::vector< cv::Point3f >& points3d_t0,
+	const std::vector< cv::Point3f >& points3d_t1,
+	cv::Mat& R, cv::Mat& t)
+{
+#ifdef MVSO_WITH_G2O
 	// ʼg2o
 	typedef g2o::BlockSolver< g2o::BlockSolverTraits<6, 3> > Block;  // poseάΪ 6, landmark άΪ 3
 	Block::LinearSolverType* linearSolver = new g2o::LinearSolverEigen<Block::PoseMatrixType>(); // Է
@@ -254,18 +421,28 @@ void PoseOptimizer::optimizePose(
 		edges.push_back(edge);
 	}
 
-	TicTok tic;
-	optimizer.setVerbose(false);
-	optimizer.initializeOptimization();
-	optimizer.optimize(10);
-	
-	std::cout << "optimization costs time: " << tic.tok() << " ms." << std::endl;
+	Result result = runOptimizer(optimizer, options_, 7.815);
 
 	auto pose_optimal = Eigen::Isometry3d(pose->estimate());
 	cv::eigen2cv(pose_optimal.rotation(), R);
 	t.at<double>(0, 0) = pose_optimal.translation()(0);
 	t.at<double>(1, 0) = pose_optimal.translation()(1);
 	t.at<double>(2, 0) = pose_optimal.translation()(2);
+	return result;
+#else
+	// points3d_t0 = R * points3d_t1 + t
+	PoseSolver& solver = solver_;
+	solver.clear();
+	solver.reserve(0, static_cast<int>(points3d_t0.size()));
+	solver.options_ = options_;
+	for (size_t i = 0; i < points3d_t0.size(); i++)
+	{
+		const cv::Point3f& src = points3d_t1[i];
+		const cv::Point3f& dst = points3d_t0[i];
+		solver.addAlignment(src.x, src.y, src.z, dst.x, dst.y, dst.z);
+	}
+	return solvePose(solver, R, t);
+#endif
 }
 
 
@@ -3,33 +3,49 @@
 #include <vector>
 #include <opencv2/opencv.hpp>
 #include "cameramodel.h"
+#include "PoseSolver.h"
 
 
 namespace MVSO {
 
+// Pose-only refinement of (R, t). Every overload stops on the convergence
+// thresholds of options_ and returns what the solve did.
 class PoseOptimizer
 {
 public:
+	typedef PoseSolver::Summary Result;
+
 	PoseOptimizer(CameraModel& camera);
 
-	void optimizePose(
-		const std::vector< cv::Point3f > points_3d,
-		const std::vector< cv::Point2f > points_2d,
+	Result optimizePose(
+		const std::vector< cv::Point3f >& points_3d,
+		const std::vector< cv::Point2f >& points_2d,
 		cv::Mat& R, cv::Mat& t);
 
-	void optimizePose(
-		const std::vector< cv::Point3f > points_3d,
-		const std::vector< cv::Point2f > points_2d,
+	Result optimizePose(
+		const std::vector< cv::Point3f >& points_3d,
+		const std::vector< cv::Point2f >& points_2d,
 		const std::vector< double >& weights,
 		cv::Mat& R, cv::Mat& t);
 
-	void optimizePose(
-		const std::vector< cv::Point3f > points3d_t0,
-		const std::vector< cv::Point3f > points3d_t1,
+	// Joint left/right refinement on a rectified pair: points with a right
+	// observation (right_u >= 0) give the (uL, v, uR) residual, the others only
+	// the left one.
+	Result optimizePose(
+		const std::vector< cv::Point3f >& points_3d,
+		const std::vector< cv::Point2f >& points_left,
+		const std::vector< float >& right_u,
+		const std::vector< double >& weights,
 		cv::Mat& R, cv::Mat& t);
 
+	Result optimizePose(
+		const std::vector< cv::Point3f >& points3d_t0,
+		const std::vector< cv::Point3f >& points3d_t1,
+		cv::Mat& R, cv::Mat& t);
 
-	CameraModel camera_;
+	CameraModel camera_;   // a copy, safe to copy and move the optimizer
+	PoseSolver::Options options_;   // iteration/time caps and stopping thresholds
+	PoseSolver solver_;   // kept across calls, observations are cleared per solve
 
 	~PoseOptimizer();
 };
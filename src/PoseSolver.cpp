@@ -0,0 +1,628 @@
+#include "PoseSolver.h"
+#include "Lie.h"
+
+#include <algorithm>
+#include <bitset>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <Eigen/Geometry>
+#include <Eigen/Cholesky>
+
+#if defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+#endif
+
+namespace MVSO
+{
+
+	namespace
+	{
+		// upper triangle of the 6x6 normal matrix, row major
+		const int kNumH = 21;
+
+		inline int roundUp8(int n)
+		{
+			return (n + 7) & ~7;
+		}
+
+		struct NormalAccumulator
+		{
+			double H[kNumH];
+			double g[6];
+			double cost;
+			int inliers;
+
+			NormalAccumulator()
+			{
+				std::fill(H, H + kNumH, 0.0);
+				std::fill(g, g + 6, 0.0);
+				cost = 0.0;
+				inliers = 0;
+			}
+
+			// adds w * J^T J and w * J^T r of one residual row
+			void addRow(const double* J, double r, double w)
+			{
+				int k = 0;
+				for (int i = 0; i < 6; i++)
+				{
+					const double wJi = w * J[i];
+					for (int j = i; j < 6; j++)
+						H[k++] += wJi * J[j];
+					g[i] += wJi * r;
+				}
+			}
+		};
+
+		// Huber weight and cost for squared error e2
+		inline void huber(double e2, double delta, double& weight, double& rho)
+		{
+			if (e2 <= delta * delta)
+			{
+				weight = 1.0;
+				rho = e2;
+			}
+			else
+			{
+				double e = std::sqrt(e2);
+				weight = delta / e;
+				rho = 2.0 * delta * e - delta * delta;
+			}
+		}
+
+#if defined(__AVX2__) && defined(__FMA__)
+		struct NormalAccumulator8
+		{
+			__m256 H[kNumH];
+			__m256 g[6];
+			__m256 cost;
+			int inliers;
+
+			NormalAccumulator8()
+			{
+				inliers = 0;
+				for (int k = 0; k < kNumH; k++)
+					H[k] = _mm256_setzero_ps();
+				for (int i = 0; i < 6; i++)
+					g[i] = _mm256_setzero_ps();
+				cost = _mm256_setzero_ps();
+			}
+
+			inline void addRow(const __m256* J, __m256 r, __m256 w)
+			{
+				int k = 0;
+				for (int i = 0; i < 6; i++)
+				{
+					const __m256 wJi = _mm256_mul_ps(w, J[i]);
+					for (int j = i; j < 6; j++, k++)
+						H[k] = _mm256_fmadd_ps(wJi, J[j], H[k]);
+					g[i] = _mm256_fmadd_ps(wJi, r, g[i]);
+				}
+			}
+
+			static double sum(__m256 v)
+			{
+				alignas(32) float lanes[8];
+				_mm256_store_ps(lanes, v);
+				double s = 0.0;
+				for (int i = 0; i < 8; i++)
+					s += lanes[i];
+				return s;
+			}
+
+			// lanes set in the mask count as inliers
+			inline void countInliers(__m256 mask)
+			{
+				inliers += static_cast<int>(std::bitset<8>(_mm256_movemask_ps(mask)).count());
+			}
+
+			void reduce(double* Hout, double* gout, double& costOut, int& inliersOut) const
+			{
+				inliersOut += inliers;
+				for (int k = 0; k < kNumH; k++)
+					Hout[k] += sum(H[k]);
+				for (int i = 0; i < 6; i++)
+					gout[i] += sum(g[i]);
+				costOut += sum(cost);
+			}
+		};
+
+		// Huber weight and cost, 8 lanes; returns the lanes inside the threshold
+		inline __m256 huber8(__m256 e2, __m256 delta, __m256& weight, __m256& rho)
+		{
+			const __m256 e = _mm256_sqrt_ps(e2);
+			const __m256 inside = _mm256_cmp_ps(e, delta, _CMP_LE_OQ);
+			weight = _mm256_blendv_ps(_mm256_div_ps(delta, e), _mm256_set1_ps(1.f), inside);
+			const __m256 outer = _mm256_fmsub_ps(_mm256_add_ps(delta, delta), e, _mm256_mul_ps(delta, delta));
+			rho = _mm256_blendv_ps(outer, e2, inside);
+			return inside;
+		}
+
+		// v on the lanes of mask, exactly zero on the others, also where v is
+		// inf or NaN; a zero weight alone would still let 0 * NaN through
+		inline __m256 select8(__m256 mask, __m256 v)
+		{
+			return _mm256_blendv_ps(_mm256_setzero_ps(), v, mask);
+		}
+#endif
+	}
+
+	void PoseSolver::Buffer::resize(size_t n)
+	{
+		n = roundUp8(static_cast<int>(n));
+		x.resize(n, 0.f); y.resize(n, 0.f); z.resize(n, 0.f);
+		a.resize(n, 0.f); b.resize(n, 0.f); c.resize(n, 0.f);
+		w.resize(n, 0.f);
+	}
+
+	const char * PoseSolver::terminationName(Termination termination)
+	{
+		switch (termination)
+		{
+		case Termination::NO_OBSERVATIONS: return "no observations";
+		case Termination::RELATIVE_DECREASE: return "relative decrease";
+		case Termination::STEP_NORM: return "step norm";
+		case Termination::GRADIENT: return "gradient";
+		case Termination::MAX_ITERATIONS: return "max iterations";
+		case Termination::TIME_LIMIT: return "time limit";
+		case Termination::FAILED: return "failed";
+		}
+		return "unknown";
+	}
+
+	PoseSolver::PoseSolver()
+		: fx_(1.0), fy_(1.0), cx_(0.0), cy_(0.0), bf_(0.0),
+		numProjections_(0), numStereo_(0), numAlignments_(0), growths_(0)
+	{
+	}
+
+	void PoseSolver::setIntrinsics(double fx, double fy, double cx, double cy)
+	{
+		fx_ = fx;
+		fy_ = fy;
+		cx_ = cx;
+		cy_ = cy;
+	}
+
+	void PoseSolver::setStereo(double bf)
+	{
+		bf_ = bf;
+	}
+
+	void PoseSolver::clear()
+	{
+		numProjections_ = 0;
+		numStereo_ = 0;
+		numAlignments_ = 0;
+	}
+
+	void PoseSolver::reserve(int projections, int alignments, int stereoProjections)
+	{
+		if (projections > static_cast<int>(projections_.w.size()))
+			grow(projections_, projections);
+		if (stereoProjections > static_cast<int>(stereo_.w.size()))
+			grow(stereo_, stereoProjections);
+		if (alignments > static_cast<int>(alignments_.w.size()))
+			grow(alignments_, alignments);
+	}
+
+	void PoseSolver::grow(Buffer & buf, size_t n)
+	{
+		buf.resize(n);
+		growths_++;
+	}
+
+	void PoseSolver::push(Buffer & buf, int & count, float x, float y, float z, float a, float b, float c, float w)
+	{
+		if (count + 1 > static_cast<int>(buf.w.size()))
+			grow(buf, std::max<size_t>(64, 2 * buf.w.size()));
+		buf.x[count] = x; buf.y[count] = y; buf.z[count] = z;
+		buf.a[count] = a; buf.b[count] = b; buf.c[count] = c;
+		buf.w[count] = w;
+		count++;
+	}
+
+	void PoseSolver::addProjection(float X, float Y, float Z, float u, float v, float weight)
+	{
+		push(projections_, numProjections_, X, Y, Z, u, v, 0.f, weight);
+	}
+
+	void PoseSolver::addStereoProjection(float X, float Y, float Z, float uL, float v, float uR, float weight)
+	{
+		push(stereo_, numStereo_, X, Y, Z, uL, v, uR, weight);
+	}
+
+	void PoseSolver::addAlignment(float sx, float sy, float sz, float tx, float ty, float tz, float weight)
+	{
+		push(alignments_, numAlignments_, sx, sy, sz, tx, ty, tz, weight);
+	}
+
+	void PoseSolver::linearizeProjections(const Buffer & p, int count, bool stereo,
+		const Eigen::Matrix3f & R, const Eigen::Vector3f & t,
+		double * Hout, double * gout, double & costOut, int & inliersOut) const
+	{
+		const int n = roundUp8(count);
+		const float fx = static_cast<float>(fx_), fy = static_cast<float>(fy_);
+		const float cx = static_cast<float>(cx_), cy = static_cast<float>(cy_);
+		const float bf = static_cast<float>(bf_);
+		const float huberDelta = stereo ? options_.stereoHuber : options_.pixelHuber;
+		int i = 0;
+
+#if defined(__AVX2__) && defined(__FMA__)
+		NormalAccumulator8 acc;
+		const __m256 r00 = _mm256_set1_ps(R(0, 0)), r01 = _mm256_set1_ps(R(0, 1)), r02 = _mm256_set1_ps(R(0, 2));
+		const __m256 r10 = _mm256_set1_ps(R(1, 0)), r11 = _mm256_set1_ps(R(1, 1)), r12 = _mm256_set1_ps(R(1, 2));
+		const __m256 r20 = _mm256_set1_ps(R(2, 0)), r21 = _mm256_set1_ps(R(2, 1)), r22 = _mm256_set1_ps(R(2, 2));
+		const __m256 tx = _mm256_set1_ps(t(0)), ty = _mm256_set1_ps(t(1)), tz = _mm256_set1_ps(t(2));
+		const __m256 vfx = _mm256_set1_ps(fx), vfy = _mm256_set1_ps(fy);
+		const __m256 vcx = _mm256_set1_ps(cx), vcy = _mm256_set1_ps(cy);
+		const __m256 vbf = _mm256_set1_ps(bf);
+		const __m256 minDepth = _mm256_set1_ps(1e-3f);
+		const __m256 zero = _mm256_setzero_ps();
+		const __m256 infinity = _mm256_set1_ps(std::numeric_limits<float>::infinity());
+		const __m256 delta = _mm256_set1_ps(huberDelta);
+
+		for (; i < n; i += 8)
+		{
+			const __m256 X = _mm256_loadu_ps(&p.x[i]);
+			const __m256 Y = _mm256_loadu_ps(&p.y[i]);
+			const __m256 Z = _mm256_loadu_ps(&p.z[i]);
+			const __m256 x = _mm256_fmadd_ps(r00, X, _mm256_fmadd_ps(r01, Y, _mm256_fmadd_ps(r02, Z, tx)));
+			const __m256 y = _mm256_fmadd_ps(r10, X, _mm256_fmadd_ps(r11, Y, _mm256_fmadd_ps(r12, Z, ty)));
+			const __m256 z = _mm256_fmadd_ps(r20, X, _mm256_fmadd_ps(r21, Y, _mm256_fmadd_ps(r22, Z, tz)));
+
+			// points behind the camera, and non-finite ones (triangulated from
+			// degenerate matches), contribute zero residuals and Jacobians
+			__m256 valid = _mm256_cmp_ps(z, minDepth, _CMP_GT_OQ);
+			const __m256 zinv = _mm256_and_ps(_mm256_div_ps(_mm256_set1_ps(1.f), z), valid);
+			const __m256 xz = _mm256_mul_ps(x, zinv);
+			const __m256 yz = _mm256_mul_ps(y, zinv);
+
+			const __m256 u = _mm256_fmadd_ps(vfx, xz, vcx);
+			__m256 ru = _mm256_sub_ps(u, _mm256_loadu_ps(&p.a[i]));
+			__m256 rv = _mm256_sub_ps(_mm256_fmadd_ps(vfy, yz, vcy), _mm256_loadu_ps(&p.b[i]));
+			__m256 e2 = _mm256_fmadd_ps(ru, ru, _mm256_mul_ps(rv, rv));
+
+			// uR = uL + bf / z
+			__m256 rr = zero;
+			if (stereo)
+			{
+				rr = _mm256_sub_ps(_mm256_fmadd_ps(vbf, zinv, u), _mm256_loadu_ps(&p.c[i]));
+				e2 = _mm256_fmadd_ps(rr, rr, e2);
+			}
+			valid = _mm256_and_ps(valid, _mm256_cmp_ps(e2, infinity, _CMP_LT_OQ));
+			ru = select8(valid, ru);
+			rv = select8(valid, rv);
+			rr = select8(valid, rr);
+			e2 = select8(valid, e2);
+
+			__m256 hw, rho;
+			const __m256 inside = huber8(e2, delta, hw, rho);
+			const __m256 w = _mm256_and_ps(_mm256_mul_ps(_mm256_loadu_ps(&p.w[i]), hw), valid);
+			acc.countInliers(_mm256_and_ps(inside, _mm256_cmp_ps(w, zero, _CMP_GT_OQ)));
+			acc.cost = _mm256_fmadd_ps(_mm256_and_ps(_mm256_loadu_ps(&p.w[i]), valid), rho, acc.cost);
+
+			const __m256 fxz = _mm256_mul_ps(vfx, zinv);
+			const __m256 fyz = _mm256_mul_ps(vfy, zinv);
+			__m256 Ju[6], Jv[6];
+			Ju[0] = fxz;
+			Ju[1] = zero;
+			Ju[2] = _mm256_sub_ps(zero, _mm256_mul_ps(fxz, xz));
+			Ju[3] = _mm256_sub_ps(zero, _mm256_mul_ps(_mm256_mul_ps(vfx, xz), yz));
+			Ju[4] = _mm256_fmadd_ps(_mm256_mul_ps(vfx, xz), xz, vfx);
+			Ju[5] = _mm256_sub_ps(zero, _mm256_mul_ps(vfx, yz));
+			Jv[0] = zero;
+			Jv[1] = fyz;
+			Jv[2] = _mm256_sub_ps(zero, _mm256_mul_ps(fyz, yz));
+			Jv[3] = _mm256_sub_ps(zero, _mm256_fmadd_ps(_mm256_mul_ps(vfy, yz), yz, vfy));
+			Jv[4] = _mm256_mul_ps(_mm256_mul_ps(vfy, xz), yz);
+			Jv[5] = _mm256_mul_ps(vfy, xz);
+			for (int k = 0; k < 6; k++)
+			{
+				Ju[k] = select8(valid, Ju[k]);
+				Jv[k] = select8(valid, Jv[k]);
+			}
+
+			acc.addRow(Ju, ru, w);
+			acc.addRow(Jv, rv, w);
+
+			if (stereo)
+			{
+				// d(bf / z) = -bf / z^2 * [0, 0, 1, y, -x, 0]
+				const __m256 dz = _mm256_sub_ps(zero, _mm256_mul_ps(_mm256_mul_ps(vbf, zinv), zinv));
+				__m256 Jr[6];
+				Jr[0] = Ju[0];
+				Jr[1] = Ju[1];
+				Jr[2] = _mm256_add_ps(Ju[2], dz);
+				Jr[3] = select8(valid, _mm256_fmadd_ps(dz, y, Ju[3]));
+				Jr[4] = select8(valid, _mm256_fnmadd_ps(dz, x, Ju[4]));
+				Jr[5] = Ju[5];
+				acc.addRow(Jr, rr, w);
+			}
+		}
+		acc.reduce(Hout, gout, costOut, inliersOut);
+#endif
+
+		if (i < n)
+		{
+			NormalAccumulator acc;
+			const double delta = huberDelta;
+			for (; i < n; i++)
+			{
+				const double x = R(0, 0) * p.x[i] + R(0, 1) * p.y[i] + R(0, 2) * p.z[i] + t(0);
+				const double y = R(1, 0) * p.x[i] + R(1, 1) * p.y[i] + R(1, 2) * p.z[i] + t(1);
+				const double z = R(2, 0) * p.x[i] + R(2, 1) * p.y[i] + R(2, 2) * p.z[i] + t(2);
+				if (!(z > 1e-3) || p.w[i] == 0.f)
+					continue;
+
+				const double zinv = 1.0 / z;
+				const double xz = x * zinv, yz = y * zinv;
+				const double u = fx * xz + cx;
+				const double ru = u - p.a[i];
+				const double rv = fy * yz + cy - p.b[i];
+				const double rr = stereo ? u + bf * zinv - p.c[i] : 0.0;
+
+				double hw, rho;
+				const double e2 = ru * ru + rv * rv + rr * rr;
+				if (!std::isfinite(e2))
+					continue;
+				huber(e2, delta, hw, rho);
+				acc.inliers += e2 <= delta * delta;
+				const double w = p.w[i] * hw;
+				acc.cost += p.w[i] * rho;
+
+				const double Ju[6] = { fx * zinv, 0.0, -fx * xz * zinv, -fx * xz * yz, fx + fx * xz * xz, -fx * yz };
+				const double Jv[6] = { 0.0, fy * zinv, -fy * yz * zinv, -fy - fy * yz * yz, fy * xz * yz, fy * xz };
+				acc.addRow(Ju, ru, w);
+				acc.addRow(Jv, rv, w);
+				if (stereo)
+				{
+					const double dz = -bf * zinv * zinv;
+					const double Jr[6] = { Ju[0], Ju[1], Ju[2] + dz, Ju[3] + dz * y, Ju[4] - dz * x, Ju[5] };
+					acc.addRow(Jr, rr, w);
+				}
+			}
+			for (int k = 0; k < kNumH; k++)
+				Hout[k] += acc.H[k];
+			for (int k = 0; k < 6; k++)
+				gout[k] += acc.g[k];
+			costOut += acc.cost;
+			inliersOut += acc.inliers;
+		}
+	}
+
+	void PoseSolver::linearizeAlignments(const Eigen::Matrix3f & R, const Eigen::Vector3f & t,
+		double * Hout, double * gout, double & costOut, int & inliersOut) const
+	{
+		const Buffer& p = alignments_;
+		const int n = roundUp8(numAlignments_);
+		int i = 0;
+
+#if defined(__AVX2__) && defined(__FMA__)
+		NormalAccumulator8 acc;
+		const __m256 r00 = _mm256_set1_ps(R(0, 0)), r01 = _mm256_set1_ps(R(0, 1)), r02 = _mm256_set1_ps(R(0, 2));
+		const __m256 r10 = _mm256_set1_ps(R(1, 0)), r11 = _mm256_set1_ps(R(1, 1)), r12 = _mm256_set1_ps(R(1, 2));
+		const __m256 r20 = _mm256_set1_ps(R(2, 0)), r21 = _mm256_set1_ps(R(2, 1)), r22 = _mm256_set1_ps(R(2, 2));
+		const __m256 tx = _mm256_set1_ps(t(0)), ty = _mm256_set1_ps(t(1)), tz = _mm256_set1_ps(t(2));
+		const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.f);
+		const __m256 infinity = _mm256_set1_ps(std::numeric_limits<float>::infinity());
+		const __m256 delta = _mm256_set1_ps(options_.metricHuber);
+
+		for (; i < n; i += 8)
+		{
+			const __m256 X = _mm256_loadu_ps(&p.x[i]);
+			const __m256 Y = _mm256_loadu_ps(&p.y[i]);
+			const __m256 Z = _mm256_loadu_ps(&p.z[i]);
+			const __m256 x = _mm256_fmadd_ps(r00, X, _mm256_fmadd_ps(r01, Y, _mm256_fmadd_ps(r02, Z, tx)));
+			const __m256 y = _mm256_fmadd_ps(r10, X, _mm256_fmadd_ps(r11, Y, _mm256_fmadd_ps(r12, Z, ty)));
+			const __m256 z = _mm256_fmadd_ps(r20, X, _mm256_fmadd_ps(r21, Y, _mm256_fmadd_ps(r22, Z, tz)));
+
+			// non-finite points contribute zero residuals and Jacobians
+			__m256 ex = _mm256_sub_ps(x, _mm256_loadu_ps(&p.a[i]));
+			__m256 ey = _mm256_sub_ps(y, _mm256_loadu_ps(&p.b[i]));
+			__m256 ez = _mm256_sub_ps(z, _mm256_loadu_ps(&p.c[i]));
+			__m256 e2 = _mm256_fmadd_ps(ex, ex, _mm256_fmadd_ps(ey, ey, _mm256_mul_ps(ez, ez)));
+			const __m256 valid = _mm256_cmp_ps(e2, infinity, _CMP_LT_OQ);
+			ex = select8(valid, ex);
+			ey = select8(valid, ey);
+			ez = select8(valid, ez);
+			e2 = select8(valid, e2);
+
+			__m256 hw, rho;
+			const __m256 inside = huber8(e2, delta, hw, rho);
+			const __m256 pw = select8(valid, _mm256_loadu_ps(&p.w[i]));
+			acc.countInliers(_mm256_and_ps(inside, _mm256_cmp_ps(pw, zero, _CMP_GT_OQ)));
+			const __m256 w = _mm256_mul_ps(pw, hw);
+			acc.cost = _mm256_fmadd_ps(pw, rho, acc.cost);
+
+			// d(T * X) = [I, -[T * X]x]
+			const __m256 px = select8(valid, x), py = select8(valid, y), pz = select8(valid, z);
+			const __m256 nx = _mm256_sub_ps(zero, px), ny = _mm256_sub_ps(zero, py), nz = _mm256_sub_ps(zero, pz);
+			const __m256 Jx[6] = { one, zero, zero, zero, pz, ny };
+			const __m256 Jy[6] = { zero, one, zero, nz, zero, px };
+			const __m256 Jz[6] = { zero, zero, one, py, nx, zero };
+			acc.addRow(Jx, ex, w);
+			acc.addRow(Jy, ey, w);
+			acc.addRow(Jz, ez, w);
+		}
+		acc.reduce(Hout, gout, costOut, inliersOut);
+#endif
+
+		if (i < n)
+		{
+			NormalAccumulator acc;
+			const double delta = options_.metricHuber;
+			for (; i < n; i++)
+			{
+				if (p.w[i] == 0.f)
+					continue;
+				const double x = R(0, 0) * p.x[i] + R(0, 1) * p.y[i] + R(0, 2) * p.z[i] + t(0);
+				const double y = R(1, 0) * p.x[i] + R(1, 1) * p.y[i] + R(1, 2) * p.z[i] + t(1);
+				const double z = R(2, 0) * p.x[i] + R(2, 1) * p.y[i] + R(2, 2) * p.z[i] + t(2);
+				const double ex = x - p.a[i], ey = y - p.b[i], ez = z - p.c[i];
+
+				double hw, rho;
+				const double e2 = ex * ex + ey * ey + ez * ez;
+				if (!std::isfinite(e2))
+					continue;
+				huber(e2, delta, hw, rho);
+				acc.inliers += e2 <= delta * delta;
+				const double w = p.w[i] * hw;
+				acc.cost += p.w[i] * rho;
+
+				const double Jx[6] = { 1, 0, 0, 0, z, -y };
+				const double Jy[6] = { 0, 1, 0, -z, 0, x };
+				const double Jz[6] = { 0, 0, 1, y, -x, 0 };
+				acc.addRow(Jx, ex, w);
+				acc.addRow(Jy, ey, w);
+				acc.addRow(Jz, ez, w);
+			}
+			for (int k = 0; k < kNumH; k++)
+				Hout[k] += acc.H[k];
+			for (int k = 0; k < 6; k++)
+				gout[k] += acc.g[k];
+			costOut += acc.cost;
+			inliersOut += acc.inliers;
+		}
+	}
+
+	void PoseSolver::linearize(const Eigen::Matrix3d & R, const Eigen::Vector3d & t,
+		Matrix6d & H, Vector6d & g, double & cost, int & inliers) const
+	{
+		double h[kNumH] = { 0 };
+		double gg[6] = { 0 };
+		cost = 0.0;
+		inliers = 0;
+
+		const Eigen::Matrix3f Rf = R.cast<float>();
+		const Eigen::Vector3f tf = t.cast<float>();
+		if (numProjections_ > 0)
+			linearizeProjections(projections_, numProjections_, false, Rf, tf, h, gg, cost, inliers);
+		if (numStereo_ > 0)
+			linearizeProjections(stereo_, numStereo_, true, Rf, tf, h, gg, cost, inliers);
+		if (numAlignments_ > 0)
+			linearizeAlignments(Rf, tf, h, gg, cost, inliers);
+
+		int k = 0;
+		for (int i = 0; i < 6; i++)
+		{
+			for (int j = i; j < 6; j++, k++)
+			{
+				H(i, j) = h[k];
+				H(j, i) = h[k];
+			}
+			g(i) = gg[i];
+		}
+	}
+
+	void PoseSolver::clearPadding()
+	{
+		for (int i = numProjections_; i < roundUp8(numProjections_); i++)
+			projections_.w[i] = 0.f;
+		for (int i = numStereo_; i < roundUp8(numStereo_); i++)
+			stereo_.w[i] = 0.f;
+		for (int i = numAlignments_; i < roundUp8(numAlignments_); i++)
+			alignments_.w[i] = 0.f;
+	}
+
+	void PoseSolver::normalEquations(const Eigen::Matrix3d & R, const Eigen::Vector3d & t,
+		Matrix6d & H, Vector6d & g, double & cost, int & inliers)
+	{
+		clearPadding();
+		linearize(R, t, H, g, cost, inliers);
+	}
+
+	PoseSolver::Summary PoseSolver::solve(Eigen::Matrix3d & R, Eigen::Vector3d & t)
+	{
+		typedef std::chrono::steady_clock Clock;
+		const Clock::time_point start = Clock::now();
+		Summary summary;
+		summary.observations = numProjections_ + numStereo_ + numAlignments_;
+		clearPadding();
+
+		if (summary.observations == 0)
+			return summary;
+
+		Matrix6d H, Hnew;
+		Vector6d g, gnew;
+		double cost, costNew;
+		int inliers, inliersNew;
+		linearize(R, t, H, g, cost, inliers);
+		summary.initialCost = cost;
+
+		double lambda = options_.initialLambda;
+		summary.termination = Termination::MAX_ITERATIONS;
+		while (summary.iterations < options_.maxIterations)
+		{
+			if (g.lpNorm<Eigen::Infinity>() < options_.minGradientNorm)
+			{
+				summary.termination = Termination::GRADIENT;
+				break;
+			}
+			summary.iterations++;
+
+			Matrix6d A = H;
+			A.diagonal() *= 1.0 + lambda;
+			A.diagonal().array() += 1e-9;
+			const Vector6d delta = A.ldlt().solve(-g);
+			if (!delta.allFinite())
+			{
+				summary.termination = Termination::FAILED;
+				break;
+			}
+
+			Eigen::Matrix3d Rnew = R;
+			Eigen::Vector3d tnew = t;
+			applyLeftIncrement(delta, Rnew, tnew);
+			linearize(Rnew, tnew, Hnew, gnew, costNew, inliersNew);
+
+			if (costNew < cost)
+			{
+				const double decrease = (cost - costNew) / std::max(cost, 1e-12);
+				R = Rnew;
+				t = tnew;
+				H = Hnew;
+				g = gnew;
+				cost = costNew;
+				inliers = inliersNew;
+				lambda = std::max(lambda * 0.1, 1e-7);
+				if (decrease < options_.minRelativeDecrease)
+				{
+					summary.termination = Termination::RELATIVE_DECREASE;
+					break;
+				}
+			}
+			else
+			{
+				lambda *= 10.0;
+				if (lambda > 1e8)
+				{
+					summary.termination = Termination::FAILED;
+					break;
+				}
+			}
+			if (delta.norm() < options_.minStepNorm)
+			{
+				summary.termination = Termination::STEP_NORM;
+				break;
+			}
+			if (options_.maxTimeUs > 0 &&
+				std::chrono::duration<double, std::micro>(Clock::now() - start).count() > options_.maxTimeUs)
+			{
+				summary.termination = Termination::TIME_LIMIT;
+				break;
+			}
+		}
+
+		// keep R orthonormal despite the float accumulation
+		Eigen::Quaterniond q(R);
+		R = q.normalized().toRotationMatrix();
+
+		summary.finalCost = cost;
+		summary.inliers = inliers;
+		summary.solveTimeUs = std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+		return summary;
+	}
+
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <vector>
+#include <Eigen/Core>
+
+namespace MVSO
+{
+
+	// Pose-only Levenberg-Marquardt on SE(3) over mono, stereo (uL, v, uR) and
+	// 3D-3D residuals. Each iteration accumulates the 6x6 normal equations of all
+	// residuals in one fused pass (8 points per AVX2 lane group), with analytic
+	// Jacobians for the left perturbation
+	// T <- exp([rho, phi]) * T and Huber weights. No allocation happens in solve()
+	// once the observation buffers have reached their high-water mark.
+	class PoseSolver
+	{
+	public:
+		typedef Eigen::Matrix<double, 6, 6> Matrix6d;
+		typedef Eigen::Matrix<double, 6, 1> Vector6d;
+
+		struct Options
+		{
+			int maxIterations = 10;
+			double maxTimeUs = 0.0;           // wall-clock cap of one solve, 0 disables it
+			float pixelHuber = 2.45f;         // sqrt(chi2(0.95, 2 dof)), in pixels
+			float stereoHuber = 2.80f;        // sqrt(chi2(0.95, 3 dof)), in pixels
+			float metricHuber = 1.0f;         // for 3D-3D residuals, in meters
+			double minStepNorm = 1e-6;
+			double minRelativeDecrease = 1e-6;
+			double minGradientNorm = 1e-6;    // max |J^T W r|
+			double initialLambda = 1e-4;
+		};
+
+		enum class Termination
+		{
+			NO_OBSERVATIONS,
+			RELATIVE_DECREASE,
+			STEP_NORM,
+			GRADIENT,
+			MAX_ITERATIONS,
+			TIME_LIMIT,
+			FAILED            // non-finite step or damping blew up
+		};
+
+		// what one solve() did, for logging and for tuning the limits above
+		struct Summary
+		{
+			int iterations = 0;
+			double initialCost = 0.0;
+			double finalCost = 0.0;
+			int inliers = 0;                  // residuals inside the Huber threshold at the final pose
+			int observations = 0;
+			double solveTimeUs = 0.0;
+			Termination termination = Termination::NO_OBSERVATIONS;
+		};
+
+		static const char* terminationName(Termination termination);
+
+		PoseSolver();
+
+		void setIntrinsics(double fx, double fy, double cx, double cy);
+
+		// baseline times fx, with the sign of the rectified right projection
+		// matrix, so that uR = uL + bf / Z
+		void setStereo(double bf);
+
+		// drops the observations, keeps the buffers
+		void clear();
+
+		// grows the observation buffers ahead of time
+		void reserve(int projections, int alignments, int stereoProjections = 0);
+
+		// number of times an observation buffer had to be reallocated
+		long long growths() const { return growths_; }
+
+		// u ~ K * (R * X + t)
+		void addProjection(float X, float Y, float Z, float u, float v, float weight = 1.f);
+
+		// (uL, v, uR) ~ left and right projections of R * X + t in a rectified pair
+		void addStereoProjection(float X, float Y, float Z, float uL, float v, float uR, float weight = 1.f);
+
+		// target ~ R * source + t
+		void addAlignment(float sx, float sy, float sz, float tx, float ty, float tz, float weight = 1.f);
+
+		int numProjections() const { return numProjections_; }
+		int numAlignments() const { return numAlignments_; }
+		int numStereoProjections() const { return numStereo_; }
+
+		// Refines (R, t) in place until the cost, the step or the gradient stops
+		// changing, or the iteration/time cap is hit.
+		Summary solve(Eigen::Matrix3d& R, Eigen::Vector3d& t);
+
+		// J^T W J, J^T W r, the robust cost and the inlier count of the
+		// observations at (R, t), what every solve() iteration works on
+		void normalEquations(const Eigen::Matrix3d& R, const Eigen::Vector3d& t,
+			Matrix6d& H, Vector6d& g, double& cost, int& inliers);
+
+		Options options_;
+
+	private:
+		// zero weights on the padding after the last observation of each buffer
+		void clearPadding();
+
+		// observations in structure-of-arrays layout, padded to a multiple of 8
+		// with zero-weight entries
+		struct Buffer
+		{
+			std::vector<float> x, y, z, a, b, c, w;
+			void resize(size_t n);
+		};
+
+		// normal equations, cost and inlier count of all residuals at (R, t)
+		void linearize(const Eigen::Matrix3d& R, const Eigen::Vector3d& t,
+			Matrix6d& H, Vector6d& g, double& cost, int& inliers) const;
+
+		// mono (u, v) rows, plus the right-image uR row when stereo is set
+		void linearizeProjections(const Buffer& p, int count, bool stereo,
+			const Eigen::Matrix3f& R, const Eigen::Vector3f& t,
+			double* H, double* g, double& cost, int& inliers) const;
+		void linearizeAlignments(const Eigen::Matrix3f& R, const Eigen::Vector3f& t,
+			double* H, double* g, double& cost, int& inliers) const;
+
+		void grow(Buffer& buf, size_t n);
+		void push(Buffer& buf, int& count, float x, float y, float z, float a, float b, float c, float w);
+
+		double fx_, fy_, cx_, cy_, bf_;
+		Buffer projections_;
+		Buffer stereo_;
+		Buffer alignments_;
+		int numProjections_;
+		int numStereo_;
+		int numAlignments_;
+		long long growths_;
+	};
+
+}
@@ -0,0 +1,428 @@
+#include "Profiler.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+
+namespace MVSO
+{
+
+	namespace
+	{
+		const int STAGES = static_cast<int>(Stage::COUNT);
+		const int SUB_BITS = 3;
+		const int SUB_BUCKETS = 1 << SUB_BITS;
+		const int BUCKETS = (64 - SUB_BITS + 1) * SUB_BUCKETS;
+
+		int msb(uint64_t v)
+		{
+#if defined(__GNUC__)
+			return 63 - __builtin_clzll(v);
+#else
+			int n = 0;
+			while (v >>= 1)
+				n++;
+			return n;
+#endif
+		}
+
+		// values under SUB_BUCKETS ns are exact, above that each power of two
+		// is split into SUB_BUCKETS linear buckets
+		int bucketOf(uint64_t ns)
+		{
+			if (ns < SUB_BUCKETS)
+				return static_cast<int>(ns);
+			const int m = msb(ns);
+			return (m - SUB_BITS + 1) * SUB_BUCKETS + static_cast<int>((ns >> (m - SUB_BITS)) & (SUB_BUCKETS - 1));
+		}
+
+		// middle of the bucket
+		double bucketValue(int bucket)
+		{
+			if (bucket < SUB_BUCKETS)
+				return bucket;
+			const int m = bucket / SUB_BUCKETS + SUB_BITS - 1;
+			const uint64_t width = uint64_t(1) << (m - SUB_BITS);
+			return static_cast<double>((SUB_BUCKETS + bucket % SUB_BUCKETS) * width) + 0.5 * width;
+		}
+
+		// written by its thread only, read by summarize()
+		struct Histogram
+		{
+			std::atomic<uint64_t> buckets[BUCKETS];
+			std::atomic<uint64_t> count, sum, max;
+
+			Histogram() : count(0), sum(0), max(0)
+			{
+				for (std::atomic<uint64_t>& b : buckets)
+					b.store(0, std::memory_order_relaxed);
+			}
+
+			static void add(std::atomic<uint64_t>& a, uint64_t v)
+			{
+				a.store(a.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+			}
+
+			void record(uint64_t ns)
+			{
+				add(buckets[bucketOf(ns)], 1);
+				add(count, 1);
+				add(sum, ns);
+				if (ns > max.load(std::memory_order_relaxed))
+					max.store(ns, std::memory_order_relaxed);
+			}
+		};
+
+		// hardware counts of one stage, written by its thread only
+		struct CounterTotals
+		{
+			std::atomic<uint64_t> counted;
+			std::atomic<uint64_t> values[HARDWARE_COUNTERS];
+
+			CounterTotals() : counted(0)
+			{
+				for (std::atomic<uint64_t>& v : values)
+					v.store(0, std::memory_order_relaxed);
+			}
+
+			void add(const uint64_t deltas[HARDWARE_COUNTERS])
+			{
+				Histogram::add(counted, 1);
+				for (int i = 0; i < HARDWARE_COUNTERS; i++)
+					Histogram::add(values[i], deltas[i]);
+			}
+		};
+
+		struct ThreadHistograms
+		{
+			Histogram stages[STAGES];
+			CounterTotals counters[STAGES];
+			int index = 0;             // registration order, the trace tid
+			std::string name;          // under registryMutex
+		};
+
+		// histograms of finished threads stay registered
+		std::mutex registryMutex;
+		std::vector<std::shared_ptr<ThreadHistograms>>& registry()
+		{
+			static std::vector<std::shared_ptr<ThreadHistograms>> threads;
+			return threads;
+		}
+
+		ThreadHistograms& threadHistograms()
+		{
+			thread_local std::shared_ptr<ThreadHistograms> histograms;
+			if (!histograms)
+			{
+				histograms = std::make_shared<ThreadHistograms>();
+				std::lock_guard<std::mutex> lock(registryMutex);
+				histograms->index = static_cast<int>(registry().size());
+				registry().push_back(histograms);
+			}
+			return *histograms;
+		}
+
+		thread_local FrameStats* currentFrame = nullptr;
+
+		// stage is stored last, a span with stage -1 was claimed but not written
+		struct Span
+		{
+			int64_t beginNs;
+			int64_t durationNs;
+			int frameId;
+			int thread;
+			std::atomic<int> stage;
+		};
+
+		struct Trace
+		{
+			std::unique_ptr<Span[]> spans;
+			size_t capacity;
+			std::atomic<size_t> next;
+			std::atomic<long long> dropped;
+			std::chrono::steady_clock::time_point epoch;
+
+			explicit Trace(size_t capacity) : spans(new Span[capacity]), capacity(capacity), next(0), dropped(0),
+				epoch(std::chrono::steady_clock::now())
+			{
+				for (size_t i = 0; i < capacity; i++)
+					spans[i].stage.store(-1, std::memory_order_relaxed);
+			}
+
+			void add(Stage stage, std::chrono::steady_clock::time_point begin, uint64_t ns, int frameId, int thread)
+			{
+				const size_t i = next.fetch_add(1, std::memory_order_relaxed);
+				if (i >= capacity)
+				{
+					dropped.fetch_add(1, std::memory_order_relaxed);
+					return;
+				}
+				Span& span = spans[i];
+				span.beginNs = std::chrono::duration_cast<std::chrono::nanoseconds>(begin - epoch).count();
+				span.durationNs = static_cast<int64_t>(ns);
+				span.frameId = frameId;
+				span.thread = thread;
+				span.stage.store(static_cast<int>(stage), std::memory_order_release);
+			}
+		};
+
+		// set once, lives until exit
+		std::atomic<Trace*> activeTrace(nullptr);
+		std::unique_ptr<Trace> traceStorage;
+
+		void writeJsonString(FILE* file, const std::string& text)
+		{
+			std::fputc('"', file);
+			for (char c : text)
+			{
+				if (c == '"' || c == '\\')
+					std::fputc('\\', file);
+				if (static_cast<unsigned char>(c) >= 0x20)
+					std::fputc(c, file);
+			}
+			std::fputc('"', file);
+		}
+	}
+
+	const char * stageName(Stage stage)
+	{
+		switch (stage)
+		{
+		case Stage::FRAME: return "frame";
+		case Stage::GRAB: return "grab";
+		case Stage::INGEST: return "ingest";
+		case Stage::PYRAMID: return "pyramid";
+		case Stage::DETECTION: return "detection";
+		case Stage::MOTION_GATE: return "motion gate";
+		case Stage::FEATURES: return "features";
+		case Stage::MATCHING: return "matching";
+		case Stage::LK: return "LK";
+		case Stage::TRIANGULATION: return "triangulation";
+		case Stage::POSE: return "pose";
+		case Stage::RANSAC: return "RANSAC";
+		case Stage::REFINEMENT: return "refinement";
+		case Stage::LANDMARKS: return "landmarks";
+		case Stage::RIGS: return "rigs";
+		case Stage::RELOCALIZATION: return "relocalization";
+		case Stage::KEYFRAME: return "keyframe";
+		case Stage::LOCAL_BA: return "local BA";
+		case Stage::DISPLAY: return "display";
+		default: return "?";
+		}
+	}
+
+	void Profiler::record(Stage stage, uint64_t ns)
+	{
+		threadHistograms().stages[static_cast<int>(stage)].record(ns);
+	}
+
+	std::vector<Profiler::Summary> Profiler::summarize()
+	{
+		std::vector<std::shared_ptr<ThreadHistograms>> threads;
+		{
+			std::lock_guard<std::mutex> lock(registryMutex);
+			threads = registry();
+		}
+
+		std::vector<Summary> summaries;
+		std::vector<uint64_t> buckets(BUCKETS);
+		for (int s = 0; s < STAGES; s++)
+		{
+			Summary summary;
+			summary.stage = static_cast<Stage>(s);
+			std::fill(buckets.begin(), buckets.end(), 0);
+			uint64_t sum = 0, max = 0;
+			for (const std::shared_ptr<ThreadHistograms>& thread : threads)
+			{
+				const Histogram& h = thread->stages[s];
+				for (int b = 0; b < BUCKETS; b++)
+					buckets[b] += h.buckets[b].load(std::memory_order_relaxed);
+				summary.count += h.count.load(std::memory_order_relaxed);
+				sum += h.sum.load(std::memory_order_relaxed);
+				max = std::max(max, h.max.load(std::memory_order_relaxed));
+				const CounterTotals& c = thread->counters[s];
+				summary.counted += c.counted.load(std::memory_order_relaxed);
+				for (int i = 0; i < HARDWARE_COUNTERS; i++)
+					summary.counters[i] += c.values[i].load(std::memory_order_relaxed);
+			}
+			if (summary.count == 0)
+				continue;
+
+			// the bucket counts may run ahead of count while a thread records
+			uint64_t total = 0;
+			for (uint64_t b : buckets)
+				total += b;
+			const uint64_t rank50 = (total + 1) / 2, rank99 = (total * 99 + 99) / 100;
+			uint64_t seen = 0;
+			for (int b = 0; b < BUCKETS; b++)
+			{
+				if (seen < rank50 && seen + buckets[b] >= rank50)
+					summary.p50Us = bucketValue(b) / 1000.0;
+				if (seen < rank99 && seen + buckets[b] >= rank99)
+					summary.p99Us = bucketValue(b) / 1000.0;
+				seen += buckets[b];
+			}
+			summary.meanUs = sum / 1000.0 / summary.count;
+			summary.maxUs = max / 1000.0;
+			summary.p50Us = std::min(summary.p50Us, summary.maxUs);
+			summary.p99Us = std::min(summary.p99Us, summary.maxUs);
+			summaries.push_back(summary);
+		}
+		return summaries;
+	}
+
+	void Profiler::report(std::ostream & os)
+	{
+		std::vector<Summary> summaries = summarize();
+		if (summaries.empty())
+			return;
+		const bool counters = PerfCounters::enabled();
+		os << "stage timings (ms):" << std::endl;
+		os << std::setw(16) << std::left << "stage" << std::right << std::setw(10) << "count"
+			<< std::setw(10) << "mean" << std::setw(10) << "p50" << std::setw(10) << "p99" << std::setw(10) << "max";
+		if (counters)
+			os << std::setw(10) << "IPC" << std::setw(10) << "L1D/ki" << std::setw(10) << "LLC/ki" << std::setw(10) << "branch/ki";
+		os << std::endl;
+		const std::ios::fmtflags flags = os.flags();
+		os << std::fixed << std::setprecision(3);
+		for (const Summary& s : summaries)
+		{
+			os << std::setw(16) << std::left << stageName(s.stage) << std::right << std::setw(10) << s.count
+				<< std::setw(10) << s.meanUs / 1000.0 << std::setw(10) << s.p50Us / 1000.0
+				<< std::setw(10) << s.p99Us / 1000.0 << std::setw(10) << s.maxUs / 1000.0;
+			if (counters)
+			{
+				// per 1000 instructions, n/a for a counter that did not open
+				const double instructions = static_cast<double>(s.counters[static_cast<int>(HardwareCounter::INSTRUCTIONS)]);
+				const double cycles = static_cast<double>(s.counters[static_cast<int>(HardwareCounter::CYCLES)]);
+				os << std::setw(10);
+				if (cycles > 0 && PerfCounters::available(HardwareCounter::INSTRUCTIONS))
+					os << instructions / cycles;
+				else
+					os << "n/a";
+				for (HardwareCounter c : { HardwareCounter::L1D_MISSES, HardwareCounter::LLC_MISSES, HardwareCounter::BRANCH_MISSES })
+				{
+					os << std::setw(10);
+					if (instructions > 0 && PerfCounters::available(c))
+						os << 1000.0 * s.counters[static_cast<int>(c)] / instructions;
+					else
+						os << "n/a";
+				}
+			}
+			os << std::endl;
+		}
+		os.flags(flags);
+	}
+
+	Profiler::FrameScope::FrameScope(FrameStats * stats) : previous_(currentFrame)
+	{
+		currentFrame = stats;
+	}
+
+	Profiler::FrameScope::~FrameScope()
+	{
+		currentFrame = previous_;
+	}
+
+	FrameStats * Profiler::frame()
+	{
+		return currentFrame;
+	}
+
+	void Profiler::setThreadName(const std::string & name)
+	{
+		ThreadHistograms& histograms = threadHistograms();
+		std::lock_guard<std::mutex> lock(registryMutex);
+		histograms.name = name;
+	}
+
+	void Profiler::startTrace(size_t capacity)
+	{
+		std::lock_guard<std::mutex> lock(registryMutex);
+		if (traceStorage || capacity == 0)
+			return;
+		traceStorage.reset(new Trace(capacity));
+		activeTrace.store(traceStorage.get(), std::memory_order_release);
+	}
+
+	bool Profiler::tracing()
+	{
+		return activeTrace.load(std::memory_order_acquire) != nullptr;
+	}
+
+	long long Profiler::writeTrace(const std::string & path)
+	{
+		Trace* trace = activeTrace.load(std::memory_order_acquire);
+		FILE* file = std::fopen(path.c_str(), "w");
+		if (!file)
+			return -1;
+
+		// complete events ("X") in microseconds, one tid per registered thread
+		std::fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", file);
+		std::fputs("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"odometry\"}}", file);
+		{
+			std::lock_guard<std::mutex> lock(registryMutex);
+			for (const std::shared_ptr<ThreadHistograms>& thread : registry())
+			{
+				std::fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":", thread->index);
+				writeJsonString(file, thread->name.empty() ? "thread " + std::to_string(thread->index) : thread->name);
+				std::fputs("}}", file);
+			}
+		}
+
+		long long written = 0;
+		const size_t count = trace ? std::min(trace->next.load(std::memory_order_relaxed), trace->capacity) : 0;
+		for (size_t i = 0; i < count; i++)
+		{
+			const Span& span = trace->spans[i];
+			const int stage = span.stage.load(std::memory_order_acquire);
+			if (stage < 0)
+				continue;
+			std::fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"mvso\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f",
+				stageName(static_cast<Stage>(stage)), span.thread, span.beginNs / 1000.0, span.durationNs / 1000.0);
+			if (span.frameId >= 0)
+				std::fprintf(file, ",\"args\":{\"frame\":%d}", span.frameId);
+			std::fputc('}', file);
+			written++;
+		}
+		std::fputs("\n]}\n", file);
+		const bool ok = std::ferror(file) == 0;
+		if (std::fclose(file) != 0 || !ok)
+			return -1;
+		return written;
+	}
+
+	long long Profiler::droppedSpans()
+	{
+		Trace* trace = activeTrace.load(std::memory_order_acquire);
+		return trace ? trace->dropped.load(std::memory_order_relaxed) : 0;
+	}
+
+	ScopedTimer::~ScopedTimer()
+	{
+		const uint64_t ns = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now() - start_).count());
+		CounterReading reading;
+		const bool counted = counting_ && PerfCounters::read(reading);
+		const int s = static_cast<int>(stage_);
+		ThreadHistograms& histograms = threadHistograms();
+		histograms.stages[s].record(ns);
+		FrameStats* stats = currentFrame;
+		if (stats)
+			(*stats)[stage_] += ns / 1000.0;
+		if (counted)
+		{
+			uint64_t counters[HARDWARE_COUNTERS];
+			PerfCounters::delta(counters_, reading, counters);
+			histograms.counters[s].add(counters);
+			if (stats)
+				for (int i = 0; i < HARDWARE_COUNTERS; i++)
+					stats->stageCounters[s][i] += counters[i];
+		}
+		if (Trace* trace = activeTrace.load(std::memory_order_acquire))
+			trace->add(stage_, start_, ns, stats ? stats->frameId : -1, histograms.index);
+	}
+
+}
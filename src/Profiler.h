@@ -0,0 +1,162 @@
+#pragma once
+
+#include "PerfCounters.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace MVSO
+{
+
+	// Timed stages of the odometry. Stages nest: FRAME is all of process(),
+	// the others are parts of it or run beside it on the scheduler.
+	enum class Stage
+	{
+		FRAME,            // process(), gate to skip interval
+		GRAB,             // grayscale copies of the images
+		INGEST,           // pyramids and detection ahead of tracking (submit)
+		PYRAMID,          // one LK pyramid
+		DETECTION,        // FAST on one image
+		MOTION_GATE,
+		FEATURES,         // detection top-up and bucketing
+		MATCHING,         // circular, landmark or keyframe LK
+		LK,               // one LK leg
+		TRIANGULATION,
+		POSE,             // RANSAC and refinement, every estimator
+		RANSAC,           // including the five-point essential matrix
+		REFINEMENT,
+		LANDMARKS,        // depth fusion
+		RIGS,             // auxiliary rig tracking and fusion
+		RELOCALIZATION,
+		KEYFRAME,         // insertion, reference and index
+		LOCAL_BA,         // solver task and merge
+		DISPLAY,
+		COUNT
+	};
+
+	const char* stageName(Stage stage);
+
+	// What one frame went through: the counters of the primary pair, zero
+	// where a step did not run, and the wall time of each stage in
+	// microseconds, filled by the timers that run on the thread the frame is
+	// bound to (Profiler::FrameScope), with the hardware counters of each
+	// stage when PerfCounters are enabled. The times stay zero without
+	// MVSO_WITH_PROFILING, the pipeline counters do not.
+	struct FrameStats
+	{
+		int frameId = -1;
+		bool skipped = false;      // by the skip interval or the motion gate
+		bool keyframe = false;
+		bool lost = false;
+		int detected = 0;          // FAST candidates added to the previous frame
+		int features = 0;          // previous frame, tracked and new, before bucketing
+		int bucketed = 0;
+		int circleLegs[4] = {};    // surviving each LK leg: left t0 -> right t0 -> right t1 -> left t1 -> left t0
+		int matched = 0;           // after the circle closes
+		int triangulated = 0;
+		int ransacIterations = 0;
+		int inliers = 0;
+		float inlierRatio = 0.f;   // of the matches
+		int optimizerIterations = 0;
+		double stageUs[static_cast<int>(Stage::COUNT)] = {};
+		uint64_t stageCounters[static_cast<int>(Stage::COUNT)][HARDWARE_COUNTERS] = {};
+
+		double& operator[](Stage stage) { return stageUs[static_cast<int>(stage)]; }
+		double operator[](Stage stage) const { return stageUs[static_cast<int>(stage)]; }
+		uint64_t counter(Stage stage, HardwareCounter counter) const
+		{
+			return stageCounters[static_cast<int>(stage)][static_cast<int>(counter)];
+		}
+	};
+
+	// Latency histograms per stage over the whole process, and optionally a
+	// timeline of every timed span. Every thread records into histograms of
+	// its own with plain relaxed stores, so recording takes no lock and no
+	// read-modify-write; a thread registers its histograms once, and
+	// summarize() merges all of them. Buckets are log-linear with 8
+	// sub-buckets per power of two, the percentiles are within 6.25%.
+	class Profiler
+	{
+	public:
+		struct Summary
+		{
+			Stage stage;
+			uint64_t count = 0;
+			double meanUs = 0.0, p50Us = 0.0, p99Us = 0.0, maxUs = 0.0;
+			uint64_t counted = 0;      // timings with hardware counts
+			uint64_t counters[HARDWARE_COUNTERS] = {};
+		};
+
+		static void record(Stage stage, uint64_t ns);
+
+		// stages recorded at least once
+		static std::vector<Summary> summarize();
+
+		// one line per recorded stage, nothing when none was; with hardware
+		// counters also the IPC and the misses per 1000 instructions
+		static void report(std::ostream& os);
+
+		// binds the frame the calling thread works on, restores the previous
+		// binding when it goes out of scope
+		class FrameScope
+		{
+		public:
+			explicit FrameScope(FrameStats* stats);
+			~FrameScope();
+			FrameScope(const FrameScope&) = delete;
+			FrameScope& operator=(const FrameScope&) = delete;
+		private:
+			FrameStats* previous_;
+		};
+
+		static FrameStats* frame();
+
+		// names the calling thread in the trace
+		static void setThreadName(const std::string& name);
+
+		// Timeline: once a trace is started, every timer also leaves a span
+		// (stage, frame, thread, begin, duration) in a buffer of capacity spans
+		// allocated up front; spans past it are dropped and counted. Call once.
+		static void startTrace(size_t capacity);
+		static bool tracing();
+
+		// the spans so far as Chrome Trace Event JSON, for chrome://tracing
+		// or ui.perfetto.dev; returns the number of spans written, -1 when the
+		// file cannot be opened
+		static long long writeTrace(const std::string& path);
+		static long long droppedSpans();
+	};
+
+	class ScopedTimer
+	{
+	public:
+		// the counters are read before the clock starts and after it stops
+		explicit ScopedTimer(Stage stage) : stage_(stage), counting_(PerfCounters::enabled() && PerfCounters::read(counters_)),
+			start_(std::chrono::steady_clock::now()) {}
+		~ScopedTimer();
+		ScopedTimer(const ScopedTimer&) = delete;
+		ScopedTimer& operator=(const ScopedTimer&) = delete;
+	private:
+		Stage stage_;
+		CounterReading counters_;
+		bool counting_;
+		std::chrono::steady_clock::time_point start_;
+	};
+
+}
+
+// MVSO_WITH_PROFILING (the CMake option of the same name) compiles the timers
+// in; without it both macros expand to nothing.
+#ifdef MVSO_WITH_PROFILING
+#define MVSO_PROFILE_CONCAT_(a, b) a##b
+#define MVSO_PROFILE_CONCAT(a, b) MVSO_PROFILE_CONCAT_(a, b)
+#define MVSO_SCOPED_TIMER(stage) ::MVSO::ScopedTimer MVSO_PROFILE_CONCAT(scopedTimer_, __LINE__)(stage)
+#define MVSO_PROFILE_FRAME(stats) ::MVSO::Profiler::FrameScope MVSO_PROFILE_CONCAT(frameScope_, __LINE__)(stats)
+#else
+#define MVSO_SCOPED_TIMER(stage) ((void)0)
+#define MVSO_PROFILE_FRAME(stats) ((void)0)
+#endif
@@ -0,0 +1,456 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+#include "TaskScheduler.h"
+
+namespace MVSO
+{
+
+	// Counter-based random stream (SplitMix64 finalizer over seed/stream/counter).
+	// Hypothesis k always draws from stream k, so its sample never depends on
+	// which worker thread happens to evaluate it.
+	class CounterRng
+	{
+	public:
+		CounterRng(uint64_t seed, uint64_t stream)
+			: key_(mix(seed ^ mix(stream + 0x9E3779B97F4A7C15ull))), counter_(0)
+		{
+		}
+
+		uint64_t next()
+		{
+			return mix(key_ + (++counter_) * 0x9E3779B97F4A7C15ull);
+		}
+
+		// uniform integer in [0, n)
+		int uniform(int n)
+		{
+			return static_cast<int>(((next() >> 32) * static_cast<uint64_t>(n)) >> 32);
+		}
+
+		static uint64_t mix(uint64_t z)
+		{
+			z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+			z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+			return z ^ (z >> 31);
+		}
+
+	private:
+		uint64_t key_;
+		uint64_t counter_;
+	};
+
+	enum class RansacMode { ADAPTIVE, PREEMPTIVE };
+
+	struct RansacParams
+	{
+		RansacMode mode = RansacMode::ADAPTIVE;
+		int maxIterations = 100;
+		float threshold = 1.0f;      // inlier threshold, in the problem's residual unit
+		float confidence = 0.99f;    // stop once this success probability is reached
+		int blockSize = 8;           // hypotheses scored by one parallel task
+		int blocksPerRound = 8;      // termination is re-evaluated after each round
+		int numThreads = 0;          // at most this many threads per call, 1: the calling thread, <= 0: all of them
+		TaskScheduler* scheduler = nullptr;   // runs the threads when set, OpenCV's pool otherwise
+		uint64_t seed = 0x5EEDull;
+
+		// PREEMPTIVE only
+		double budgetUs = 2000.0;    // time budget of one call, in microseconds
+		int preemptionBlock = 16;    // observations scored per round before halving
+		int minHypotheses = 8;
+	};
+
+	// Running per-operation cost estimates, used to turn a time budget into a
+	// number of hypotheses and residual evaluations.
+	struct RansacCostModel
+	{
+		double fitUs = 20.0;         // one minimal solve
+		double residualUs = 0.05;    // one residual evaluation
+
+		void update(double measuredFitUs, double measuredResidualUs)
+		{
+			const double alpha = 0.2;
+			if (measuredFitUs > 0)
+				fitUs += alpha * (measuredFitUs - fitUs);
+			if (measuredResidualUs > 0)
+				residualUs += alpha * (measuredResidualUs - residualUs);
+		}
+	};
+
+	template<class Model>
+	struct RansacResult
+	{
+		Model model;
+		std::vector<int> inliers;
+		int iterations = 0;
+		bool found = false;
+		bool fromPrior = false;
+
+		void reset()
+		{
+			model = Model();
+			inliers.clear();
+			iterations = 0;
+			found = false;
+			fromPrior = false;
+		}
+	};
+
+	// Buffers reused across calls, so that RANSAC's own bookkeeping does not
+	// allocate in steady state; a minimal solver may still do (cv::solvePnP).
+	template<class Model>
+	struct RansacScratch
+	{
+		std::vector<Model> models;
+		std::vector<char> valid;
+		std::vector<int> order;
+		std::vector<std::pair<int, int> > alive;
+	};
+
+	// Draws k distinct indices out of [0, n) into ids.
+	inline void drawSample(CounterRng& rng, int n, int k, int* ids)
+	{
+		for (int i = 0; i < k; i++)
+		{
+			bool unique;
+			do
+			{
+				ids[i] = rng.uniform(n);
+				unique = true;
+				for (int j = 0; j < i; j++)
+				{
+					if (ids[j] == ids[i])
+					{
+						unique = false;
+						break;
+					}
+				}
+			} while (!unique);
+		}
+	}
+
+	// body(range) over [0, count) on at most params.numThreads threads, those
+	// of params.scheduler (its workers and the caller) or of OpenCV's pool. The
+	// nstripes argument of cv::parallel_for_ only hints how to split a range,
+	// so the range is cut here into that many stripes, one task each.
+	template<class Body>
+	void ransacParallelFor(const RansacParams& params, int count, const Body& body)
+	{
+		const int available = params.scheduler ? params.scheduler->numWorkers() + 1 : cv::getNumThreads();
+		const int threads = std::min(count, params.numThreads > 0 ? params.numThreads : available);
+		if (threads <= 1)
+		{
+			body(cv::Range(0, count));
+			return;
+		}
+		auto stripe = [&](int s)
+		{
+			body(cv::Range(count * s / threads, count * (s + 1) / threads));
+		};
+		if (params.scheduler)
+		{
+			params.scheduler->parallelFor(0, threads, stripe);
+			return;
+		}
+		cv::parallel_for_(cv::Range(0, threads), [&](const cv::Range& stripes)
+		{
+			for (int s = stripes.start; s < stripes.end; s++)
+				stripe(s);
+		});
+	}
+
+	// Number of hypotheses needed to draw one all-inlier sample with the given confidence.
+	inline int ransacRequiredIterations(double inlierRatio, int sampleSize, double confidence, int maxIterations)
+	{
+		double w = std::pow(inlierRatio, sampleSize);
+		if (w >= 1.0)
+			return 1;
+		if (w <= 0.0)
+			return maxIterations;
+		double n = std::log(1.0 - confidence) / std::log(1.0 - w);
+		if (n >= maxIterations)
+			return maxIterations;
+		return std::max(1, static_cast<int>(std::ceil(n)));
+	}
+
+	// Keeps the best (inliers, hypothesis) pair with a single CAS. Ties go to the
+	// lower hypothesis index, which makes the reduction order independent.
+	class BestHypothesis
+	{
+	public:
+		BestHypothesis() : packed_(0) {}
+
+		void offer(int inlierCount, int hypothesis)
+		{
+			uint64_t candidate = pack(inlierCount, hypothesis);
+			uint64_t current = packed_.load(std::memory_order_relaxed);
+			while (candidate > current &&
+				!packed_.compare_exchange_weak(current, candidate, std::memory_order_relaxed))
+			{
+			}
+		}
+
+		int inliers() const { return static_cast<int>(packed_.load() >> 32); }
+		int hypothesis() const { return static_cast<int>(0xFFFFFFFFu - static_cast<uint32_t>(packed_.load())); }
+
+	private:
+		static uint64_t pack(int inlierCount, int hypothesis)
+		{
+			return (static_cast<uint64_t>(inlierCount) << 32) | (0xFFFFFFFFu - static_cast<uint32_t>(hypothesis));
+		}
+
+		std::atomic<uint64_t> packed_;
+	};
+
+	// Scores a prior model (e.g. constant-velocity motion) before any sampling.
+	// If it explains at least minInlierRatio of the data, result is filled in
+	// with fromPrior set and RANSAC can be skipped. Returns the prior's inlier ratio.
+	template<class Problem>
+	float scorePriorModel(const Problem& problem, const typename Problem::Model& prior, float minInlierRatio,
+		RansacResult<typename Problem::Model>& result)
+	{
+		result.reset();
+		const int n = problem.size();
+		if (n < Problem::kSampleSize)
+			return 0.f;
+
+		float ratio = float(problem.score(prior)) / n;
+		if (ratio >= minInlierRatio)
+		{
+			result.model = prior;
+			result.found = true;
+			result.fromPrior = true;
+			result.iterations = 0;
+			problem.inliers(prior, result.inliers);
+		}
+		return ratio;
+	}
+
+	// Generic RANSAC. Problem provides:
+	//   typedef ... Model;
+	//   static const int kSampleSize;
+	//   int size() const;
+	//   bool fit(const int* sample, Model& model) const;   // minimal solver
+	//   int score(const Model& model) const;               // inlier count
+	//   void inliers(const Model& model, std::vector<int>& ids) const;
+	//
+	// Hypotheses are generated and scored in parallel blocks. The hypothesis set
+	// of each round is fixed, so the result is identical for any thread count.
+	template<class Problem>
+	void runRansac(const Problem& problem, const RansacParams& params,
+		RansacResult<typename Problem::Model>& result, RansacScratch<typename Problem::Model>& scratch)
+	{
+		typedef typename Problem::Model Model;
+		const int k = Problem::kSampleSize;
+		const int n = problem.size();
+
+		result.reset();
+		if (n < k)
+			return;
+
+		const int roundSize = params.blockSize * params.blocksPerRound;
+		std::vector<Model>& models = scratch.models;
+		if (static_cast<int>(models.size()) < roundSize)
+			models.resize(roundSize);
+		BestHypothesis best;
+		Model bestModel;
+		int bestInliers = 0;
+		int required = params.maxIterations;
+		int done = 0;
+
+		while (done < required)
+		{
+			const int first = done;
+			const int count = std::min(roundSize, required - done);
+			const int blocks = (count + params.blockSize - 1) / params.blockSize;
+
+			auto scoreBlocks = [&](const cv::Range& range)
+			{
+				int sample[Problem::kSampleSize];
+				for (int b = range.start; b < range.end; b++)
+				{
+					int end = std::min(count, (b + 1) * params.blockSize);
+					for (int h = b * params.blockSize; h < end; h++)
+					{
+						CounterRng rng(params.seed, static_cast<uint64_t>(first + h));
+						drawSample(rng, n, k, sample);
+						if (!problem.fit(sample, models[h]))
+							continue;
+						best.offer(problem.score(models[h]), first + h);
+					}
+				}
+			};
+
+			ransacParallelFor(params, blocks, scoreBlocks);
+
+			done += count;
+
+			if (best.inliers() > bestInliers)
+			{
+				bestInliers = best.inliers();
+				bestModel = models[best.hypothesis() - first];
+				result.found = true;
+				required = ransacRequiredIterations(double(bestInliers) / n, k,
+					params.confidence, params.maxIterations);
+			}
+		}
+
+		result.iterations = done;
+		if (result.found)
+		{
+			result.model = bestModel;
+			problem.inliers(bestModel, result.inliers);
+		}
+	}
+
+	template<class Problem>
+	RansacResult<typename Problem::Model> runRansac(const Problem& problem, const RansacParams& params)
+	{
+		RansacResult<typename Problem::Model> result;
+		RansacScratch<typename Problem::Model> scratch;
+		runRansac(problem, params, result, scratch);
+		return result;
+	}
+
+	// Preemptive RANSAC (Nister 2005). A fixed set of M hypotheses is scored
+	// breadth-first on growing blocks of observations (in a shuffled order) and
+	// the survivors are halved after every block, so the whole call costs
+	// M fits + about 2 * M * preemptionBlock + N residual evaluations whatever
+	// the outlier ratio. M is derived from params.budgetUs and the cost model,
+	// which is refreshed with the timings measured here. In addition to the
+	// runRansac() interface, Problem must provide
+	//   bool isInlier(const Model& model, int i) const;
+	template<class Problem>
+	void runPreemptiveRansac(const Problem& problem, const RansacParams& params, RansacCostModel& cost,
+		RansacResult<typename Problem::Model>& result, RansacScratch<typename Problem::Model>& scratch)
+	{
+		typedef typename Problem::Model Model;
+		typedef std::chrono::steady_clock Clock;
+		const int k = Problem::kSampleSize;
+		const int n = problem.size();
+		const int B = std::max(1, params.preemptionBlock);
+
+		result.reset();
+		if (n < k)
+			return;
+
+		double perHypothesisUs = cost.fitUs + 2.0 * B * cost.residualUs;
+		double available = params.budgetUs - n * cost.residualUs;
+		int M = static_cast<int>(available / perHypothesisUs);
+		M = std::max(params.minHypotheses, std::min(M, params.maxIterations));
+
+		// generate hypotheses
+		Clock::time_point tFit = Clock::now();
+		std::vector<Model>& models = scratch.models;
+		std::vector<char>& valid = scratch.valid;
+		if (static_cast<int>(models.size()) < M)
+			models.resize(M);
+		valid.assign(M, 0);
+		auto generate = [&](const cv::Range& range)
+		{
+			int sample[Problem::kSampleSize];
+			for (int h = range.start; h < range.end; h++)
+			{
+				CounterRng rng(params.seed, static_cast<uint64_t>(h));
+				drawSample(rng, n, k, sample);
+				valid[h] = problem.fit(sample, models[h]);
+			}
+		};
+		ransacParallelFor(params, M, generate);
+		double fitUs = std::chrono::duration<double, std::micro>(Clock::now() - tFit).count() / M;
+
+		// observation order, shuffled once per call
+		std::vector<int>& order = scratch.order;
+		order.resize(n);
+		for (int i = 0; i < n; i++)
+			order[i] = i;
+		CounterRng shuffle(params.seed, 0xFFFFFFFFull);
+		for (int i = n - 1; i > 0; i--)
+			std::swap(order[i], order[shuffle.uniform(i + 1)]);
+
+		// (score, hypothesis) of the survivors
+		std::vector<std::pair<int, int> >& alive = scratch.alive;
+		alive.clear();
+		for (int h = 0; h < M; h++)
+			if (valid[h])
+				alive.push_back(std::make_pair(0, h));
+		if (alive.empty())
+		{
+			result.iterations = M;
+			return;
+		}
+
+		Clock::time_point tScore = Clock::now();
+		long long evaluations = 0;
+		int scored = 0;
+		while (alive.size() > 1 && scored < n)
+		{
+			const int end = std::min(n, scored + B);
+			auto scoreBlock = [&](const cv::Range& range)
+			{
+				for (int a = range.start; a < range.end; a++)
+				{
+					const Model& model = models[alive[a].second];
+					int count = 0;
+					for (int i = scored; i < end; i++)
+						count += problem.isInlier(model, order[i]);
+					alive[a].first += count;
+				}
+			};
+			const int survivors = static_cast<int>(alive.size());
+			if (survivors * (end - scored) < 1024)
+				scoreBlock(cv::Range(0, survivors));
+			else
+				ransacParallelFor(params, survivors, scoreBlock);
+			evaluations += static_cast<long long>(survivors) * (end - scored);
+			scored = end;
+
+			// keep the better half; ties go to the lower hypothesis index
+			size_t keep = std::max<size_t>(1, alive.size() / 2);
+			std::sort(alive.begin(), alive.end(), [](const std::pair<int, int>& a, const std::pair<int, int>& b)
+			{
+				return a.first != b.first ? a.first > b.first : a.second < b.second;
+			});
+			alive.resize(keep);
+		}
+
+		result.model = models[alive.front().second];
+		result.found = true;
+		result.iterations = M;
+		problem.inliers(result.model, result.inliers);
+		evaluations += n;
+
+		double residualUs = std::chrono::duration<double, std::micro>(Clock::now() - tScore).count() / evaluations;
+		cost.update(fitUs, residualUs);
+	}
+
+	// Runs the RANSAC variant selected by params.mode.
+	template<class Problem>
+	void runRansac(const Problem& problem, const RansacParams& params, RansacCostModel& cost,
+		RansacResult<typename Problem::Model>& result, RansacScratch<typename Problem::Model>& scratch)
+	{
+		if (params.mode == RansacMode::PREEMPTIVE)
+			runPreemptiveRansac(problem, params, cost, result, scratch);
+		else
+			runRansac(problem, params, result, scratch);
+	}
+
+	template<class Problem>
+	RansacResult<typename Problem::Model> runRansac(const Problem& problem, const RansacParams& params,
+		RansacCostModel& cost)
+	{
+		RansacResult<typename Problem::Model> result;
+		RansacScratch<typename Problem::Model> scratch;
+		runRansac(problem, params, cost, result, scratch);
+		return result;
+	}
+
+}
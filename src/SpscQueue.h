@@ -0,0 +1,96 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+namespace MVSO
+{
+
+	// Bounded single-producer single-consumer ring buffer. Push and pop never
+	// block or lock: each side owns one index and only reads the other one, so
+	// the only synchronization is one acquire/release pair per item.
+	template <typename T>
+	class SpscQueue
+	{
+	public:
+		// capacity is rounded up to a power of two
+		explicit SpscQueue(size_t capacity)
+		{
+			size_t size = 1;
+			while (size < capacity)
+				size <<= 1;
+			slots_.resize(size);
+			mask_ = size - 1;
+		}
+
+		size_t capacity() const { return slots_.size(); }
+
+		// moves item in, false when full
+		bool tryPush(T& item)
+		{
+			const size_t tail = tail_.load(std::memory_order_relaxed);
+			if (tail - head_.load(std::memory_order_acquire) == slots_.size())
+				return false;
+			slots_[tail & mask_] = std::move(item);
+			tail_.store(tail + 1, std::memory_order_release);
+			return true;
+		}
+
+		// moves the oldest item out, false when empty
+		bool tryPop(T& item)
+		{
+			const size_t head = head_.load(std::memory_order_relaxed);
+			if (head == tail_.load(std::memory_order_acquire))
+				return false;
+			item = std::move(slots_[head & mask_]);
+			head_.store(head + 1, std::memory_order_release);
+			return true;
+		}
+
+		// exact on the producer side, the consumer can only make room
+		bool full() const
+		{
+			return tail_.load(std::memory_order_relaxed) - head_.load(std::memory_order_acquire) == slots_.size();
+		}
+
+		bool empty() const
+		{
+			return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+		}
+
+	private:
+		// the indices sit on separate cache lines, padded rather than alignas so
+		// the queue stays heap-allocatable without C++17 aligned new
+		std::vector<T> slots_;
+		size_t mask_;
+		char padding0_[64];
+		std::atomic<size_t> head_{ 0 };   // written by the consumer
+		char padding1_[64 - sizeof(std::atomic<size_t>)];
+		std::atomic<size_t> tail_{ 0 };   // written by the producer
+	};
+
+	// Waiting on a lock-free queue: yield for a while, then sleep in short
+	// steps so an idle stage does not hold a core.
+	class Backoff
+	{
+	public:
+		void wait()
+		{
+			if (spins_ < 64)
+			{
+				spins_++;
+				std::this_thread::yield();
+			}
+			else
+				std::this_thread::sleep_for(std::chrono::microseconds(100));
+		}
+
+		void reset() { spins_ = 0; }
+
+	private:
+		int spins_ = 0;
+	};
+
+}
@@ -0,0 +1,232 @@
+#include "SyntheticSequence.h"
+#include "Ransac.h"
+
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <sys/stat.h>
+
+namespace MVSO
+{
+
+	namespace
+	{
+		// surfaces, also the texture stream of each
+		enum Surface { GROUND = 1, LEFT_WALL = 2, RIGHT_WALL = 3 };
+
+		const float SKY = 210.f;
+
+		// gray level of texture cell (i, j) of a surface, never close to the sky
+		float cellGray(uint64_t seed, int surface, int64_t i, int64_t j)
+		{
+			const uint64_t key = CounterRng::mix(seed ^ CounterRng::mix(static_cast<uint64_t>(surface) * 0x9E3779B97F4A7C15ull
+				^ CounterRng::mix(static_cast<uint64_t>(i) * 0xD1B54A32D192ED03ull + static_cast<uint64_t>(j))));
+			return 20.f + static_cast<float>(key >> 56) * (170.f / 255.f);
+		}
+
+		// uniform in [0, 1)
+		double uniform(CounterRng& rng)
+		{
+			return static_cast<double>(rng.next() >> 11) * (1.0 / 9007199254740992.0);
+		}
+
+		int makeDirectory(const std::string& path)
+		{
+			return mkdir(path.c_str(), 0755) == 0 || errno == EEXIST ? 0 : -1;
+		}
+	}
+
+	SyntheticSequence::SyntheticSequence(const CameraModel & camera, const Options & options)
+		: options_(options), fx_(camera.fx_), fy_(camera.fy_), cx_(camera.cx_), cy_(camera.cy_),
+		baseline_(std::abs(camera.bf_) / camera.fx_)
+	{
+		CV_Assert(cx_ >= 0 && cx_ < options_.width && cy_ >= 0 && cy_ < options_.height);
+		// heading yaw about y, forward is (sin yaw, 0, cos yaw)
+		Eigen::Vector3d position = Eigen::Vector3d::Zero();
+		for (int i = 0; i < options_.frames; i++)
+		{
+			const double yaw = options_.yawAmplitude * std::sin(2.0 * M_PI * i / options_.turnPeriod);
+			Eigen::Matrix3d R;
+			R << std::cos(yaw), 0, std::sin(yaw),
+				0, 1, 0,
+				-std::sin(yaw), 0, std::cos(yaw);
+			rotations_.push_back(R);
+			positions_.push_back(position);
+			position += options_.speed * R.col(2);
+		}
+	}
+
+	int SyntheticSequence::size() const
+	{
+		return options_.frames;
+	}
+
+	void SyntheticSequence::getPose(int frame, Eigen::Matrix3d & Rwc, Eigen::Vector3d & twc) const
+	{
+		Rwc = rotations_[frame];
+		twc = positions_[frame];
+	}
+
+	float SyntheticSequence::shade(const Eigen::Vector3d & center, const Eigen::Vector3d & direction) const
+	{
+		// nearest of the ground (y = cameraHeight) and the walls (x = +-halfWidth, up to wallHeight)
+		const double groundY = options_.cameraHeight, wallTop = groundY - options_.wallHeight;
+		double nearest = std::numeric_limits<double>::infinity();
+		int surface = 0;
+		double a = 0, b = 0;
+		if (direction.y() > 1e-9)
+		{
+			const double s = (groundY - center.y()) / direction.y();
+			if (s > 0 && s < nearest)
+			{
+				const Eigen::Vector3d p = center + s * direction;
+				if (std::abs(p.x()) <= options_.streetHalfWidth)
+				{
+					nearest = s;
+					surface = GROUND;
+					a = p.x();
+					b = p.z();
+				}
+			}
+		}
+		if (std::abs(direction.x()) > 1e-9)
+		{
+			const double wallX = direction.x() > 0 ? options_.streetHalfWidth : -options_.streetHalfWidth;
+			const double s = (wallX - center.x()) / direction.x();
+			if (s > 0 && s < nearest)
+			{
+				const Eigen::Vector3d p = center + s * direction;
+				if (p.y() >= wallTop && p.y() <= groundY)
+				{
+					nearest = s;
+					surface = direction.x() > 0 ? RIGHT_WALL : LEFT_WALL;
+					a = p.z();
+					b = p.y();
+				}
+			}
+		}
+		if (!surface)
+			return SKY;
+		const double density = options_.textureDensity;
+		return cellGray(options_.seed, surface, static_cast<int64_t>(std::floor(a * density)),
+			static_cast<int64_t>(std::floor(b * density)));
+	}
+
+	void SyntheticSequence::renderView(int frame, const Eigen::Vector3d & offset, cv::Mat & image) const
+	{
+		image.create(options_.height, options_.width, CV_8UC1);
+		const Eigen::Matrix3d& R = rotations_[frame];
+		const Eigen::Vector3d center = positions_[frame] + R * offset;
+		const int n = std::max(1, options_.samples);
+		cv::parallel_for_(cv::Range(0, options_.height), [&](const cv::Range& rows) {
+			for (int v = rows.start; v < rows.end; v++)
+			{
+				uchar* row = image.ptr<uchar>(v);
+				for (int u = 0; u < options_.width; u++)
+				{
+					float sum = 0.f;
+					for (int sv = 0; sv < n; sv++)
+					{
+						for (int su = 0; su < n; su++)
+						{
+							// sample centers inside the pixel, whose center is (u, v)
+							const double x = u - 0.5 + (su + 0.5) / n, y = v - 0.5 + (sv + 0.5) / n;
+							const Eigen::Vector3d ray((x - cx_) / fx_, (y - cy_) / fy_, 1.0);
+							sum += shade(center, R * ray);
+						}
+					}
+					row[u] = cv::saturate_cast<uchar>(sum / (n * n));
+				}
+			}
+		});
+	}
+
+	void SyntheticSequence::drawOutliers(int frame, cv::Mat & left, cv::Mat & right) const
+	{
+		// stream 2 * frames + frame: disjoint from the noise streams
+		CounterRng rng(options_.seed, 2 * static_cast<uint64_t>(options_.frames) + frame);
+		for (int k = 0; k < options_.outliers; k++)
+		{
+			cv::Mat& image = rng.uniform(2) ? right : left;
+			const int size = 8 + rng.uniform(17);
+			const int x0 = rng.uniform(std::max(1, options_.width - size)), y0 = rng.uniform(std::max(1, options_.height - size));
+			// a small checkerboard of random cells, seen by one camera only
+			for (int y = 0; y < size; y += 4)
+			{
+				for (int x = 0; x < size; x += 4)
+				{
+					const cv::Rect cell(x0 + x, y0 + y, std::min(4, size - x), std::min(4, size - y));
+					image(cell & cv::Rect(0, 0, image.cols, image.rows)).setTo(cv::Scalar(20 + rng.uniform(216)));
+				}
+			}
+		}
+	}
+
+	void SyntheticSequence::render(int frame, cv::Mat & left, cv::Mat & right) const
+	{
+		CV_Assert(frame >= 0 && frame < options_.frames);
+		renderView(frame, Eigen::Vector3d::Zero(), left);
+		renderView(frame, Eigen::Vector3d(baseline_, 0, 0), right);
+		if (options_.outliers > 0)
+			drawOutliers(frame, left, right);
+		if (options_.noiseSigma > 0)
+		{
+			// Box-Muller on the frame's streams, one per image
+			cv::Mat* images[2] = { &left, &right };
+			for (int side = 0; side < 2; side++)
+			{
+				CounterRng rng(options_.seed, 2 * static_cast<uint64_t>(frame) + side);
+				cv::Mat& image = *images[side];
+				for (int v = 0; v < image.rows; v++)
+				{
+					uchar* row = image.ptr<uchar>(v);
+					for (int u = 0; u < image.cols; u++)
+					{
+						const double r = std::sqrt(-2.0 * std::log(1.0 - uniform(rng)));
+						const double noise = options_.noiseSigma * r * std::cos(2.0 * M_PI * uniform(rng));
+						row[u] = cv::saturate_cast<uchar>(row[u] + noise);
+					}
+				}
+			}
+		}
+	}
+
+	bool SyntheticSequence::writePoses(const std::string & path) const
+	{
+		std::ofstream file(path);
+		if (!file)
+			return false;
+		file << std::scientific << std::setprecision(9);
+		for (int i = 0; i < options_.frames; i++)
+		{
+			const Eigen::Matrix3d& R = rotations_[i];
+			const Eigen::Vector3d& t = positions_[i];
+			for (int r = 0; r < 3; r++)
+			{
+				file << R(r, 0) << " " << R(r, 1) << " " << R(r, 2) << " " << t(r);
+				file << (r < 2 ? " " : "\n");
+			}
+		}
+		return static_cast<bool>(file);
+	}
+
+	bool SyntheticSequence::writeSequence(const std::string & directory) const
+	{
+		const std::string root = directory.empty() || directory.back() == '/' ? directory : directory + "/";
+		if (makeDirectory(root) || makeDirectory(root + "image_2") || makeDirectory(root + "image_3"))
+			return false;
+		cv::Mat left, right;
+		for (int i = 0; i < options_.frames; i++)
+		{
+			render(i, left, right);
+			if (!cv::imwrite(root + cv::format("image_2/%06d.png", i), left)
+				|| !cv::imwrite(root + cv::format("image_3/%06d.png", i), right))
+				return false;
+		}
+		return writePoses(root + "poses.txt");
+	}
+
+}
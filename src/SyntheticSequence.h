@@ -0,0 +1,77 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <Eigen/Core>
+#include <string>
+#include <vector>
+
+#include "cameramodel.h"
+
+namespace MVSO
+{
+
+	// Rectified stereo pairs of a procedurally textured street, rendered by
+	// ray casting along a scripted trajectory, with the ground truth poses.
+	// The street is a ground plane and two walls; every surface is tiled with
+	// cells of random gray, so the corners are the cell junctions and the
+	// texture density sets how many there are. Everything is drawn from
+	// CounterRng streams of the seed, so a frame does not depend on the others
+	// and can be rendered alone, in any order, the same on every run. Across
+	// machines the poses and cell edges go through libm's sin, cos and log,
+	// whose last bits may differ, so a pixel on a cell edge can flip.
+	//
+	// World frame: the first left camera, x right, y down, z forward. The
+	// camera moves forward at a constant speed and slaloms with a sinusoidal
+	// heading.
+	class SyntheticSequence
+	{
+	public:
+		struct Options
+		{
+			int width = 1241;              // KITTI 00; the principal point must lie inside
+			int height = 376;
+			int frames = 200;
+			double speed = 1.0;            // meters per frame
+			double yawAmplitude = 0.05;    // radians of heading at the peak of the slalom
+			double turnPeriod = 200.0;     // frames per slalom
+			double textureDensity = 4.0;   // texture cells per meter
+			double cameraHeight = 1.65;    // above the ground, meters
+			double streetHalfWidth = 6.0;
+			double wallHeight = 6.0;
+			int outliers = 0;              // patches per frame drawn into one image of the pair only
+			double noiseSigma = 0.0;       // gray levels of Gaussian noise per pixel
+			int samples = 2;               // per pixel and axis, antialiasing
+			uint64_t seed = 1;
+		};
+
+		SyntheticSequence(const CameraModel& camera, const Options& options);
+
+		int size() const;
+
+		// 8-bit gray left and right images of a frame
+		void render(int frame, cv::Mat& left, cv::Mat& right) const;
+
+		// left camera to world
+		void getPose(int frame, Eigen::Matrix3d& Rwc, Eigen::Vector3d& twc) const;
+
+		// one line per frame, the 3x4 camera to world matrix row by row, as the
+		// KITTI ground truth and loadPoses()
+		bool writePoses(const std::string& path) const;
+
+		// directory/image_2 and image_3 PNGs named as loadImageLeft/Right read
+		// them, and directory/poses.txt
+		bool writeSequence(const std::string& directory) const;
+
+	private:
+		// gray level seen along a world ray from center, 0..255
+		float shade(const Eigen::Vector3d& center, const Eigen::Vector3d& direction) const;
+		void renderView(int frame, const Eigen::Vector3d& offset, cv::Mat& image) const;
+		void drawOutliers(int frame, cv::Mat& left, cv::Mat& right) const;
+
+		Options options_;
+		double fx_, fy_, cx_, cy_, baseline_;
+		std::vector<Eigen::Matrix3d> rotations_;
+		std::vector<Eigen::Vector3d> positions_;
+	};
+
+}
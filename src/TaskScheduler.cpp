@@ -0,0 +1,244 @@
+#include "TaskScheduler.h"
+#include "Logger.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <exception>
+#include <opencv2/core.hpp>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace MVSO
+{
+
+	namespace
+	{
+		// the scheduler and worker the calling thread belongs to, if any
+		thread_local const TaskScheduler* currentScheduler = nullptr;
+		thread_local int currentWorker = -1;
+
+		void pinThread(std::thread& thread, int cpu)
+		{
+#ifdef __linux__
+			cpu_set_t set;
+			CPU_ZERO(&set);
+			CPU_SET(cpu, &set);
+			if (pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set) != 0)
+				MVSO_LOG_WARN("TaskScheduler: cannot pin a worker to cpu " << cpu);
+#else
+			(void)thread;
+			(void)cpu;
+#endif
+		}
+	}
+
+	TaskScheduler::TaskScheduler(const Options & options)
+		: queued_(0), stop_(false), nextWorker_(0), steals_(0)
+	{
+		if (options.opencvThreads >= 0)
+			cv::setNumThreads(options.opencvThreads);
+
+		int count = options.workers > 0 ? options.workers : static_cast<int>(std::thread::hardware_concurrency());
+		if (count < 1)
+			count = 1;
+		for (int i = 0; i < count; i++)
+			workers_.emplace_back(new Worker);
+		for (int i = 0; i < count; i++)
+		{
+			int cpu = options.cpus.empty() ? -1 : options.cpus[i % options.cpus.size()];
+			workers_[i]->thread = std::thread(&TaskScheduler::run, this, i);
+			if (cpu >= 0)
+				pinThread(workers_[i]->thread, cpu);
+		}
+	}
+
+	TaskScheduler::~TaskScheduler()
+	{
+		{
+			std::lock_guard<std::mutex> lock(sleepMutex_);
+			stop_ = true;
+		}
+		wakeUp_.notify_all();
+		for (auto& worker : workers_)
+			worker->thread.join();
+	}
+
+	void TaskScheduler::spawn(std::function<void()> task)
+	{
+		int index = currentScheduler == this
+			? currentWorker
+			: static_cast<int>(nextWorker_++ % workers_.size());
+		queued_++;
+		{
+			std::lock_guard<std::mutex> lock(workers_[index]->mutex);
+			workers_[index]->tasks.push_back(std::move(task));
+		}
+		{
+			// pairs with the predicate check of a worker going to sleep
+			std::lock_guard<std::mutex> lock(sleepMutex_);
+		}
+		wakeUp_.notify_one();
+	}
+
+	bool TaskScheduler::pop(int index, std::function<void()>& task)
+	{
+		Worker& worker = *workers_[index];
+		std::lock_guard<std::mutex> lock(worker.mutex);
+		if (worker.tasks.empty())
+			return false;
+		task = std::move(worker.tasks.back());
+		worker.tasks.pop_back();
+		return true;
+	}
+
+	bool TaskScheduler::steal(int index, std::function<void()>& task)
+	{
+		// index < 0: a thread outside the pool, every deque is a victim
+		const int count = static_cast<int>(workers_.size());
+		const int base = std::max(index, 0);
+		for (int k = index < 0 ? 0 : 1; k < count; k++)
+		{
+			Worker& victim = *workers_[(base + k) % count];
+			std::lock_guard<std::mutex> lock(victim.mutex);
+			if (victim.tasks.empty())
+				continue;
+			task = std::move(victim.tasks.front());
+			victim.tasks.pop_front();
+			steals_++;
+			return true;
+		}
+		return false;
+	}
+
+	void TaskScheduler::execute(std::function<void()>& task)
+	{
+		queued_--;
+		try
+		{
+			task();
+		}
+		catch (const std::exception& e)
+		{
+			MVSO_LOG_ERROR("TaskScheduler: task failed: " << e.what());
+		}
+		catch (...)
+		{
+			MVSO_LOG_ERROR("TaskScheduler: task failed with an unknown exception");
+		}
+		task = nullptr;
+	}
+
+	bool TaskScheduler::runPending()
+	{
+		std::function<void()> task;
+		const int index = currentScheduler == this ? currentWorker : -1;
+		if (!(index >= 0 && pop(index, task)) && !steal(index, task))
+			return false;
+		execute(task);
+		return true;
+	}
+
+	void TaskScheduler::run(int index)
+	{
+		currentScheduler = this;
+		currentWorker = index;
+		Profiler::setThreadName("worker " + std::to_string(index));
+		std::function<void()> task;
+		while (true)
+		{
+			if (pop(index, task) || steal(index, task))
+			{
+				execute(task);
+				continue;
+			}
+
+			std::unique_lock<std::mutex> lock(sleepMutex_);
+			wakeUp_.wait(lock, [this] { return stop_ || queued_ > 0; });
+			if (stop_ && queued_ == 0)
+				return;
+		}
+	}
+
+	void TaskScheduler::parallelFor(int begin, int end, const std::function<void(int)>& body)
+	{
+		const int count = end - begin;
+		if (count <= 0)
+			return;
+		if (count == 1 || workers_.size() == 1)
+		{
+			for (int i = begin; i < end; i++)
+				body(i);
+			return;
+		}
+
+		// helpers that start late find nothing left and return, so the state
+		// they share with the caller is reference counted
+		struct State
+		{
+			std::atomic<int> next;
+			std::atomic<int> done;
+			std::atomic<bool> failed;
+			std::exception_ptr error;
+			std::function<void(int)> body;
+			std::mutex mutex;
+			std::condition_variable finished;
+		};
+		// counts an index as done on every exit from its body, so the caller
+		// never waits on an index that threw
+		struct DoneGuard
+		{
+			State& state;
+			int count;
+			~DoneGuard()
+			{
+				if (++state.done == count)
+				{
+					// the caller checks done under the mutex before it sleeps
+					std::lock_guard<std::mutex> lock(state.mutex);
+					state.finished.notify_one();
+				}
+			}
+		};
+		auto state = std::make_shared<State>();
+		state->next = begin;
+		state->done = 0;
+		state->failed = false;
+		state->body = body;
+		auto work = [state, begin, end] {
+			int i;
+			while ((i = state->next++) < end)
+			{
+				DoneGuard guard{ *state, end - begin };
+				// after a failure the remaining indices are claimed but not run
+				if (state->failed)
+					continue;
+				try
+				{
+					state->body(i);
+				}
+				catch (...)
+				{
+					std::lock_guard<std::mutex> lock(state->mutex);
+					if (!state->error)
+						state->error = std::current_exception();
+					state->failed = true;
+				}
+			}
+		};
+
+		const int helpers = std::min(count - 1, static_cast<int>(workers_.size()));
+		for (int h = 0; h < helpers; h++)
+			spawn(work);
+		work();
+
+		// the remaining indices are running on other threads; the body captures
+		// the caller's locals, so wait for them even when one of them failed
+		std::unique_lock<std::mutex> lock(state->mutex);
+		state->finished.wait(lock, [&state, count] { return state->done.load() == count; });
+		if (state->error)
+			std::rethrow_exception(state->error);
+	}
+
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace MVSO
+{
+
+	// Work-stealing thread pool shared by every stage of one odometry instance:
+	// the pipeline stages, chunked LK, and the local BA. Each worker owns a
+	// deque; it pops its own tasks LIFO and, when it runs dry, steals the oldest
+	// task of another worker. Tasks spawned from a worker go to its own deque,
+	// tasks from outside are dealt round robin.
+	//
+	// The worker count and CPU set are the pipeline's CPU budget; RANSAC runs
+	// its hypotheses on the scheduler too, see RansacParams::scheduler. OpenCV's
+	// own pool is process-wide, so the scheduler leaves it alone by default.
+	// opencvThreads = 0 keeps OpenCV sequential inside the tasks instead of
+	// oversubscribing the cores, at the price of every other cv::parallel_for_
+	// user in the process, other pipelines included.
+	class TaskScheduler
+	{
+	public:
+		struct Options
+		{
+			int workers = 0;                  // 0: one per hardware thread
+			std::vector<int> cpus;            // pin worker i to cpus[i % size], empty: no pinning
+			int opencvThreads = -1;           // cv::setNumThreads value, -1 leaves OpenCV alone
+		};
+
+		explicit TaskScheduler(const Options& options);
+
+		// runs the queued tasks, then joins the workers
+		~TaskScheduler();
+
+		void spawn(std::function<void()> task);
+
+		template <typename F>
+		auto async(F&& f) -> std::future<decltype(f())>
+		{
+			typedef decltype(f()) R;
+			auto task = std::make_shared<std::packaged_task<R()>>(std::forward<F>(f));
+			std::future<R> result = task->get_future();
+			spawn([task] { (*task)(); });
+			return result;
+		}
+
+		// waits for a future of this scheduler, running queued tasks meanwhile,
+		// so a task can wait on the tasks it spawned even when every worker is
+		// busy. With nothing queued it blocks on the future, looking for new
+		// tasks again every idleWait.
+		template <typename T>
+		T wait(std::future<T>& future)
+		{
+			const std::chrono::microseconds idleWait(200);
+			while (future.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+			{
+				if (!runPending())
+					future.wait_for(idleWait);
+			}
+			return future.get();
+		}
+
+		// runs one queued task on the calling thread, false if there was none
+		bool runPending();
+
+		// body(i) for i in [begin, end), chunks claimed dynamically by the
+		// caller and the workers; the caller always takes part, so this never
+		// waits on a busy pool. If a body throws, the indices not yet started
+		// are skipped and the first exception is rethrown once every running
+		// body has returned
+		void parallelFor(int begin, int end, const std::function<void(int)>& body);
+
+		int numWorkers() const { return static_cast<int>(workers_.size()); }
+		long long steals() const { return steals_.load(); }
+
+	private:
+		struct Worker
+		{
+			std::mutex mutex;
+			std::deque<std::function<void()>> tasks;
+			std::thread thread;
+		};
+
+		bool pop(int index, std::function<void()>& task);
+		bool steal(int index, std::function<void()>& task);
+		void execute(std::function<void()>& task);
+		void run(int index);
+
+		std::vector<std::unique_ptr<Worker>> workers_;
+		std::mutex sleepMutex_;
+		std::condition_variable wakeUp_;
+		std::atomic<int> queued_;
+		std::atomic<bool> stop_;
+		std::atomic<unsigned> nextWorker_;
+		std::atomic<long long> steals_;
+	};
+
+}
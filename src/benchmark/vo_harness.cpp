@@ -0,0 +1,306 @@
+// Headless end-to-end run of the odometry over a sequence: throughput, per
+// frame latency, peak RSS and the KITTI errors, as JSON that a later run can
+// be checked against.
+//
+//   ./vo_harness /data/kitti/sequences/00/ ../calibration/kitti00.yaml
+//       --poses /data/kitti/poses/00.txt --output run.json --baseline baseline.json
+//
+// --poses      ground truth, default poses.txt in the sequence directory as
+//              synthetic_sequence writes it; without it there are no errors
+// --frames     at most this many frames, default until an image is missing
+// --output     the JSON, default vo_harness.json
+// --trajectory the estimated camera to world poses in the KITTI format
+// --baseline   an earlier output; exits with 2 when a metric is worse than
+//              its baseline by more than its relative tolerance, or when the
+//              baseline measured a metric this run could not
+//
+// fps is over the wall-clock time of the run, image reading included;
+// processingFps over the time spent in grabImage only.
+//
+// The tolerances come from the "tolerances" map of the baseline, the
+// defaults below where it has none; every output carries the ones it was
+// checked with, so it can become the next baseline as is.
+
+#include <opencv2/opencv.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#ifdef __linux__
+#include <sys/resource.h>
+#endif
+
+#include "Logger.h"
+#include "Profiler.h"
+#include "evaluate_odometry.h"
+#include "visualOdometry.h"
+
+namespace
+{
+	struct Metric
+	{
+		const char* name;
+		bool higherIsBetter;
+		double tolerance;          // relative, default
+		double value;              // negative: not measured
+	};
+
+	// nearest rank, sorted must not be empty
+	double percentile(const std::vector<double>& sorted, double p)
+	{
+		const size_t rank = static_cast<size_t>(std::ceil(p * sorted.size()));
+		return sorted[std::min(sorted.size() - 1, rank > 0 ? rank - 1 : 0)];
+	}
+
+	// maximum resident set size of the process in megabytes, -1 when unknown
+	double peakRssMb()
+	{
+#ifdef __linux__
+		rusage usage;
+		if (getrusage(RUSAGE_SELF, &usage) == 0)
+			return usage.ru_maxrss / 1024.0;
+#endif
+		return -1.0;
+	}
+
+	Matrix toMatrix(const cv::Mat& pose)
+	{
+		Matrix m = Matrix::eye(4);
+		for (int r = 0; r < 3; r++)
+			for (int c = 0; c < 4; c++)
+				m.val[r][c] = pose.at<double>(r, c);
+		return m;
+	}
+
+	bool writeTrajectory(const std::string& path, const std::vector<Matrix>& poses)
+	{
+		std::ofstream file(path);
+		if (!file)
+			return false;
+		file << std::scientific << std::setprecision(9);
+		for (const Matrix& pose : poses)
+		{
+			for (int r = 0; r < 3; r++)
+			{
+				for (int c = 0; c < 4; c++)
+					file << pose.val[r][c] << (r == 2 && c == 3 ? "\n" : " ");
+			}
+		}
+		return static_cast<bool>(file);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 3)
+	{
+		MVSO_LOG_ERROR("Usage: ./vo_harness path_to_sequence path_to_calibration [--poses file] [--frames n]"
+			" [--output file.json] [--trajectory file] [--baseline file.json]");
+		return 1;
+	}
+	std::string sequence = argv[1];
+	if (!sequence.empty() && sequence.back() != '/')
+		sequence += "/";
+	const std::string settingPath = argv[2];
+	std::string posesPath = sequence + "poses.txt", outputPath = "vo_harness.json", trajectoryPath, baselinePath;
+	int maxFrames = 0;
+	for (int i = 3; i < argc; i += 2)
+	{
+		const std::string option = argv[i];
+		if (i + 1 == argc)
+		{
+			MVSO_LOG_ERROR("option " << option << " needs a value");
+			MVSO::Logger::flush();
+			return 1;
+		}
+		if (option == "--poses")
+			posesPath = argv[i + 1];
+		else if (option == "--frames")
+			maxFrames = std::atoi(argv[i + 1]);
+		else if (option == "--output")
+			outputPath = argv[i + 1];
+		else if (option == "--trajectory")
+			trajectoryPath = argv[i + 1];
+		else if (option == "--baseline")
+			baselinePath = argv[i + 1];
+		else
+		{
+			MVSO_LOG_ERROR("unknown option " << option);
+			MVSO::Logger::flush();
+			return 1;
+		}
+	}
+
+	// loadPoses() returns nothing for a missing file
+	std::vector<Matrix> groundTruth = loadPoses(posesPath);
+
+	MVSO::MultiViewStereoOdometry mvso(settingPath);
+	mvso.setDisplay(false);
+
+	// only grabImage is timed, reading the images is not
+	std::vector<double> latencies;
+	std::vector<Matrix> poses;
+	int skipped = 0, lost = 0, keyframes = 0;
+	double processingSeconds = 0.0;
+	const auto wallStart = std::chrono::steady_clock::now();
+	for (int frameId = 0; maxFrames <= 0 || frameId < maxFrames; frameId++)
+	{
+		cv::Mat left = cv::imread(sequence + cv::format("image_2/%06d.png", frameId), cv::IMREAD_GRAYSCALE);
+		cv::Mat right = cv::imread(sequence + cv::format("image_3/%06d.png", frameId), cv::IMREAD_GRAYSCALE);
+		if (left.empty() || right.empty())
+			break;
+
+		MVSO::FrameStats stats;
+		const auto start = std::chrono::steady_clock::now();
+		mvso.grabImage(left, right, stats);
+		const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		processingSeconds += seconds;
+		latencies.push_back(seconds * 1e3);
+		poses.push_back(toMatrix(mvso.getWorldPose()));
+		skipped += stats.skipped;
+		lost += stats.lost;
+		keyframes += stats.keyframe;
+	}
+	const double wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+	if (latencies.empty())
+	{
+		MVSO_LOG_ERROR("no stereo pair in " << sequence);
+		MVSO::Logger::flush();
+		return 1;
+	}
+	const int frames = static_cast<int>(latencies.size());
+
+	if (!trajectoryPath.empty() && !writeTrajectory(trajectoryPath, poses))
+		MVSO_LOG_ERROR("cannot write the trajectory " << trajectoryPath);
+
+	// KITTI errors over the 100 to 800 m segments, averaged as the devkit does
+	double translationError = -1.0, rotationError = -1.0;
+	int segments = 0;
+	if (groundTruth.size() >= poses.size())
+	{
+		groundTruth.resize(poses.size());
+		std::vector<errors> sequenceErrors = calcSequenceErrors(groundTruth, poses);
+		segments = static_cast<int>(sequenceErrors.size());
+		if (segments > 0)
+		{
+			translationError = rotationError = 0.0;
+			for (const errors& e : sequenceErrors)
+			{
+				translationError += e.t_err;
+				rotationError += e.r_err;
+			}
+			translationError = 100.0 * translationError / segments;
+			rotationError = 100.0 * rotationError / segments * 180.0 / CV_PI;
+		}
+		else
+			MVSO_LOG_WARN("the sequence is shorter than the shortest error segment, 100 m");
+	}
+	else
+		MVSO_LOG_WARN("no ground truth for all " << frames << " frames in " << posesPath << ", errors not computed");
+
+	std::vector<double> sorted = latencies;
+	std::sort(sorted.begin(), sorted.end());
+	double meanLatency = 0.0;
+	for (double latency : latencies)
+		meanLatency += latency;
+	meanLatency /= frames;
+
+	std::vector<Metric> metrics = {
+		{ "fps", true, 0.10, frames / wallSeconds },
+		{ "processingFps", true, 0.10, frames / processingSeconds },
+		{ "latencyP50Ms", false, 0.15, percentile(sorted, 0.50) },
+		{ "latencyP95Ms", false, 0.15, percentile(sorted, 0.95) },
+		{ "latencyP99Ms", false, 0.20, percentile(sorted, 0.99) },
+		{ "peakRssMb", false, 0.10, peakRssMb() },
+		{ "translationErrorPercent", false, 0.05, translationError },
+		{ "rotationErrorDegPer100m", false, 0.05, rotationError },
+	};
+
+	cv::FileStorage baseline;
+	if (!baselinePath.empty() && !baseline.open(baselinePath, cv::FileStorage::READ))
+	{
+		MVSO_LOG_ERROR("cannot read the baseline " << baselinePath);
+		MVSO::Logger::flush();
+		return 1;
+	}
+	if (baseline.isOpened())
+	{
+		cv::FileNode tolerances = baseline["tolerances"];
+		for (Metric& metric : metrics)
+		{
+			if (!tolerances[metric.name].empty())
+				metric.tolerance = tolerances[metric.name].real();
+		}
+	}
+
+	cv::FileStorage output(outputPath, cv::FileStorage::WRITE | cv::FileStorage::FORMAT_JSON);
+	if (!output.isOpened())
+	{
+		MVSO_LOG_ERROR("cannot write " << outputPath);
+		MVSO::Logger::flush();
+		return 1;
+	}
+	output << "sequence" << sequence;
+	output << "frames" << frames << "skipped" << skipped << "lost" << lost << "keyframes" << keyframes;
+	output << "wallSeconds" << wallSeconds << "processingSeconds" << processingSeconds;
+	output << "latencyMeanMs" << meanLatency << "latencyMaxMs" << sorted.back();
+	output << "errorSegments" << segments;
+	for (const Metric& metric : metrics)
+		output << metric.name << metric.value;
+	output << "tolerances" << "{";
+	for (const Metric& metric : metrics)
+		output << metric.name << metric.tolerance;
+	output << "}";
+
+	MVSO_LOG_INFO(frames << " frames in " << wallSeconds << " s, " << metrics[0].value << " fps (" << metrics[1].value
+		<< " processing), latency p50 " << metrics[2].value << " p95 " << metrics[3].value << " p99 " << metrics[4].value
+		<< " ms, peak RSS " << metrics[5].value << " MB");
+	if (segments > 0)
+		MVSO_LOG_INFO("translation error " << translationError << " %, rotation error " << rotationError
+			<< " deg/100 m over " << segments << " segments");
+
+	// a metric passes unless it moved the wrong way by more than its tolerance,
+	// or the baseline has it and this run does not
+	bool passed = true;
+	if (baseline.isOpened())
+	{
+		output << "comparison" << "{";
+		for (const Metric& metric : metrics)
+		{
+			cv::FileNode node = baseline[metric.name];
+			if (node.empty() || node.real() < 0)
+				continue;
+			const double reference = node.real();
+			if (metric.value < 0)
+			{
+				output << metric.name << "{" << "baseline" << reference << "value" << metric.value
+					<< "tolerance" << metric.tolerance << "pass" << 0 << "}";
+				MVSO_LOG_ERROR("regression: " << metric.name << " not measured, the baseline has " << reference);
+				passed = false;
+				continue;
+			}
+			const bool pass = metric.higherIsBetter ? metric.value >= reference * (1.0 - metric.tolerance)
+				: metric.value <= reference * (1.0 + metric.tolerance);
+			const double change = reference > 0 ? metric.value / reference - 1.0 : 0.0;
+			output << metric.name << "{" << "baseline" << reference << "value" << metric.value
+				<< "change" << change << "tolerance" << metric.tolerance << "pass" << static_cast<int>(pass) << "}";
+			if (!pass)
+			{
+				MVSO_LOG_ERROR("regression: " << metric.name << " " << metric.value << " against " << reference
+					<< " (" << std::showpos << 100.0 * change << std::noshowpos << " %, tolerance "
+					<< 100.0 * metric.tolerance << " %)");
+				passed = false;
+			}
+		}
+		output << "}";
+		output << "passed" << static_cast<int>(passed);
+		MVSO_LOG_INFO((passed ? "within the baseline " : "regressed against the baseline ") << baselinePath);
+	}
+	output.release();
+	MVSO::Logger::flush();
+	return passed ? 0 : 2;
+}
@@ -0,0 +1,577 @@
+// Google Benchmark cases for the front-end and back-end kernels, on
+// correspondences captured from one pair of consecutive KITTI stereo frames.
+//
+//   MVSO_BENCH_SEQUENCE=/data/kitti/sequences/00/ ./vo_microbench
+//
+// MVSO_BENCH_CALIBRATION (default calibration/kitti00.yaml of the source tree),
+// MVSO_BENCH_FRAME (first of the two frames, default 100) and
+// MVSO_BENCH_POSES (ground truth poses, needed by calcSequenceErrors) select
+// the rest. The feature count argument keeps the strongest FAST corners.
+// LK and circular matching run through a MultiViewStereoOdometry built from
+// the calibration, so they are the odometry's own, chunked on its scheduler.
+// The back-end cases report allocs, the heap allocations per call once the
+// buffers are warm.
+
+#include <benchmark/benchmark.h>
+
+#include <opencv2/opencv.hpp>
+#include <opencv2/core/eigen.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "feature.h"
+#include "utils.h"
+#include "evaluate_odometry.h"
+#include "Frame.h"
+#include "cameramodel.h"
+#include "PoseEstimator.h"
+#include "PoseOptimizer.h"
+#include "visualOdometry.h"
+
+namespace
+{
+	std::atomic<long long> heapAllocations(0);
+}
+
+// Every heap allocation of the process is counted. cv::Mat and Eigen take
+// their memory from malloc/posix_memalign rather than operator new, so with
+// glibc the allocator itself is interposed; elsewhere only operator new is.
+#if defined(__GLIBC__)
+extern "C"
+{
+	void* __libc_malloc(size_t size);
+	void* __libc_calloc(size_t count, size_t size);
+	void* __libc_realloc(void* pointer, size_t size);
+	void* __libc_memalign(size_t alignment, size_t size);
+
+	void* malloc(size_t size)
+	{
+		heapAllocations.fetch_add(1, std::memory_order_relaxed);
+		return __libc_malloc(size);
+	}
+
+	void* calloc(size_t count, size_t size)
+	{
+		heapAllocations.fetch_add(1, std::memory_order_relaxed);
+		return __libc_calloc(count, size);
+	}
+
+	void* realloc(void* pointer, size_t size)
+	{
+		heapAllocations.fetch_add(1, std::memory_order_relaxed);
+		return __libc_realloc(pointer, size);
+	}
+
+	void* memalign(size_t alignment, size_t size)
+	{
+		heapAllocations.fetch_add(1, std::memory_order_relaxed);
+		return __libc_memalign(alignment, size);
+	}
+
+	void* aligned_alloc(size_t alignment, size_t size)
+	{
+		return memalign(alignment, size);
+	}
+
+	int posix_memalign(void** pointer, size_t alignment, size_t size)
+	{
+		if (alignment < sizeof(void*) || (alignment & (alignment - 1)) != 0)
+			return EINVAL;
+		*pointer = memalign(alignment, size);
+		return *pointer || size == 0 ? 0 : ENOMEM;
+	}
+}
+#else
+void* operator new(std::size_t size)
+{
+	heapAllocations.fetch_add(1, std::memory_order_relaxed);
+	if (void* pointer = std::malloc(size ? size : 1))
+		return pointer;
+	throw std::bad_alloc();
+}
+
+void operator delete(void* pointer) noexcept
+{
+	std::free(pointer);
+}
+#endif
+
+namespace
+{
+
+	using namespace MVSO;
+
+	// heap allocations per iteration since start
+	void reportAllocations(benchmark::State& state, long long start)
+	{
+		state.counters["allocs"] = benchmark::Counter(static_cast<double>(heapAllocations.load() - start),
+			benchmark::Counter::kAvgIterations);
+	}
+
+	std::string environment(const char* name, const std::string& fallback)
+	{
+		const char* value = std::getenv(name);
+		return value && *value ? std::string(value) : fallback;
+	}
+
+	// the circle of circularMatching, with its windows: left t0 -> right t0 ->
+	// right t1 -> left t1 -> left t0
+	const cv::Size legWindows[4] = { cv::Size(21, 21), cv::Size(31, 21), cv::Size(21, 21), cv::Size(31, 21) };
+	const char* legNames[4] = { "left_t0->right_t0", "right_t0->right_t1", "right_t1->left_t1", "left_t1->left_t0" };
+
+	struct Fixture
+	{
+		bool valid = false;
+		std::string error;
+		MultiViewStereoOdometry* odometry = nullptr;
+		CameraModel camera;
+		std::shared_ptr<Frame> frame0, frame1;
+		cv::Mat left0, right0, left1;
+
+		// input of each leg, the points the circle starts from first
+		std::vector<cv::Point2f> legInputs[4];
+
+		// circles closed by circularMatching: left/right at t0 and t1, both triangulated
+		std::vector<cv::Point2f> left0Matched, right0Matched, left1Matched, right1Matched;
+		std::vector<cv::Point3f> points3D0, points3D1;
+
+		// what estimatePose() hands to RANSAC and the optimizer
+		std::vector<float> rightU;
+		std::vector<double> weights;
+		cv::Mat R, t;
+	};
+
+	const std::vector<cv::Mat>& pyramid(Frame& frame, bool left)
+	{
+		return left ? frame.getLeftPyramid() : frame.getRightPyramid();
+	}
+
+	// frames are read once, the fixtures of every feature count built on demand
+	Fixture& fixture(int features)
+	{
+		static std::map<int, Fixture> fixtures;
+		auto found = fixtures.find(features);
+		if (found != fixtures.end())
+			return found->second;
+		Fixture& f = fixtures[features];
+
+		const std::string sequence = environment("MVSO_BENCH_SEQUENCE", "");
+		if (sequence.empty())
+		{
+			f.error = "set MVSO_BENCH_SEQUENCE to a KITTI sequence directory";
+			return f;
+		}
+		const std::string calibration = environment("MVSO_BENCH_CALIBRATION", MVSO_SOURCE_DIR "/calibration/kitti00.yaml");
+		cv::FileStorage settings(calibration, cv::FileStorage::READ);
+		if (!settings.isOpened())
+		{
+			f.error = "cannot read MVSO_BENCH_CALIBRATION";
+			return f;
+		}
+		// lends its trackPoints and circularMatching to every fixture
+		static std::unique_ptr<MultiViewStereoOdometry> odometry;
+		if (!odometry)
+		{
+			odometry.reset(new MultiViewStereoOdometry(calibration));
+			odometry->setDisplay(false);
+		}
+		f.odometry = odometry.get();
+		f.camera = CameraModel(settings["Camera.fx"], settings["Camera.fy"], settings["Camera.cx"], settings["Camera.cy"],
+			settings["Camera.bf"]);
+
+		const int frameId = std::atoi(environment("MVSO_BENCH_FRAME", "100").c_str());
+		cv::Mat color, right1;
+		loadImageLeft(color, f.left0, frameId, sequence);
+		loadImageRight(color, f.right0, frameId, sequence);
+		loadImageLeft(color, f.left1, frameId + 1, sequence);
+		loadImageRight(color, right1, frameId + 1, sequence);
+		f.frame0 = std::make_shared<Frame>(f.left0, f.right0, 0);
+		f.frame1 = std::make_shared<Frame>(f.left1, right1, 1);
+
+		std::vector<cv::KeyPoint> keypoints;
+		cv::FAST(f.left0, keypoints, 23, true);
+		cv::KeyPointsFilter::retainBest(keypoints, features);
+		cv::KeyPoint::convert(keypoints, f.legInputs[0]);
+
+		// the inputs of the single-leg cases, then the circle with its in-tree checks
+		std::vector<uchar> status;
+		for (int leg = 0; leg < 3; leg++)
+		{
+			Frame& from = leg < 2 ? *f.frame0 : *f.frame1;
+			Frame& to = leg == 0 ? *f.frame0 : *f.frame1;
+			f.odometry->trackPoints(pyramid(from, leg == 0), pyramid(to, leg == 2), f.legInputs[leg], f.legInputs[leg + 1],
+				status, legWindows[leg]);
+		}
+		std::vector<bool> matched;
+		f.left0Matched = f.legInputs[0];
+		f.odometry->circularMatching(f.frame0.get(), f.frame1.get(), f.left0Matched, f.right0Matched, f.left1Matched,
+			f.right1Matched, matched);
+		removeInvalidElement(f.left0Matched, matched);
+		removeInvalidElement(f.right0Matched, matched);
+		removeInvalidElement(f.left1Matched, matched);
+		removeInvalidElement(f.right1Matched, matched);
+		if (f.left0Matched.size() < 10)
+		{
+			f.error = "too few closed circles on these frames";
+			return f;
+		}
+
+		cv::Mat points4D, points3D;
+		cv::triangulatePoints(f.camera.getLeftProjectionMatrix(), f.camera.getRightProjectionMatrix(), f.left0Matched, f.right0Matched, points4D);
+		cv::convertPointsFromHomogeneous(points4D.t(), points3D);
+		f.points3D0 = std::vector<cv::Point3f>(points3D);
+		cv::triangulatePoints(f.camera.getLeftProjectionMatrix(), f.camera.getRightProjectionMatrix(), f.left1Matched, f.right1Matched, points4D);
+		cv::convertPointsFromHomogeneous(points4D.t(), points3D);
+		f.points3D1 = std::vector<cv::Point3f>(points3D);
+
+		// estimatePose(current, last, lastRight, current3D): the 3D points of
+		// t1 into the left camera of t0
+		for (size_t i = 0; i < f.left0Matched.size(); i++)
+		{
+			f.rightU.push_back(f.right0Matched[i].x);
+			f.weights.push_back(1.0);
+		}
+		PoseEstimator estimator(f.camera);
+		f.R = cv::Mat::eye(3, 3, CV_64F);
+		f.t = cv::Mat::zeros(3, 1, CV_64F);
+		solvePnPRansac(f.points3D1, f.left0Matched, f.camera, estimator.pnpRansacParams_, estimator.pnpRansacCost_, nullptr, 0.f,
+			estimator.pnpResult_, estimator.pnpScratch_);
+		cv::eigen2cv(estimator.pnpResult_.model.R, f.R);
+		cv::eigen2cv(estimator.pnpResult_.model.t, f.t);
+
+		f.valid = true;
+		return f;
+	}
+
+	// a fixture, or the benchmark skipped with the reason
+	Fixture* prepare(benchmark::State& state, int features)
+	{
+		Fixture& f = fixture(features);
+		if (!f.valid)
+		{
+			state.SkipWithError(f.error.c_str());
+			return nullptr;
+		}
+		state.counters["matches"] = static_cast<double>(f.left0Matched.size());
+		return &f;
+	}
+
+	void featureCounts(benchmark::internal::Benchmark* b)
+	{
+		for (int features : { 250, 500, 1000, 2000 })
+			b->Arg(features);
+		b->Unit(benchmark::kMicrosecond);
+	}
+
+	// ---------------------------------------------------------------
+	// front end
+	// ---------------------------------------------------------------
+
+	// Frame::featureDetection, which detects once per frame, so on a new one
+	// every iteration
+	void BM_FeatureDetection(benchmark::State& state)
+	{
+		Fixture* f = prepare(state, 1000);
+		if (!f)
+			return;
+		std::unique_ptr<Frame> frame;
+		std::vector<cv::Point2f> points;
+		for (auto _ : state)
+		{
+			state.PauseTiming();
+			frame.reset(new Frame(f->left0, f->right0, 0));
+			state.ResumeTiming();
+			frame->featureDetection(points);
+			benchmark::DoNotOptimize(points.data());
+		}
+		state.counters["corners"] = static_cast<double>(points.size());
+	}
+	BENCHMARK(BM_FeatureDetection)->Unit(benchmark::kMicrosecond);
+
+	// feature.cpp, the Bucket based one
+	void BM_BucketingFeatures(benchmark::State& state)
+	{
+		Fixture* f = prepare(state, static_cast<int>(state.range(0)));
+		if (!f)
+			return;
+		FeatureSet features;
+		for (auto _ : state)
+		{
+			state.PauseTiming();
+			features.points = f->legInputs[0];
+			features.ages.assign(features.points.size(), 0);
+			state.ResumeTiming();
+			bucketingFeatures(f->left0, features, 10, 2);
+			benchmark::DoNotOptimize(features.points.data());
+		}
+	}
+	BENCHMARK(BM_BucketingFeatures)->Apply(featureCounts);
+
+	// Frame::bucketingFeature, the one the odometry runs
+	void BM_FrameBucketing(benchmark::State& state)
+	{
+		Fixture* f = prepare(state, static_cast<int>(state.range(0)));
+		if (!f)
+			return;
+		for (auto _ : state)
+		{
+			state.PauseTiming();
+			f->frame0->setFeature(f->legInputs[0]);
+			state.ResumeTiming();
+			f->frame0->bucketingFeature(2);
+		}
+	}
+	BENCHMARK(BM_FrameBucketing)->Apply(featureCounts);
+
+	// one leg of circularMatching through MultiViewStereoOdometry::trackPoints,
+	// on pyramids built beforehand
+	void BM_CircularMatchingLeg(benchmark::State& state)
+	{
+		Fixture* f = prepare(state, static_cast<int>(state.range(1)));
+		if (!f)
+			return;
+		const int leg = static_cast<int>(state.range(0));
+		Frame& from = leg < 2 ? *f->frame0 : *f->frame1;
+		Frame& to = leg == 0 || leg == 3 ? *f->frame0 : *f->frame1;
+		const bool fromLeft = leg == 0 || leg == 3, toLeft = leg >= 2;
+		std::vector<cv::Point2f> tracked;
+		std::vector<uchar> status;
+		for (auto _ : state)
+		{
+			f->odometry->trackPoints(pyramid(from, fromLeft), pyramid(to, toLeft), f->legInputs[leg], tracked, status,
+				legWindows[leg]);
+			benchmark::DoNotOptimize(tracked.data());
+		}
+		state.SetLabel(legNames[leg]);
+	}
+	BENCHMARK(BM_CircularMatchingLeg)->ArgsProduct({ { 0, 1, 2, 3 }, { 250, 500, 1000, 2000 } })->Unit(benchmark::kMicrosecond);
+
+	// MultiViewStereoOdometry::circularMatching, the four legs and the circle check
+	void BM_CircularMatching(benchmark::State& state)
+	{
+		Fixture* f = prepare(state, static_cast<int>(state.range(0)));
+		if (!f)
+			return;
+		std::vector<cv::Point2f> left0, right0, left1, right1;
+		std::vector<bool> matched;
+		for (auto _ : state)
+		{
+			state.PauseTiming();
+			left0 = f->legInputs[0];
+			matched.clear();
+			state.ResumeTiming();
+			f->odometry->circularMatching(f->frame0.get(), f->frame1.get(), left0, right0, left1, right1, matched);
+			benchmark::DoNotOptimize(left1.data());
+		}
+		state.counters["closed"] = static_cast<double>(std::count(matched.begin(), matched.end(), true));
+	}
+	BENCHMARK(BM_CircularMatching)->Apply(featureCounts);
+
+	void BM_Triangulation(benchmark::State& state)
+	{
+		Fixture* f = prepare(state, static_cast<int>(state.range(0)));
+		if (!f)
+			return;
+		const cv::Mat projLeft = f->camera.getLeftProjectionMatrix(), projRight = f->camera.getRightProjectionMatrix();
+		cv::Mat points4D, points3D;
+		for (auto _ : state)
+		{
+			cv::triangulatePoints(projLeft, projRight, f->left1Matched, f->right1Matched, points4D);
+			cv::convertPointsFromHomogeneous(points4D.t(), points3D);
+			benchmark::DoNotOptimize(points3D.data);
+		}
+	}
+	BENCHMARK(BM_Triangulation)->Apply(featureCounts);
+
+	// ---------------------------------------------------------------
+	// back end
+	// ---------------------------------------------------------------
+
+	// cv::solvePnPRansac with the in-tree thresholds, the reference point
+	void BM_OpenCVSolvePnPRansac(benchmark::State& state)
+	{
+		Fixture* f = prepare(state, static_cast<int>(state.range(0)));
+		if (!f)
+			return;
+		PoseEstimator estimator(f->camera);
+		const RansacParams& params = estimator.pnpRansacParams_;
+		cv::Mat rvec, tvec, inliers;
+		for (auto _ : state)
+		{
+			rvec = cv::Mat::zeros(3, 1, CV_64F);
+			tvec = cv::Mat::zeros(3, 1, CV_64F);
+			cv::solvePnPRansac(f->points3D1, f->left0Matched, f->camera.intrinsicMat_, cv::noArray(), rvec, tvec, false,
+				params.maxIterations, params.threshold, params.confidence, inliers, cv::SOLVEPNP_ITERATIVE);
+			benchmark::DoNotOptimize(inliers.data);
+		}
+		state.counters["inliers"] = inliers.rows;
+	}
+	BENCHMARK(BM_OpenCVSolvePnPRansac)->Apply(featureCounts);
+
+	void BM_SolvePnPRansac(benchmark::State& state)
+	{
+		Fixture* f = prepare(state, static_cast<int>(state.range(0)));
+		if (!f)
+			return;
+		PoseEstimator estimator(f->camera);
+		estimator.reserveWorkspace(f->points3D1.size());
+		const long long allocations = heapAllocations.load();
+		for (auto _ : state)
+		{
+			estimator.pnpResult_.reset();
+			solvePnPRansac(f->points3D1, f->left0Matched, f->camera, estimator.pnpRansacParams_, estimator.pnpRansacCost_,
+				nullptr, 0.f, estimator.pnpResult_, estimator.pnpScratch_);
+			benchmark::DoNotOptimize(estimator.pnpResult_.inliers.data());
+		}
+		reportAllocations(state, allocations);
+		state.counters["inliers"] = static_cast<double>(estimator.pnpResult_.inliers.size());
+		state.counters["iterations"] = estimator.pnpResult_.iterations;
+	}
+	BENCHMARK(BM_SolvePnPRansac)->Apply(featureCounts);
+
+	void BM_SolveICPRansac(benchmark::State& state)
+	{
+		Fixture* f = prepare(state, static_cast<int>(state.range(0)));
+		if (!f)
+			return;
+		PoseEstimator estimator(f->camera);
+		PointPairsSoA soa;
+		soa.assign(f->points3D0, f->points3D1);
+		estimator.reserveWorkspace(f->points3D1.size());
+		const long long allocations = heapAllocations.load();
+		for (auto _ : state)
+		{
+			estimator.icpResult_.reset();
+			solveICPRansac(soa, f->points3D0, f->points3D1, estimator.icpRansacParams_, estimator.icpRansacCost_,
+				nullptr, 0.f, estimator.icpResult_, estimator.icpScratch_);
+			benchmark::DoNotOptimize(estimator.icpResult_.inliers.data());
+		}
+		reportAllocations(state, allocations);
+		state.counters["inliers"] = static_cast<double>(estimator.icpResult_.inliers.size());
+		state.counters["iterations"] = estimator.icpResult_.iterations;
+	}
+	BENCHMARK(BM_SolveICPRansac)->Apply(featureCounts);
+
+	// the whole estimatePose() of tracking, RANSAC and refinement, on a warm
+	// estimator
+	enum EstimatorCase { PNP, ICP };
+
+	void BM_EstimatePose(benchmark::State& state)
+	{
+		Fixture* f = prepare(state, static_cast<int>(state.range(1)));
+		if (!f)
+			return;
+		const EstimatorCase which = static_cast<EstimatorCase>(state.range(0));
+		PoseEstimator estimator(f->camera);
+		cv::Mat pose;
+		auto estimate = [&] {
+			if (which == PNP)
+				pose = estimator.estimatePose(f->left1Matched, f->left0Matched, f->right0Matched, f->points3D1);
+			else
+				pose = estimator.estimatePose(f->left1Matched, f->left0Matched, f->points3D0, f->points3D1);
+		};
+		estimate();
+		const long long allocations = heapAllocations.load();
+		for (auto _ : state)
+		{
+			estimate();
+			benchmark::DoNotOptimize(pose.data);
+		}
+		reportAllocations(state, allocations);
+		static const char* labels[] = { "PnP", "ICP" };
+		state.SetLabel(labels[which]);
+		state.counters["inliers"] = estimator.stats_.inliers;
+	}
+	BENCHMARK(BM_EstimatePose)->ArgsProduct({ { PNP, ICP }, { 250, 500, 1000, 2000 } })
+		->Unit(benchmark::kMicrosecond);
+
+	// the four optimizePose overloads, each from the RANSAC pose
+	enum OptimizerCase { LEFT, WEIGHTED, STEREO, POINTS_3D };
+
+	void BM_OptimizePose(benchmark::State& state)
+	{
+		Fixture* f = prepare(state, static_cast<int>(state.range(1)));
+		if (!f)
+			return;
+		const OptimizerCase which = static_cast<OptimizerCase>(state.range(0));
+		PoseOptimizer optimizer(f->camera);
+		PoseOptimizer::Result result;
+		cv::Mat R, t;
+		auto optimize = [&] {
+			f->R.copyTo(R);
+			f->t.copyTo(t);
+			switch (which)
+			{
+			case LEFT:
+				return optimizer.optimizePose(f->points3D1, f->left0Matched, R, t);
+			case WEIGHTED:
+				return optimizer.optimizePose(f->points3D1, f->left0Matched, f->weights, R, t);
+			case STEREO:
+				return optimizer.optimizePose(f->points3D1, f->left0Matched, f->rightU, f->weights, R, t);
+			default:
+				return optimizer.optimizePose(f->points3D0, f->points3D1, R, t);
+			}
+		};
+		optimize();
+		const long long allocations = heapAllocations.load();
+		for (auto _ : state)
+		{
+			result = optimize();
+			benchmark::DoNotOptimize(result);
+		}
+		reportAllocations(state, allocations);
+		static const char* labels[] = { "left", "weighted", "stereo", "3D-3D" };
+		state.SetLabel(labels[which]);
+		state.counters["iterations"] = result.iterations;
+	}
+	BENCHMARK(BM_OptimizePose)->ArgsProduct({ { LEFT, WEIGHTED, STEREO, POINTS_3D }, { 250, 500, 1000, 2000 } })
+		->Unit(benchmark::kMicrosecond);
+
+	// ---------------------------------------------------------------
+	// evaluation
+	// ---------------------------------------------------------------
+
+	// the ground truth against itself with a small drift per frame, on the
+	// first range(0) poses
+	void BM_CalcSequenceErrors(benchmark::State& state)
+	{
+		const std::string path = environment("MVSO_BENCH_POSES", "");
+		if (path.empty())
+		{
+			state.SkipWithError("set MVSO_BENCH_POSES to a KITTI ground truth file");
+			return;
+		}
+		std::vector<Matrix> groundTruth = loadPoses(path);
+		if (groundTruth.size() > static_cast<size_t>(state.range(0)))
+			groundTruth.resize(state.range(0));
+		std::vector<Matrix> result;
+		Matrix drift = Matrix::eye(4);
+		drift.val[0][3] = 0.001;
+		Matrix pose = groundTruth.empty() ? Matrix::eye(4) : groundTruth[0];
+		for (size_t i = 0; i < groundTruth.size(); i++)
+		{
+			if (i > 0)
+				pose = pose * Matrix::inv(groundTruth[i - 1]) * groundTruth[i] * drift;
+			result.push_back(pose);
+		}
+		for (auto _ : state)
+		{
+			std::vector<errors> err = calcSequenceErrors(groundTruth, result);
+			benchmark::DoNotOptimize(err.data());
+		}
+		state.counters["poses"] = static_cast<double>(groundTruth.size());
+	}
+	BENCHMARK(BM_CalcSequenceErrors)->Arg(1000)->Arg(5000)->Unit(benchmark::kMillisecond);
+
+}
+
+BENCHMARK_MAIN();
@@ -1,6 +1,8 @@
 #include "feature.h"
 #include "bucket.h"
 #include "utils.h"
+#include "Profiler.h"
+#include "Logger.h"
 
 void deleteUnmatchFeatures(std::vector<cv::Point2f>& points0, std::vector<cv::Point2f>& points1, std::vector<uchar>& status)
 {
@@ -120,13 +122,13 @@ void circularMatching(cv::Mat img_l_0, cv::Mat img_r_0, cv::Mat img_l_1, cv::Mat
   std::vector<uchar> status2;
   std::vector<uchar> status3;
 
-  TicTok tic;
-  calcOpticalFlowPyrLK(img_l_0, img_r_0, points_l_0, points_r_0, status0, err, winSize, 3, termcrit, 0, 0.001);
-  calcOpticalFlowPyrLK(img_r_0, img_r_1, points_r_0, points_r_1, status1, err, winSizeStereo, 3, termcrit, 0, 0.001);
-  calcOpticalFlowPyrLK(img_r_1, img_l_1, points_r_1, points_l_1, status2, err, winSize, 3, termcrit, 0, 0.001);
-  calcOpticalFlowPyrLK(img_l_1, img_l_0, points_l_1, points_l_0_return, status3, err, winSizeStereo, 3, termcrit, 0, 0.001);
-  
-  std::cerr << "calcOpticalFlowPyrLK time: " << tic.tok() << "ms" << std::endl;
+  {
+    MVSO_SCOPED_TIMER(MVSO::Stage::MATCHING);
+    calcOpticalFlowPyrLK(img_l_0, img_r_0, points_l_0, points_r_0, status0, err, winSize, 3, termcrit, 0, 0.001);
+    calcOpticalFlowPyrLK(img_r_0, img_r_1, points_r_0, points_r_1, status1, err, winSizeStereo, 3, termcrit, 0, 0.001);
+    calcOpticalFlowPyrLK(img_r_1, img_l_1, points_r_1, points_l_1, status2, err, winSize, 3, termcrit, 0, 0.001);
+    calcOpticalFlowPyrLK(img_l_1, img_l_0, points_l_1, points_l_0_return, status3, err, winSizeStereo, 3, termcrit, 0, 0.001);
+  }
 
 
   deleteUnmatchFeaturesCircle(points_l_0, points_r_0, points_r_1, points_l_1, points_l_0_return,
@@ -180,7 +182,7 @@ void bucketingFeatures(cv::Mat& image, FeatureSet& current_features, int bucket_
       }
     }
 
-    std::cout << "current features number after bucketing: " << current_features.size() << std::endl;
+    MVSO_LOG_DEBUG("current features number after bucketing: " << current_features.size());
 
 }
 
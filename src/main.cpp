@@ -38,24 +38,24 @@ int main(int argc, char **argv)
     std::vector<Matrix> pose_matrix_gt;
     if(argc == 4)
     {   display_ground_truth = true;
-        cerr << "Display ground truth trajectory" << endl;
+        MVSO_LOG_INFO("Display ground truth trajectory");
         // load ground truth pose
         string filename_pose = string(argv[3]);
         pose_matrix_gt = loadPoses(filename_pose);
     }
     if(argc < 3)
     {
-        cerr << "Usage: ./run path_to_sequence path_to_calibration [optional]path_to_ground_truth_pose" << endl;
+        MVSO_LOG_ERROR("Usage: ./run path_to_sequence path_to_calibration [optional]path_to_ground_truth_pose");
         return 1;
     }
 
     // 数据集路径，目前只测试了kitti00
     string filepath = string(argv[1]);
-    cout << "Filepath: " << filepath << endl;
+    MVSO_LOG_INFO("Filepath: " << filepath);
 
     // 相机参数
     string strSettingPath = string(argv[2]);
-    cout << "Calibration Filepath: " << strSettingPath << endl;
+    MVSO_LOG_INFO("Calibration Filepath: " << strSettingPath);
 
 	std::vector<cv::Mat> pose_results;
 
@@ -77,7 +77,7 @@ int main(int argc, char **argv)
     cv::Mat frame_pose = cv::Mat::eye(4, 4, CV_64F);
     cv::Mat frame_pose32 = cv::Mat::eye(4, 4, CV_32F);
 
-    std::cout << "frame_pose " << frame_pose << std::endl;
+    MVSO_LOG_INFO("frame_pose " << frame_pose);
     cv::Mat trajectory = cv::Mat::zeros(600, 1200, CV_8UC3);
     FeatureSet currentVOFeatures;
     cv::Mat points4D, points3D;
@@ -104,7 +104,7 @@ int main(int argc, char **argv)
 
     for (int frame_id = init_frame_id+1; frame_id <= 4540; frame_id++)
     {
-        std::cout << std::endl << "frame_id " << frame_id << std::endl;
+        MVSO_LOG_INFO("frame_id " << frame_id);
         // ------------
         // 读图
         // ------------
@@ -127,18 +127,25 @@ int main(int argc, char **argv)
 		translation_stereo = translation_mvso.clone();
 
 
-        cv::Vec3f rotation_euler = rotationMatrixToEulerAngles(rotation);
-        // std::cout << "rotation: " << rotation_euler << std::endl;
+        // std::cout << "rotation: " << rotationMatrixToEulerAngles(rotation) << std::endl;
         // std::cout << "translation: " << translation_stereo.t() << std::endl;
 
+		if (mvso.getState() == MVSO::MultiViewStereoOdometry::State::LOST)
+			MVSO_LOG_WARN("Tracking lost, pose dead reckoned");
+
         cv::Mat rigid_body_transformation;
 		//integrateOdometryStereo(frame_id, rigid_body_transformation, frame_pose, rotation, translation_stereo);
         
-		if(abs(rotation_euler[1])<0.2 && abs(rotation_euler[0])<0.2 && abs(rotation_euler[2])<0.2)
+		// a motion over Tracking.maxRotation is rejected, and dead reckoned, in
+		// the odometry, so that the world poses it keeps see the same gate
+		if (mvso.localBAEnabled())
+		{
+			// world poses are kept, and refined by the local BA, in the odometry
+			frame_pose = mvso.getWorldPose();
+		}
+		else
         {
 			integrateOdometryStereo(frame_id, rigid_body_transformation, frame_pose, rotation, translation_stereo);
-        } else {
-            std::cout << "Too large rotation"  << std::endl;
         }
 
         // std::cout << "rigid_body_transformation" << rigid_body_transformation << std::endl;
@@ -156,7 +163,7 @@ int main(int argc, char **argv)
         fps = float(frame_id-init_frame_id)/(toc-tic)*CLOCKS_PER_SEC;
 
         // std::cout << "Pose" << pose.t() << std::endl;
-        std::cout << "FPS: " << fps << std::endl;
+        MVSO_LOG_INFO("FPS: " << fps);
 
         display(frame_id, trajectory, pose, pose_matrix_gt, fps, display_ground_truth);
 
@@ -168,7 +175,7 @@ int main(int argc, char **argv)
 		if (c == ':')
 			c = '~';
 	string filename = cv::format("trajectory%s.png", time.c_str());
-	cout << "filename: " << filename << endl;
+	MVSO_LOG_INFO("filename: " << filename);
 	cv::imwrite(filename, trajectory);
     return 0;
 }
@@ -0,0 +1,82 @@
+
+#include <opencv2/core.hpp>
+
+#include <cmath>
+
+#include <string>
+
+#include "Logger.h"
+#include "cameramodel.h"
+#include "SyntheticSequence.h"
+
+// Renders a synthetic stereo sequence for a calibration file: the camera
+// comes from its Camera.* entries, the scene and the motion from the optional
+// Synthetic.* ones. The output directory reads like a KITTI sequence, with the
+// ground truth next to the images, out/poses.txt:
+//   ./synthetic_sequence out/ ../calibration/kitti00.yaml
+int main(int argc, char **argv)
+{
+	if (argc < 3)
+	{
+		MVSO_LOG_ERROR("Usage: ./synthetic_sequence output_directory path_to_calibration");
+		return 1;
+	}
+	const std::string directory = argv[1];
+
+	cv::FileStorage fSettings(argv[2], cv::FileStorage::READ);
+	if (!fSettings.isOpened())
+	{
+		MVSO_LOG_ERROR("cannot open the calibration " << argv[2]);
+		return 1;
+	}
+	MVSO::CameraModel camera(fSettings["Camera.fx"], fSettings["Camera.fy"], fSettings["Camera.cx"],
+		fSettings["Camera.cy"], fSettings["Camera.bf"]);
+
+	// a non-positive value keeps the default, except for the disturbances
+	MVSO::SyntheticSequence::Options options;
+	int width = fSettings["Synthetic.width"];
+	int height = fSettings["Synthetic.height"];
+	int frames = fSettings["Synthetic.frames"];
+	float speed = fSettings["Synthetic.speed"];
+	float yawAmplitude = fSettings["Synthetic.yawAmplitude"];
+	float turnPeriod = fSettings["Synthetic.turnPeriod"];
+	float textureDensity = fSettings["Synthetic.textureDensity"];
+	int seed = fSettings["Synthetic.seed"];
+	// the image size defaults to the camera's, else to twice the principal point
+	if (width <= 0)
+		width = fSettings["Camera.width"];
+	if (height <= 0)
+		height = fSettings["Camera.height"];
+	options.width = width > 0 ? width : static_cast<int>(std::lround(2.0 * camera.cx_));
+	options.height = height > 0 ? height : static_cast<int>(std::lround(2.0 * camera.cy_));
+	if (camera.cx_ < 0 || camera.cx_ >= options.width || camera.cy_ < 0 || camera.cy_ >= options.height)
+	{
+		MVSO_LOG_ERROR("the principal point (" << camera.cx_ << ", " << camera.cy_ << ") lies outside the "
+			<< options.width << "x" << options.height << " image");
+		MVSO::Logger::flush();
+		return 1;
+	}
+	if (frames > 0)
+		options.frames = frames;
+	if (speed > 0)
+		options.speed = speed;
+	if (yawAmplitude > 0)
+		options.yawAmplitude = yawAmplitude;
+	if (turnPeriod > 0)
+		options.turnPeriod = turnPeriod;
+	if (textureDensity > 0)
+		options.textureDensity = textureDensity;
+	if (seed > 0)
+		options.seed = static_cast<uint64_t>(seed);
+	options.outliers = fSettings["Synthetic.outliers"];
+	options.noiseSigma = static_cast<float>(fSettings["Synthetic.noiseSigma"]);
+
+	MVSO_LOG_INFO("Rendering " << options.frames << " frames of " << options.width << "x" << options.height
+		<< " to " << directory);
+	MVSO::SyntheticSequence sequence(camera, options);
+	const bool written = sequence.writeSequence(directory);
+	if (!written)
+		MVSO_LOG_ERROR("cannot write the sequence to " << directory);
+	MVSO::Logger::flush();
+	return written ? 0 : 1;
+}
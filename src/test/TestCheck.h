@@ -0,0 +1,101 @@
+#pragma once
+
+// What the solver tests share: checks that report where they failed and let
+// the test go on, and central finite differences over the left perturbation
+// T <- exp([rho, phi]) * T the solvers linearize for. A test returns
+// testResult() from main, so ctest sees any failed check.
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+
+#include "Lie.h"
+
+namespace MVSO
+{
+	namespace test
+	{
+
+		inline int& failures()
+		{
+			static int count = 0;
+			return count;
+		}
+
+		inline void check(bool ok, const char* what, const char* file, int line)
+		{
+			if (ok)
+				return;
+			failures()++;
+			std::cerr << file << ":" << line << ": check failed: " << what << std::endl;
+		}
+
+		// |a - b| <= tolerance * max(1, |b|), for scalars and matrices alike
+		template<class A, class B>
+		bool near(const A& a, const B& b, double tolerance, double& error)
+		{
+			error = (a - b).norm() / std::max(1.0, static_cast<double>(b.norm()));
+			return error <= tolerance;
+		}
+
+		inline bool near(double a, double b, double tolerance, double& error)
+		{
+			error = std::abs(a - b) / std::max(1.0, std::abs(b));
+			return error <= tolerance;
+		}
+
+		inline int testResult()
+		{
+			if (failures() == 0)
+				std::cout << "all checks passed" << std::endl;
+			return failures() == 0 ? 0 : 1;
+		}
+
+		// d f(exp(delta) * T) / d delta at delta = 0; f maps (R, t) to a residual
+		template<class F>
+		Eigen::MatrixXd numericalJacobian(const F& f, const Eigen::Matrix3d& R, const Eigen::Vector3d& t, double h = 1e-6)
+		{
+			const Eigen::VectorXd r0 = f(R, t);
+			Eigen::MatrixXd J(r0.size(), 6);
+			for (int k = 0; k < 6; k++)
+			{
+				Eigen::Matrix<double, 6, 1> delta = Eigen::Matrix<double, 6, 1>::Zero();
+				delta(k) = h;
+				Eigen::Matrix3d Rp = R, Rm = R;
+				Eigen::Vector3d tp = t, tm = t;
+				applyLeftIncrement(delta, Rp, tp);
+				applyLeftIncrement(-delta, Rm, tm);
+				J.col(k) = (f(Rp, tp) - f(Rm, tm)) / (2.0 * h);
+			}
+			return J;
+		}
+
+		// rotation angle and translation distance between two poses
+		inline double rotationError(const Eigen::Matrix3d& a, const Eigen::Matrix3d& b)
+		{
+			return Eigen::AngleAxisd(a.transpose() * b).angle();
+		}
+
+		inline Eigen::Matrix3d rotation(double rx, double ry, double rz)
+		{
+			return (Eigen::AngleAxisd(rz, Eigen::Vector3d::UnitZ()) * Eigen::AngleAxisd(ry, Eigen::Vector3d::UnitY())
+				* Eigen::AngleAxisd(rx, Eigen::Vector3d::UnitX())).toRotationMatrix();
+		}
+
+	}
+}
+
+#define MVSO_CHECK(condition) ::MVSO::test::check((condition), #condition, __FILE__, __LINE__)
+
+// relative error against the expected value, printed when over the tolerance
+#define MVSO_CHECK_NEAR(actual, expected, tolerance) \
+	do { \
+		double mvsoError_ = 0.0; \
+		const bool mvsoOk_ = ::MVSO::test::near((actual), (expected), (tolerance), mvsoError_); \
+		::MVSO::test::check(mvsoOk_, #actual " ~ " #expected, __FILE__, __LINE__); \
+		if (!mvsoOk_) \
+			std::cerr << "    relative error " << mvsoError_ << " > " << (tolerance) << std::endl; \
+	} while (0)
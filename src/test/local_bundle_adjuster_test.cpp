@@ -0,0 +1,142 @@
+// LocalBundleAdjuster: the analytic camera and point Jacobians against
+// central differences, then a window of SyntheticSequence keyframes with
+// perturbed poses and noisy stereo tracks adjusted back to the ground truth.
+
+#include "LocalBundleAdjuster.h"
+#include "SyntheticSequence.h"
+#include "TestCheck.h"
+
+#include <random>
+#include <vector>
+
+using namespace MVSO;
+using namespace MVSO::test;
+
+namespace
+{
+
+	const CameraModel camera(718.856f, 718.856f, 607.1928f, 185.2157f, -386.1448f);
+
+	void testJacobians(LocalBundleAdjuster& adjuster, bool stereo)
+	{
+		const Eigen::Matrix3d Rcw = rotation(0.05, -0.2, 0.1);
+		const Eigen::Vector3d tcw(0.4, -0.2, 2.0);
+		const Eigen::Vector3d P(1.5, -0.7, 10.0);
+
+		auto observe = [&](const Eigen::Matrix3d& R, const Eigen::Vector3d& t, const Eigen::Vector3d& X) {
+			const Eigen::Vector3d z = adjuster.project(R * X + t);
+			return stereo ? Eigen::VectorXd(z) : Eigen::VectorXd(z.head<2>());
+		};
+		auto ofPose = [&](const Eigen::Matrix3d& R, const Eigen::Vector3d& t) { return observe(R, t, P); };
+		const Eigen::MatrixXd JcNumerical = numericalJacobian(ofPose, Rcw, tcw);
+
+		Eigen::MatrixXd JpNumerical(stereo ? 3 : 2, 3);
+		const double h = 1e-6;
+		for (int k = 0; k < 3; k++)
+		{
+			const Eigen::Vector3d dP = h * Eigen::Vector3d::Unit(k);
+			JpNumerical.col(k) = (observe(Rcw, tcw, P + dP) - observe(Rcw, tcw, P - dP)) / (2.0 * h);
+		}
+
+		Eigen::Matrix<double, 3, 6> Jc;
+		Eigen::Matrix3d Jp;
+		adjuster.jacobians(Rcw, Rcw * P + tcw, stereo, Jc, Jp);
+		const int rows = stereo ? 3 : 2;
+		MVSO_CHECK_NEAR(Eigen::MatrixXd(Jc.topRows(rows)), JcNumerical, 1e-6);
+		MVSO_CHECK_NEAR(Eigen::MatrixXd(Jp.topRows(rows)), JpNumerical, 1e-6);
+		if (!stereo)
+			MVSO_CHECK(Jc.row(2).isZero() && Jp.row(2).isZero());
+	}
+
+	// five keyframes two frames apart along the synthetic street, 300 points
+	// between the walls, 0.3 px of noise, every fourth track left only; all
+	// poses but the first (the gauge) start off by ~0.01 rad and ~0.1 m
+	void testWindow(LocalBundleAdjuster& adjuster)
+	{
+		SyntheticSequence::Options sequenceOptions;
+		sequenceOptions.frames = 10;
+		sequenceOptions.yawAmplitude = 0.1;
+		sequenceOptions.turnPeriod = 16.0;
+		const SyntheticSequence sequence(camera, sequenceOptions);
+
+		std::mt19937 rng(5);
+		std::uniform_real_distribution<double> lateral(-6.0, 6.0), height(-3.0, 1.6), depth(5.0, 35.0);
+		std::normal_distribution<double> noise(0.0, 0.3), angle(0.0, 0.006), offset(0.0, 0.06);
+		std::vector<Eigen::Vector3d> points;
+		for (int i = 0; i < 300; i++)
+			points.push_back(Eigen::Vector3d(lateral(rng), height(rng), depth(rng)));
+
+		std::vector<LocalBundleAdjuster::WindowFrame> window;
+		std::vector<Eigen::Matrix3d> trueRwc;
+		std::vector<Eigen::Vector3d> trueTwc;
+		for (int frame = 0; frame < 10; frame += 2)
+		{
+			LocalBundleAdjuster::WindowFrame keyframe;
+			keyframe.frameId = frame;
+			Eigen::Matrix3d Rwc;
+			Eigen::Vector3d twc;
+			sequence.getPose(frame, Rwc, twc);
+			trueRwc.push_back(Rwc);
+			trueTwc.push_back(twc);
+			for (size_t i = 0; i < points.size(); i++)
+			{
+				const Eigen::Vector3d X = Rwc.transpose() * (points[i] - twc);
+				if (X.z() < 1.0)
+					continue;
+				const Eigen::Vector3d z = adjuster.project(X);
+				if (z(0) < 0 || z(0) >= sequenceOptions.width || z(1) < 0 || z(1) >= sequenceOptions.height)
+					continue;
+				StereoObservation observation;
+				observation.trackId = static_cast<long>(i);
+				observation.uL = static_cast<float>(z(0) + noise(rng));
+				observation.v = static_cast<float>(z(1) + noise(rng));
+				observation.uR = i % 4 == 3 ? -1.f : static_cast<float>(z(2) + noise(rng));
+				keyframe.observations.push_back(observation);
+			}
+			if (frame == 0)
+			{
+				keyframe.Rwc = Rwc;
+				keyframe.twc = twc;
+			}
+			else
+			{
+				keyframe.Rwc = rotation(angle(rng), angle(rng), angle(rng)) * Rwc;
+				keyframe.twc = twc + Eigen::Vector3d(offset(rng), offset(rng), offset(rng));
+			}
+			window.push_back(keyframe);
+		}
+
+		LocalBundleAdjuster::Result result;
+		adjuster.optimize(window, result);
+		MVSO_CHECK(result.Rwc.size() == window.size());
+		MVSO_CHECK(result.landmarks > 100);
+		MVSO_CHECK(result.finalCost < result.initialCost);
+		for (size_t k = 0; k < window.size() && k < result.Rwc.size(); k++)
+		{
+			const double before = rotationError(window[k].Rwc, trueRwc[k]), after = rotationError(result.Rwc[k], trueRwc[k]);
+			const double offBefore = (window[k].twc - trueTwc[k]).norm(), offAfter = (result.twc[k] - trueTwc[k]).norm();
+			std::cout << "keyframe " << window[k].frameId << ": rotation error " << before << " -> " << after
+				<< " rad, translation error " << offBefore << " -> " << offAfter << " m" << std::endl;
+			MVSO_CHECK(after < 2e-3);
+			MVSO_CHECK(offAfter < 0.03);
+		}
+		// the gauge stays where it was
+		MVSO_CHECK(rotationError(result.Rwc[0], window[0].Rwc) < 1e-9 && (result.twc[0] - window[0].twc).norm() < 1e-9);
+	}
+
+}
+
+int main()
+{
+	TaskScheduler::Options schedulerOptions;
+	schedulerOptions.workers = 1;
+	TaskScheduler scheduler(schedulerOptions);
+	LocalBundleAdjuster::Options options;
+	options.maxIterations = 20;
+	LocalBundleAdjuster adjuster(camera, options, scheduler);
+
+	testJacobians(adjuster, true);
+	testJacobians(adjuster, false);
+	testWindow(adjuster);
+	return testResult();
+}
@@ -0,0 +1,119 @@
+// MultiRigPoseSolver: the analytic Jacobian of a stereo and a left-only
+// observation through a rig's extrinsics against central differences, then a
+// known body motion recovered from two noisy rigs, front and rear.
+
+#include "MultiRigPoseSolver.h"
+#include "TestCheck.h"
+
+#include <random>
+#include <vector>
+
+using namespace MVSO;
+using namespace MVSO::test;
+
+namespace
+{
+
+	const CameraModel camera(718.856f, 718.856f, 607.1928f, 185.2157f, -386.1448f);
+
+	// a second pair looking backwards, 0.3 m to the left and 1.5 m behind
+	RigidModel rearRig()
+	{
+		RigidModel bodyFromCamera;
+		bodyFromCamera.R = rotation(0.0, M_PI, 0.0);
+		bodyFromCamera.t = Eigen::Vector3d(-0.3, 0.0, -1.5);
+		return bodyFromCamera;
+	}
+
+	// (uL, v, uR) in the last image pair of a rig of a point of its current
+	// camera, under the body motion (R, t)
+	Eigen::Vector3d observe(const RigidModel& bodyFromCamera, const Eigen::Matrix3d& R, const Eigen::Vector3d& t,
+		const Eigen::Vector3d& X)
+	{
+		const RigidModel cameraFromBody = inverse(bodyFromCamera);
+		const Eigen::Vector3d P = bodyFromCamera.R * X + bodyFromCamera.t;
+		const Eigen::Vector3d Z = cameraFromBody.R * (R * P + t) + cameraFromBody.t;
+		const double uL = camera.fx_ * Z.x() / Z.z() + camera.cx_;
+		return Eigen::Vector3d(uL, camera.fy_ * Z.y() / Z.z() + camera.cy_, uL + camera.bf_ / Z.z());
+	}
+
+	void testJacobian(bool stereo)
+	{
+		const RigidModel bodyFromCamera = rearRig();
+		RigidModel motion;
+		motion.R = rotation(0.03, -0.1, 0.02);
+		motion.t = Eigen::Vector3d(0.2, -0.05, 1.1);
+		// the solver keeps the point and the observation in float
+		const Eigen::Vector3d X = Eigen::Vector3f(1.5f, -0.4f, 12.f).cast<double>();
+		const Eigen::Vector3f observed = (observe(bodyFromCamera, motion.R, motion.t, X) + Eigen::Vector3d(0.5, -0.7, 0.4))
+			.cast<float>();
+		const Eigen::Vector3d z = observed.cast<double>();
+
+		MultiRigPoseSolver solver;
+		const int rig = solver.addRig(camera, bodyFromCamera);
+		solver.addObservation(rig, cv::Point3f(X.x(), X.y(), X.z()), z(0), z(1), stereo ? z(2) : -1.f, 1.0);
+
+		auto residual = [&](const Eigen::Matrix3d& R, const Eigen::Vector3d& t) {
+			const Eigen::Vector3d r = observe(bodyFromCamera, R, t, X) - z;
+			return stereo ? Eigen::VectorXd(r) : Eigen::VectorXd(r.head<2>());
+		};
+		const Eigen::VectorXd r = residual(motion.R, motion.t);
+		const Eigen::MatrixXd J = numericalJacobian(residual, motion.R, motion.t);
+
+		// inside the Huber threshold: H = J^T J, g = J^T r and the cost is |r|^2
+		MultiRigPoseSolver::Matrix6d H;
+		MultiRigPoseSolver::Vector6d g;
+		int inliers;
+		const double cost = solver.linearize(motion, &H, &g, &inliers);
+		MVSO_CHECK_NEAR(H, Eigen::MatrixXd(J.transpose() * J), 1e-6);
+		MVSO_CHECK_NEAR(g, Eigen::VectorXd(J.transpose() * r), 1e-6);
+		MVSO_CHECK_NEAR(cost, r.squaredNorm(), 1e-9);
+		MVSO_CHECK(inliers == 1);
+	}
+
+	void testRecovery()
+	{
+		std::mt19937 rng(3);
+		std::uniform_real_distribution<double> lateral(-8.0, 8.0), height(-2.0, 1.5), depth(4.0, 40.0);
+		std::normal_distribution<double> noise(0.0, 0.5);
+
+		RigidModel motion;
+		motion.R = rotation(0.01, 0.05, -0.02);
+		motion.t = Eigen::Vector3d(0.05, 0.02, 1.0);
+
+		MultiRigPoseSolver solver;
+		solver.options_.maxIterations = 50;
+		const RigidModel rigs[2] = { RigidModel(), rearRig() };
+		for (int k = 0; k < 2; k++)
+		{
+			const int rig = solver.addRig(camera, rigs[k]);
+			for (int i = 0; i < 100; i++)
+			{
+				const Eigen::Vector3d X(lateral(rng), height(rng), depth(rng));
+				const Eigen::Vector3d z = observe(rigs[k], motion.R, motion.t, X);
+				// every third one left only
+				const float uR = i % 3 == 0 ? -1.f : static_cast<float>(z(2) + noise(rng));
+				solver.addObservation(rig, cv::Point3f(X.x(), X.y(), X.z()), z(0) + noise(rng), z(1) + noise(rng), uR, 1.0);
+			}
+		}
+
+		RigidModel estimate;
+		const MultiRigPoseSolver::Summary summary = solver.solve(estimate);
+		std::cout << "two rigs: " << summary.iterations << " iterations, rotation error "
+			<< rotationError(estimate.R, motion.R) << " rad, translation error " << (estimate.t - motion.t).norm()
+			<< " m" << std::endl;
+		MVSO_CHECK(summary.finalCost < summary.initialCost);
+		MVSO_CHECK(rotationError(estimate.R, motion.R) < 2e-3);
+		MVSO_CHECK((estimate.t - motion.t).norm() < 0.03);
+		MVSO_CHECK(summary.inliers >= summary.observations * 8 / 10);
+	}
+
+}
+
+int main()
+{
+	testJacobian(true);
+	testJacobian(false);
+	testRecovery();
+	return testResult();
+}
@@ -0,0 +1,156 @@
+// PoseSolver: the analytic Jacobians of the mono, stereo and 3D-3D rows
+// against central differences of the residuals they linearize, then a known
+// pose recovered from noisy synthetic observations with outliers.
+
+#include "PoseSolver.h"
+#include "TestCheck.h"
+
+#include <random>
+#include <vector>
+
+using namespace MVSO;
+using namespace MVSO::test;
+
+namespace
+{
+
+	const double fx = 718.856, fy = 718.856, cx = 607.1928, cy = 185.2157, bf = -386.1448;
+
+	Eigen::Vector3d project(const Eigen::Matrix3d& R, const Eigen::Vector3d& t, const Eigen::Vector3d& X)
+	{
+		const Eigen::Vector3d x = R * X + t;
+		const double uL = fx * x.x() / x.z() + cx;
+		return Eigen::Vector3d(uL, fy * x.y() / x.z() + cy, uL + bf / x.z());
+	}
+
+	// one observation: H = J^T J and g = J^T r, since its residual is inside
+	// the Huber threshold; the cost is |r|^2
+	void checkNormalEquations(PoseSolver& solver, const Eigen::Matrix3d& R, const Eigen::Vector3d& t,
+		const Eigen::VectorXd& r, const Eigen::MatrixXd& J)
+	{
+		PoseSolver::Matrix6d H;
+		PoseSolver::Vector6d g;
+		double cost;
+		int inliers;
+		solver.normalEquations(R, t, H, g, cost, inliers);
+		// the solver accumulates in float
+		MVSO_CHECK_NEAR(H, Eigen::MatrixXd(J.transpose() * J), 1e-4);
+		MVSO_CHECK_NEAR(g, Eigen::VectorXd(J.transpose() * r), 1e-4);
+		MVSO_CHECK_NEAR(cost, r.squaredNorm(), 1e-4);
+		MVSO_CHECK(inliers == 1);
+	}
+
+	void testJacobians()
+	{
+		const Eigen::Matrix3d R = rotation(0.1, -0.2, 0.05);
+		const Eigen::Vector3d t(0.3, -0.1, 1.2);
+		const Eigen::Vector3d X(2.0, -0.5, 9.0);
+		const Eigen::Vector3d z = project(R, t, X) + Eigen::Vector3d(0.6, -0.4, 0.3);
+
+		{
+			PoseSolver solver;
+			solver.setIntrinsics(fx, fy, cx, cy);
+			solver.addProjection(X.x(), X.y(), X.z(), z(0), z(1));
+			auto residual = [&](const Eigen::Matrix3d& Ri, const Eigen::Vector3d& ti) {
+				return Eigen::VectorXd((project(Ri, ti, X) - z).head<2>());
+			};
+			checkNormalEquations(solver, R, t, residual(R, t), numericalJacobian(residual, R, t));
+		}
+		{
+			PoseSolver solver;
+			solver.setIntrinsics(fx, fy, cx, cy);
+			solver.setStereo(bf);
+			solver.addStereoProjection(X.x(), X.y(), X.z(), z(0), z(1), z(2));
+			auto residual = [&](const Eigen::Matrix3d& Ri, const Eigen::Vector3d& ti) {
+				return Eigen::VectorXd(project(Ri, ti, X) - z);
+			};
+			checkNormalEquations(solver, R, t, residual(R, t), numericalJacobian(residual, R, t));
+		}
+		{
+			const Eigen::Vector3d target = R * X + t + Eigen::Vector3d(0.2, 0.1, -0.3);
+			PoseSolver solver;
+			solver.addAlignment(X.x(), X.y(), X.z(), target.x(), target.y(), target.z());
+			auto residual = [&](const Eigen::Matrix3d& Ri, const Eigen::Vector3d& ti) {
+				return Eigen::VectorXd(Ri * X + ti - target);
+			};
+			checkNormalEquations(solver, R, t, residual(R, t), numericalJacobian(residual, R, t));
+		}
+	}
+
+	// more points than one AVX2 lane group and a tail, 0.5 px noise and 5%
+	// gross outliers, solved from the identity
+	void testRecovery(bool stereo)
+	{
+		std::mt19937 rng(7);
+		std::uniform_real_distribution<double> lateral(-8.0, 8.0), height(-2.0, 1.5), depth(4.0, 40.0);
+		std::normal_distribution<double> noise(0.0, 0.5);
+		std::uniform_real_distribution<double> outlier(-40.0, 40.0);
+
+		const Eigen::Matrix3d R = rotation(0.02, 0.08, -0.01);
+		const Eigen::Vector3d t(0.1, -0.05, 0.9);
+		PoseSolver solver;
+		solver.setIntrinsics(fx, fy, cx, cy);
+		solver.setStereo(bf);
+		solver.options_.maxIterations = 50;
+		const int points = 203;
+		for (int i = 0; i < points; i++)
+		{
+			const Eigen::Vector3d X(lateral(rng), height(rng), depth(rng));
+			Eigen::Vector3d z = project(R, t, X);
+			if (i % 20 == 0)
+				z += Eigen::Vector3d(outlier(rng), outlier(rng), 0.0);
+			const double uL = z(0) + noise(rng), v = z(1) + noise(rng), uR = z(2) + noise(rng);
+			if (stereo)
+				solver.addStereoProjection(X.x(), X.y(), X.z(), uL, v, uR);
+			else
+				solver.addProjection(X.x(), X.y(), X.z(), uL, v);
+		}
+
+		Eigen::Matrix3d Rs = Eigen::Matrix3d::Identity();
+		Eigen::Vector3d ts = Eigen::Vector3d::Zero();
+		const PoseSolver::Summary summary = solver.solve(Rs, ts);
+		std::cout << (stereo ? "stereo" : "mono") << ": " << summary.iterations << " iterations ("
+			<< PoseSolver::terminationName(summary.termination) << "), rotation error " << rotationError(Rs, R)
+			<< " rad, translation error " << (ts - t).norm() << " m" << std::endl;
+		MVSO_CHECK(summary.termination != PoseSolver::Termination::FAILED);
+		MVSO_CHECK(summary.finalCost < summary.initialCost);
+		MVSO_CHECK(rotationError(Rs, R) < 2e-3);
+		MVSO_CHECK((ts - t).norm() < (stereo ? 0.03 : 0.1));
+		MVSO_CHECK(summary.inliers >= points * 8 / 10);
+	}
+
+	void testAlignmentRecovery()
+	{
+		std::mt19937 rng(11);
+		std::uniform_real_distribution<double> coordinate(-10.0, 10.0);
+		std::normal_distribution<double> noise(0.0, 0.02);
+
+		const Eigen::Matrix3d R = rotation(-0.1, 0.3, 0.2);
+		const Eigen::Vector3d t(1.0, -0.5, 2.0);
+		PoseSolver solver;
+		solver.options_.maxIterations = 50;
+		for (int i = 0; i < 61; i++)
+		{
+			const Eigen::Vector3d X(coordinate(rng), coordinate(rng), coordinate(rng));
+			const Eigen::Vector3d Y = R * X + t;
+			solver.addAlignment(X.x(), X.y(), X.z(), Y.x() + noise(rng), Y.y() + noise(rng), Y.z() + noise(rng));
+		}
+		Eigen::Matrix3d Rs = Eigen::Matrix3d::Identity();
+		Eigen::Vector3d ts = Eigen::Vector3d::Zero();
+		const PoseSolver::Summary summary = solver.solve(Rs, ts);
+		std::cout << "3D-3D: " << summary.iterations << " iterations, rotation error " << rotationError(Rs, R)
+			<< " rad, translation error " << (ts - t).norm() << " m" << std::endl;
+		MVSO_CHECK(rotationError(Rs, R) < 2e-3);
+		MVSO_CHECK((ts - t).norm() < 0.02);
+	}
+
+}
+
+int main()
+{
+	testJacobians();
+	testRecovery(false);
+	testRecovery(true);
+	testAlignmentRecovery();
+	return testResult();
+}
@@ -1,5 +1,6 @@
 #include "utils.h"
 #include "evaluate_odometry.h"
+#include "Logger.h"
 
 
 
@@ -73,7 +74,7 @@ void integrateOdometryStereo(int frame_i, cv::Mat& rigid_body_transformation, cv
                         + (translation_stereo.at<double>(2))*(translation_stereo.at<double>(2))) ;
 
     // frame_pose = frame_pose * rigid_body_transformation;
-    std::cout << "scale: " << scale << std::endl;
+    MVSO_LOG_DEBUG("scale: " << scale);
 
     // rigid_body_transformation = rigid_body_transformation.inv();
     // if ((scale>0.1)&&(translation_stereo.at<double>(2) > translation_stereo.at<double>(0)) && (translation_stereo.at<double>(2) > translation_stereo.at<double>(1))) 
@@ -86,7 +87,7 @@ void integrateOdometryStereo(int frame_i, cv::Mat& rigid_body_transformation, cv
     }
     else 
     {
-     std::cout << "[WARNING] scale below 0.1, or incorrect translation" << std::endl;
+     MVSO_LOG_WARN("scale below 0.1, or incorrect translation");
     }
 }
 
@@ -177,7 +177,7 @@ void displayTracking(cv::Mat& imageLeft_t1,
                      std::vector<cv::Point2f>&  pointsLeft_t0,
                      std::vector<cv::Point2f>&  pointsLeft_t1)
 {
-	TicTok tic;
+	MVSO_SCOPED_TIMER(MVSO::Stage::DISPLAY);
       // -----------------------------------------
       // Display feature racking
       // -----------------------------------------
@@ -203,7 +203,6 @@ void displayTracking(cv::Mat& imageLeft_t1,
       }
 
       cv::imshow("vis ", vis );  
-	  std::cout << "display tracking: " << tic.tok() << "ms" << std::endl;
 }
 
 void displayTracking(cv::Mat& imageLeft_t1,
@@ -211,7 +210,7 @@ void displayTracking(cv::Mat& imageLeft_t1,
 	std::vector<cv::Point2f>&  pointsLeft_t1,
 	cv::Point2f epipoint)
 {
-	TicTok tic;
+	MVSO_SCOPED_TIMER(MVSO::Stage::DISPLAY);
 	// -----------------------------------------
 	// Display feature racking
 	// -----------------------------------------
@@ -239,7 +238,6 @@ void displayTracking(cv::Mat& imageLeft_t1,
 	cv::circle(vis, epipoint, 10, CV_RGB(255, 255, 0), 4);
 
 	cv::imshow("vis ", vis);
-	std::cout << "display tracking: " << tic.tok() << "ms" << std::endl;
 }
 
 void visualOdometry(int current_frame_id, std::string filepath,
@@ -274,7 +272,7 @@ void visualOdometry(int current_frame_id, std::string filepath,
         // append new features with old features
         appendNewFeatures(image_left_t0, current_features);   
 
-        std::cout << "Current feature set size: " << current_features.points.size() << std::endl;
+        MVSO_LOG_DEBUG("Current feature set size: " << current_features.points.size());
     }
 
 
@@ -340,7 +338,7 @@ void visualOdometry(int current_frame_id, std::string filepath,
                         useExtrinsicGuess, iterationsCount, reprojectionError, confidence,
                         inliers, flags );
 
-    std::cout << "inliers size: " << inliers.size() << std::endl;
+    MVSO_LOG_DEBUG("inliers size: " << inliers.size());
 
     // translation_stereo = -translation_stereo;
 
@@ -387,13 +385,94 @@ void visualOdometry(int current_frame_id, std::string filepath,
 
 namespace MVSO {
 
-MultiViewStereoOdometry::MultiViewStereoOdometry(const std::string &settingPath)
+// the layout tracking() leaves in pose_ for the motion x_last = R * x_cur + t: [R | R t]
+static cv::Mat motionToPose(const RigidModel& motion)
 {
-    // 相机参数
-    std::cout << "Calibration Filepath: " << settingPath << std::endl;
+	Eigen::Matrix<double, 3, 4> pose;
+	pose.leftCols<3>() = motion.R;
+	pose.col(3) = motion.R * motion.t;
+	cv::Mat mat;
+	cv::eigen2cv(pose, mat);
+	return mat;
+}
+
+// the motion scaled along its rotation axis and its translation, 0: identity, 1: the motion
+static RigidModel scaleMotion(const RigidModel& motion, double scale)
+{
+	const Eigen::AngleAxisd rotation(motion.R);
+	RigidModel scaled;
+	scaled.R = Eigen::AngleAxisd(rotation.angle() * scale, rotation.axis()).toRotationMatrix();
+	scaled.t = scale * motion.t;
+	return scaled;
+}
 
+MultiViewStereoOdometry::MultiViewStereoOdometry(const std::string &settingPath)
+{
     cv::FileStorage fSettings(settingPath, cv::FileStorage::READ);
 
+#if defined(MVSO_WITH_AVX2) && (defined(__GNUC__) || defined(__clang__))
+	// the SIMD kernels were built for AVX2/FMA (MVSO_ENABLE_AVX2); fail here
+	// rather than with an illegal instruction in the first RANSAC
+	if (!__builtin_cpu_supports("avx2") || !__builtin_cpu_supports("fma"))
+		CV_Error(cv::Error::StsNotImplemented, "built with MVSO_ENABLE_AVX2, but this CPU has no AVX2/FMA");
+#endif
+
+	// runtime log level, below the compiled-in MVSO_LOG_LEVEL nothing is left to enable
+	std::string logLevel = fSettings["Log.level"];
+	LogLevel level;
+	if (Logger::parseLevel(logLevel, level))
+		Logger::setLevel(level);
+
+	// timeline of the stage timers, written at exit
+	tracePath_ = static_cast<std::string>(fSettings["Profiler.trace"]);
+	if (!tracePath_.empty())
+	{
+		int traceSpans = fSettings["Profiler.traceSpans"];
+#ifdef MVSO_WITH_PROFILING
+		Profiler::setThreadName("caller");
+		Profiler::startTrace(traceSpans > 0 ? traceSpans : 1000000);
+#else
+		MVSO_LOG_WARN("Profiler.trace needs MVSO_WITH_PROFILING, no trace is written");
+		tracePath_.clear();
+#endif
+	}
+
+	// cycles, instructions, cache and branch misses per stage
+	if (static_cast<int>(fSettings["Profiler.hardwareCounters"]) > 0)
+	{
+#ifdef MVSO_WITH_PROFILING
+		std::string reason;
+		if (PerfCounters::enable(reason))
+		{
+			std::string counters;
+			for (int i = 0; i < HARDWARE_COUNTERS; i++)
+				if (PerfCounters::available(static_cast<HardwareCounter>(i)))
+					counters += std::string(counters.empty() ? "" : ", ") + counterName(static_cast<HardwareCounter>(i));
+			MVSO_LOG_INFO("hardware counters: " << counters);
+		}
+		else
+			MVSO_LOG_WARN("hardware counters off: " << reason);
+#else
+		MVSO_LOG_WARN("Profiler.hardwareCounters needs MVSO_WITH_PROFILING");
+#endif
+	}
+
+	// one CSV row of counters and stage times per frame
+	frameStats_ = nullptr;
+	std::string statsPath = fSettings["Profiler.frameStats"];
+	if (!statsPath.empty())
+	{
+		statsWriter_ = std::make_shared<FrameStatsWriter>(statsPath);
+		if (!statsWriter_->isOpen())
+		{
+			MVSO_LOG_ERROR("cannot write the frame stats " << statsPath);
+			statsWriter_.reset();
+		}
+	}
+
+    // 相机参数
+    MVSO_LOG_INFO("Calibration Filepath: " << settingPath);
+
     float fx = fSettings["Camera.fx"];
     float fy = fSettings["Camera.fy"];
     float cx = fSettings["Camera.cx"];
@@ -401,39 +480,1078 @@ MultiViewStereoOdometry::MultiViewStereoOdometry(const std::string &settingPath)
     float bf = fSettings["Camera.bf"];
     camera_ = CameraModel(fx, fy, cx, cy, bf);
 	map_ = std::make_shared<Map>();
+
+	// 2D-3D (PnP) or 3D-3D (ICP) pose estimation
+	std::string poseMethod = fSettings["PoseEstimator.method"];
+	poseMethod_ = poseMethod == "ICP" ? PoseMethod::ICP : PoseMethod::PNP;
+	MVSO_LOG_INFO("Pose estimation: " << (poseMethod_ == PoseMethod::ICP ? "ICP" : "PnP"));
+
+	// a positive budget selects the preemptive, time-bounded RANSAC
+	float ransacBudgetUs = fSettings["Ransac.budgetUs"];
+	ransacMode_ = ransacBudgetUs > 0 ? RansacMode::PREEMPTIVE : RansacMode::ADAPTIVE;
+	ransacBudgetUs_ = ransacBudgetUs;
+
+	// inlier ratio above which the constant-velocity prior replaces RANSAC
+	float priorInlierRatio = fSettings["Ransac.priorInlierRatio"];
+	motionPriorInlierRatio_ = priorInlierRatio > 0 ? priorInlierRatio : 0.8f;
+
+	// one estimator for the whole sequence, its buffers are reused every frame
+	estimator_ = std::make_shared<PoseEstimator>(camera_);
+	estimator_->pnpRansacParams_.mode = ransacMode_;
+	estimator_->pnpRansacParams_.budgetUs = ransacBudgetUs_;
+	estimator_->icpRansacParams_.mode = ransacMode_;
+	estimator_->icpRansacParams_.budgetUs = ransacBudgetUs_;
+	estimator_->motionPriorInlierRatio_ = motionPriorInlierRatio_;
+
+	// stereo residuals only for points closer than ThDepth baselines
+	float thDepth = fSettings["ThDepth"];
+	if (thDepth > 0)
+		estimator_->closeDepth_ = thDepth * std::abs(bf) / fx;
+
+	// pose refinement caps, the convergence thresholds usually stop it earlier
+	int refineMaxIterations = fSettings["PoseOptimizer.maxIterations"];
+	float refineMaxTimeUs = fSettings["PoseOptimizer.maxTimeUs"];
+	if (refineMaxIterations > 0)
+		estimator_->optimizer_.options_.maxIterations = refineMaxIterations;
+	estimator_->optimizer_.options_.maxTimeUs = refineMaxTimeUs;
+	refineIterations_ = 0;
+	poseEstimates_ = 0;
+	motionPriorShortcuts_ = 0;
+
+	// keyframe policy, a non-positive value keeps the default
+	KeyframeSelector::Options keyframeOptions;
+	float minTrackedRatio = fSettings["Keyframe.minTrackedRatio"];
+	float maxParallax = fSettings["Keyframe.maxParallax"];
+	float maxTranslation = fSettings["Keyframe.maxTranslation"];
+	int maxFrames = fSettings["Keyframe.maxFrames"];
+	if (minTrackedRatio > 0)
+		keyframeOptions.minTrackedRatio = minTrackedRatio;
+	if (maxParallax > 0)
+		keyframeOptions.maxParallax = maxParallax;
+	if (maxTranslation > 0)
+		keyframeOptions.maxTranslation = maxTranslation;
+	if (maxFrames > 0)
+		keyframeOptions.maxFrames = maxFrames;
+	keyframeSelector_ = KeyframeSelector(keyframeOptions);
+	keyframes_ = 0;
+
+	// track against the last frame (default) or the reference keyframe
+	std::string trackingReference = fSettings["Tracking.reference"];
+	trackKeyframe_ = trackingReference == "keyframe";
+	MVSO_LOG_INFO("Tracking reference: " << (trackKeyframe_ ? "keyframe" : "frame"));
+
+	// persistent landmarks with fused depth, frame-to-frame PnP only
+	int useLandmarks = fSettings["Tracking.landmarks"];
+	if (useLandmarks > 0 && !trackKeyframe_ && poseMethod_ == PoseMethod::PNP)
+	{
+		landmarks_ = std::make_shared<LandmarkMap>(camera_, LandmarkMap::Options());
+		MVSO_LOG_INFO("Landmarks: fused depth");
+	}
+
+	// frame skipping, Tracking.maxSkip <= 1 processes every frame
+	maxSkip_ = std::max(static_cast<int>(fSettings["Tracking.maxSkip"]), 1);
+	skipParallax_ = fSettings["Tracking.skipParallax"];
+	skipMinTracked_ = fSettings["Tracking.skipMinTracked"];
+	if (skipParallax_ <= 0)
+		skipParallax_ = 10.f;
+	if (skipMinTracked_ <= 0)
+		skipMinTracked_ = 200;
+	skipInterval_ = 1;
+	framesToSkip_ = 0;
+	skippedFrames_ = 0;
+	frameCount_ = 0;
+	framesSinceReference_ = 0;
+	lastMotionFrames_ = 1;
+	trackedFeatures_ = 0;
+	landmarksStarved_ = false;
+
+	// tracking loss thresholds, a non-positive value keeps the default
+	lostMinTracked_ = fSettings["Tracking.lostMinTracked"];
+	lostMinInliers_ = fSettings["Tracking.lostMinInliers"];
+	maxRotation_ = static_cast<float>(fSettings["Tracking.maxRotation"]);
+	maxTranslation_ = static_cast<float>(fSettings["Tracking.maxTranslation"]);
+	if (lostMinTracked_ <= 0)
+		lostMinTracked_ = 30;
+	if (lostMinInliers_ <= 0)
+		lostMinInliers_ = 20;
+	if (maxRotation_ <= 0)
+		maxRotation_ = 0.5;
+	if (maxTranslation_ <= 0)
+		maxTranslation_ = 5.0;
+	state_ = State::INVALID;
+	forceKeyframe_ = false;
+	lostEvents_ = 0;
+	lostFrames_ = 0;
+	relocalizations_ = 0;
+
+	// binary descriptor index over the newest keyframes for relocalization
+	relocMinInliers_ = fSettings["Relocalization.minInliers"];
+	if (relocMinInliers_ <= 0)
+		relocMinInliers_ = 25;
+	if (static_cast<int>(fSettings["Relocalization.enabled"]) > 0)
+	{
+		KeyframeIndex::Options indexOptions;
+		int indexKeyframes = fSettings["Relocalization.keyframes"];
+		int indexFeatures = fSettings["Relocalization.features"];
+		int indexMinMatches = fSettings["Relocalization.minMatches"];
+		if (indexKeyframes > 0)
+			indexOptions.capacity = indexKeyframes;
+		if (indexFeatures > 0)
+			indexOptions.features = indexFeatures;
+		if (indexMinMatches > 0)
+			indexOptions.minMatches = indexMinMatches;
+		keyframeIndex_ = std::make_shared<KeyframeIndex>(camera_, indexOptions);
+		MVSO_LOG_INFO("Relocalization: newest " << indexOptions.capacity << " keyframes, "
+			<< indexOptions.minMatches << " matches and " << relocMinInliers_ << " inliers to accept");
+	}
+
+	// one scheduler runs every parallel stage of this instance, RANSAC included:
+	// Scheduler.workers threads (0: all cores) pinned round robin to
+	// Scheduler.cpus; OpenCV's own pool is set to Scheduler.opencvThreads
+	// (-1, the default: untouched, 0: sequential)
+	TaskScheduler::Options schedulerOptions;
+	schedulerOptions.workers = fSettings["Scheduler.workers"];
+	std::string cpus = fSettings["Scheduler.cpus"];
+	std::stringstream cpuList(cpus);
+	for (std::string cpu; std::getline(cpuList, cpu, ',');)
+	{
+		if (cpu.empty())
+			continue;
+		char* parsed = nullptr;
+		errno = 0;
+		long value = std::strtol(cpu.c_str(), &parsed, 10);
+		while (isspace(static_cast<unsigned char>(*parsed)))
+			parsed++;
+		if (errno != 0 || parsed == cpu.c_str() || *parsed != '\0' || value < 0 || value > std::numeric_limits<int>::max())
+		{
+			MVSO_LOG_WARN("Scheduler.cpus: '" << cpu << "' is not a cpu index, ignored");
+			continue;
+		}
+		schedulerOptions.cpus.push_back(static_cast<int>(value));
+	}
+	if (!fSettings["Scheduler.opencvThreads"].empty())
+		schedulerOptions.opencvThreads = fSettings["Scheduler.opencvThreads"];
+	scheduler_ = std::make_shared<TaskScheduler>(schedulerOptions);
+	estimator_->pnpRansacParams_.scheduler = scheduler_.get();
+	estimator_->icpRansacParams_.scheduler = scheduler_.get();
+	MVSO_LOG_INFO("Scheduler: " << scheduler_->numWorkers() << " workers on "
+		<< (cpus.empty() ? std::string("any cpu") : "cpus " + cpus));
+
+	// motion gate ahead of tracking, a non-positive value keeps the default
+	motionGateEnabled_ = static_cast<int>(fSettings["MotionGate.enabled"]) > 0;
+	MotionGate::Options gateOptions;
+	int gateLevel = fSettings["MotionGate.level"];
+	float gateSkipFlow = fSettings["MotionGate.skipFlow"];
+	float gateMaxParallax = fSettings["MotionGate.maxParallax"];
+	if (gateLevel > 0)
+		gateOptions.level = gateLevel;
+	if (gateSkipFlow > 0)
+		gateOptions.skipFlow = gateSkipFlow;
+	if (gateMaxParallax > 0)
+		gateOptions.maxParallax = gateMaxParallax;
+	motionGate_ = MotionGate(camera_, gateOptions);
+	gatedSinceReference_ = false;
+	std::fill(gatedFrames_, gatedFrames_ + 3, 0);
+	if (motionGateEnabled_)
+		MVSO_LOG_INFO("Motion gate: level " << gateOptions.level << ", skip under " << gateOptions.skipFlow
+			<< " px, rotation only under " << gateOptions.maxParallax << " px parallax");
+
+	// auxiliary stereo rigs 1 .. Rigs.count - 1: Rig<k>.Camera.* intrinsics and
+	// Rig<k>.bodyFromCamera, the 4x4 pose of the rig's left camera in the body
+	// (primary left camera) frame
+	int rigCount = fSettings["Rigs.count"];
+	for (int k = 1; k < rigCount; k++)
+	{
+		const std::string prefix = "Rig" + std::to_string(k) + ".";
+		cv::Mat bodyFromCamera;
+		fSettings[prefix + "bodyFromCamera"] >> bodyFromCamera;
+		if (bodyFromCamera.rows != 4 || bodyFromCamera.cols != 4)
+		{
+			MVSO_LOG_WARN(prefix << "bodyFromCamera is not a 4x4 matrix, rig " << k << " ignored");
+			continue;
+		}
+		std::shared_ptr<StereoRig> rig = std::make_shared<StereoRig>();
+		rig->camera = CameraModel(fSettings[prefix + "Camera.fx"], fSettings[prefix + "Camera.fy"],
+			fSettings[prefix + "Camera.cx"], fSettings[prefix + "Camera.cy"], fSettings[prefix + "Camera.bf"]);
+		Eigen::Matrix4d T;
+		bodyFromCamera.convertTo(bodyFromCamera, CV_64F);
+		cv::cv2eigen(bodyFromCamera, T);
+		rig->bodyFromCamera.R = T.topLeftCorner<3, 3>();
+		rig->bodyFromCamera.t = T.topRightCorner<3, 1>();
+
+		// same RANSAC and refinement settings as the primary rig
+		rig->estimator = std::make_shared<PoseEstimator>(rig->camera);
+		rig->estimator->pnpRansacParams_ = estimator_->pnpRansacParams_;
+		rig->estimator->icpRansacParams_ = estimator_->icpRansacParams_;
+		rig->estimator->motionPriorInlierRatio_ = motionPriorInlierRatio_;
+		rig->estimator->optimizer_.options_ = estimator_->optimizer_.options_;
+		if (thDepth > 0)
+			rig->estimator->closeDepth_ = thDepth * std::abs(rig->camera.bf_) / rig->camera.fx_;
+		rigs_.push_back(rig);
+	}
+	if (!rigs_.empty() && (trackKeyframe_ || landmarks_ || poseMethod_ != PoseMethod::PNP))
+	{
+		MVSO_LOG_WARN("Rigs: fusion needs frame-to-frame PnP tracking without landmarks, auxiliary rigs disabled");
+		rigs_.clear();
+	}
+	if (!rigs_.empty())
+		MVSO_LOG_INFO("Rigs: " << rigs_.size() + 1 << " stereo pairs, one fused pose per timestep");
+
+	// depth of each queue of the pipelined submit()
+	int queueSize = fSettings["Pipeline.queueSize"];
+	pipelineQueueSize_ = queueSize > 0 ? queueSize : 4;
+	display_ = true;
+
+	// local BA over the newest LocalBA.windowSize keyframes, fewer than 2 disables it
+	localBAWindow_ = fSettings["LocalBA.windowSize"];
+	localBARuns_ = 0;
+	if (localBAEnabled())
+	{
+		LocalBundleAdjuster::Options options;
+		int iterations = fSettings["LocalBA.iterations"];
+		if (iterations > 0)
+			options.maxIterations = iterations;
+		localBA_ = std::make_shared<LocalBundleAdjuster>(camera_, options, *scheduler_);
+		MVSO_LOG_INFO("Local BA: " << localBAWindow_ << " frames, " << options.maxIterations << " iterations");
+	}
+	map_->setCapacity(std::max(localBAWindow_, 1));
 }
 
 cv::Mat MultiViewStereoOdometry::grabImage(cv::Mat imgLeft, cv::Mat imgRight)
 {
+	FrameStats stats;
+	return grabImage(imgLeft, imgRight, stats);
+}
+
+cv::Mat MultiViewStereoOdometry::grabImage(cv::Mat imgLeft, cv::Mat imgRight, FrameStats& stats)
+{
+	stats = FrameStats();
+	const int frameId = frameCount_++;
+	// skipped frames cost nothing, not even the grayscale copy
+	if (consumeSkip())
+	{
+		skipFrame();
+		stats.frameId = frameId;
+		stats.skipped = true;
+		recordFrame(stats);
+		return pose_.clone();
+	}
+	std::shared_ptr<Frame> frame;
+	{
+		MVSO_PROFILE_FRAME(&stats);
+		MVSO_SCOPED_TIMER(Stage::GRAB);
+		frame = std::make_shared<Frame>(imgLeft, imgRight, frameId);
+	}
+	stats.frameId = frame->getFrameId();
+	cv::Mat pose = process(frame, std::vector<std::shared_ptr<Frame>>(), stats);
+	recordFrame(stats);
+	return pose;
+}
+
+cv::Mat MultiViewStereoOdometry::grabImages(const std::vector<cv::Mat>& imgLefts, const std::vector<cv::Mat>& imgRights)
+{
+	FrameStats stats;
+	return grabImages(imgLefts, imgRights, stats);
+}
+
+cv::Mat MultiViewStereoOdometry::grabImages(const std::vector<cv::Mat>& imgLefts, const std::vector<cv::Mat>& imgRights,
+	FrameStats& stats)
+{
+	CV_Assert(!imgLefts.empty() && imgLefts.size() == imgRights.size());
+	stats = FrameStats();
+	const int frameId = frameCount_++;
+	if (consumeSkip())
+	{
+		skipFrame();
+		stats.frameId = frameId;
+		stats.skipped = true;
+		recordFrame(stats);
+		return pose_.clone();
+	}
+	std::shared_ptr<Frame> frame;
+	std::vector<std::shared_ptr<Frame>> rigFrames(std::min(imgLefts.size() - 1, rigs_.size()));
+	{
+		MVSO_PROFILE_FRAME(&stats);
+		MVSO_SCOPED_TIMER(Stage::GRAB);
+		frame = std::make_shared<Frame>(imgLefts[0], imgRights[0], frameId);
+		scheduler_->parallelFor(0, static_cast<int>(rigFrames.size()), [&](int k) {
+			rigFrames[k] = std::make_shared<Frame>(imgLefts[k + 1], imgRights[k + 1], frame->getFrameId());
+		});
+	}
+	stats.frameId = frame->getFrameId();
+	cv::Mat pose = process(frame, rigFrames, stats);
+	recordFrame(stats);
+	return pose;
+}
+
+void MultiViewStereoOdometry::recordFrame(const FrameStats& stats)
+{
+	if (statsWriter_)
+		statsWriter_->write(stats);
+}
+
+bool MultiViewStereoOdometry::consumeSkip()
+{
+	// updateSkipInterval() may store a new interval meanwhile
+	int frames = framesToSkip_.load();
+	while (frames > 0 && !framesToSkip_.compare_exchange_weak(frames, frames - 1))
+	{
+	}
+	return frames > 0;
+}
+
+void MultiViewStereoOdometry::skipFrame()
+{
+	skippedFrames_++;
+	// dead reckoned at constant velocity; the next processed frame returns the
+	// rest of its measured motion, as after a gated frame
+	framesSinceReference_++;
+	const RigidModel refToFrame = scaleMotion(lastMotion_, static_cast<double>(framesSinceReference_) / lastMotionFrames_);
+	pose_ = motionToPose(compose(inverse(refToOutput_), refToFrame));
+	refToOutput_ = refToFrame;
+	gatedSinceReference_ = true;
+}
+
+cv::Mat MultiViewStereoOdometry::process(std::shared_ptr<Frame> frame, const std::vector<std::shared_ptr<Frame>>& rigFrames,
+	FrameStats& stats)
+{
+	MVSO_PROFILE_FRAME(&stats);
+	MVSO_SCOPED_TIMER(Stage::FRAME);
+	stats.frameId = frame->getFrameId();
+	// frameStats_ must not outlive stats, whichever way this returns
+	struct StatsScope
+	{
+		FrameStats*& stats;
+		~StatsScope() { stats = nullptr; }
+	} statsScope{ frameStats_ };
+	frameStats_ = &stats;
+
+	// probe the motion against the reference before paying for any tracking
+	if (motionGateEnabled_ && currentFrame_)
+	{
+		motionDecision_ = motionGate_.evaluate(*currentFrame_, *frame);
+		if (motionDecision_.mode != MotionGate::FULL)
+		{
+			stats.skipped = true;
+			return gatedFrame(motionDecision_);
+		}
+	}
+
+	// keyframes older than the last frame stay in the map for their poses and
+	// observations only
+	if (lastFrame_)
+		lastFrame_->releaseImages();
 	lastFrame_ = currentFrame_;
-    currentFrame_ = std::make_shared<Frame>(imgLeft, imgRight);
+	currentFrame_ = frame;
+	lastMotionFrames_ = framesSinceReference_ + 1;
+	framesSinceReference_ = 0;
+	// the auxiliary rigs advance with the primary one; a rig without an image
+	// pair this timestep starts over
+	for (size_t k = 0; k < rigs_.size(); k++)
+	{
+		StereoRig& rig = *rigs_[k];
+		if (rig.lastFrame)
+			rig.lastFrame->releaseImages();
+		rig.lastFrame = rig.currentFrame;
+		rig.currentFrame = k < rigFrames.size() ? rigFrames[k] : nullptr;
+		if (!rig.currentFrame)
+			rig.lastFrame.reset();
+		rig.estimated = false;
+	}
 	//std::cout << "frame id: " << currentFrame_->frameId_ << std::endl;
-	if (currentFrame_->frameId_ == 0)
+	if (state_ == State::INVALID)
 	{
 		pose_ = (cv::Mat_<double>(3, 4) << 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0);
+		insertKeyframe();
+		state_ = State::OK;
 		return pose_.clone();
 	}
 	//std::cout << "tracking:" << std::endl;
-    tracking();
-	//map_->addNewFrame(currentFrame_);
+	const RigidModel previousMotion = lastMotion_;
+	const int poseEstimates = poseEstimates_;
+	if (trackKeyframe_)
+	{
+		trackingKeyframe();
+	}
+	else
+	{
+		// auxiliary rigs are tracked while the primary one is
+		std::vector<std::future<void>> rigTracks;
+		for (const std::shared_ptr<StereoRig>& rig : rigs_)
+		{
+			if (!rig->lastFrame || !rig->currentFrame)
+				continue;
+			StereoRig* r = rig.get();
+			const RigidModel prior = lastMotion_;
+			rigTracks.push_back(scheduler_->async([this, r, prior] { trackRig(*r, prior); }));
+		}
+		tracking();
+		for (std::future<void>& rigTrack : rigTracks)
+			scheduler_->wait(rigTrack);
+		// not when tracking() took its static shortcut
+		if (!rigs_.empty() && poseEstimates_ > poseEstimates)
+			fuseRigs();
+
+		// chain the world pose: T_wc = T_wl * T_lc
+		Eigen::Matrix3d Rwl;
+		Eigen::Vector3d twl;
+		lastFrame_->getPose(Rwl, twl);
+		currentFrame_->setPose(Rwl * lastMotion_.R, Rwl * lastMotion_.t + twl);
+	}
+
+	// 跟踪丢失: 重定位到最近的关键帧, 否则匀速外推并从当前帧重新初始化
+	const bool healthy = trackingHealthy(poseEstimates_ > poseEstimates);
+	if (!healthy || state_ == State::LOST)
+		recoverTracking(healthy, previousMotion);
+	else
+		state_ = State::OK;
+	stats.lost = state_ == State::LOST;
+
+	// report the motion since the last frame returned, not since the reference
+	if (gatedSinceReference_)
+	{
+		pose_ = motionToPose(compose(inverse(refToOutput_), lastMotion_));
+		refToOutput_ = RigidModel();
+		gatedSinceReference_ = false;
+	}
+
+	if (localBAEnabled())
+		mergeLocalBA();
+	keyframeDecision_ = trackKeyframe_
+		? keyframeSelector_.evaluate(*currentFrame_, currentFrame_->trackIds_, currentFrame_->keyPoints_)
+		: keyframeSelector_.evaluate(*currentFrame_);
+	if (forceKeyframe_)
+	{
+		keyframeDecision_.keyframe = true;
+		forceKeyframe_ = false;
+	}
+	if (keyframeDecision_.keyframe)
+	{
+		insertKeyframe();
+		if (localBAEnabled())
+			submitLocalBA();
+	}
+	MVSO_LOG_DEBUG("keyframe " << (keyframeDecision_.keyframe ? "inserted" : "skipped")
+		<< " (tracked " << keyframeDecision_.trackedRatio << ", parallax " << keyframeDecision_.parallax
+		<< " px, translation " << keyframeDecision_.translation << " m, frames " << keyframeDecision_.frames
+		<< "), keyframes: " << keyframes_ << "/" << currentFrame_->getFrameId() + 1);
+
+	updateSkipInterval();
 	return pose_;
 }
 
+void MultiViewStereoOdometry::trackRig(StereoRig& rig, const RigidModel& prior)
+{
+	MVSO_SCOPED_TIMER(Stage::RIGS);
+	std::vector<cv::Point2f> lastFrameKpts, lastFrameKptsRight;
+	matchingFeatures2(rig.lastFrame.get(), rig.currentFrame.get(), lastFrameKpts, nullptr, &lastFrameKptsRight, nullptr, &rig.camera);
+	std::vector<cv::Point2f> currentFrameKpts = rig.currentFrame->getKeypoints();
+	std::vector<cv::Point3f> currentFrameKpts3D = rig.currentFrame->getKeypoints3D();
+
+	// an occluded or textureless rig sits this timestep out
+	static const size_t minMatches = 10;
+	if (lastFrameKpts.size() < minMatches)
+		return;
+
+	// the body motion prior seen from the rig: T_kb * T * T_bk
+	rig.estimator->setMotionPrior(compose(inverse(rig.bodyFromCamera), compose(prior, rig.bodyFromCamera)));
+	rig.estimator->estimatePose(currentFrameKpts, lastFrameKpts, lastFrameKptsRight, currentFrameKpts3D);
+	rig.estimated = true;
+}
+
+// the inliers an estimator handed its refinement, with the same weights
+static void addRigInliers(MultiRigPoseSolver& solver, int rig, const PoseEstimator& estimator)
+{
+	for (size_t i = 0; i < estimator.inlierPoints3d_.size(); i++)
+	{
+		const cv::Point2f& p = estimator.inlierPoints2d_[i];
+		solver.addObservation(rig, estimator.inlierPoints3d_[i], p.x, p.y, estimator.inlierRightU_[i], estimator.inlierWeights_[i]);
+	}
+}
+
+void MultiViewStereoOdometry::fuseRigs()
+{
+	MVSO_SCOPED_TIMER(Stage::RIGS);
+	rigSolver_.clear();
+	addRigInliers(rigSolver_, rigSolver_.addRig(camera_, RigidModel()), *estimator_);
+	int rigsUsed = 1;
+	for (const std::shared_ptr<StereoRig>& rig : rigs_)
+	{
+		if (!rig->estimated)
+			continue;
+		addRigInliers(rigSolver_, rigSolver_.addRig(rig->camera, rig->bodyFromCamera), *rig->estimator);
+		rigsUsed++;
+	}
+
+	// starts from the primary rig's refined motion
+	RigidModel motion = lastMotion_;
+	rigFusion_ = rigSolver_.solve(motion);
+	if (rigFusion_.finalCost <= rigFusion_.initialCost && motion.R.allFinite() && motion.t.allFinite())
+	{
+		lastMotion_ = motion;
+		pose_ = motionToPose(lastMotion_);
+	}
+	MVSO_LOG_DEBUG("rig fusion: " << rigsUsed << "/" << rigs_.size() + 1 << " rigs, " << rigFusion_.iterations
+		<< " iterations, cost " << rigFusion_.initialCost << " -> " << rigFusion_.finalCost
+		<< ", inliers " << rigFusion_.inliers << "/" << rigFusion_.observations);
+}
+
+cv::Mat MultiViewStereoOdometry::gatedFrame(const MotionGate::Decision& decision)
+{
+	// the frame itself is dropped, its motion is the probe's against the reference
+	RigidModel refToFrame;
+	if (decision.mode == MotionGate::ROTATION)
+		refToFrame.R = decision.R;
+	pose_ = motionToPose(compose(inverse(refToOutput_), refToFrame));
+	refToOutput_ = refToFrame;
+	gatedSinceReference_ = true;
+	framesSinceReference_++;
+	gatedFrames_[decision.mode]++;
+	MVSO_LOG_DEBUG("motion gate: " << MotionGate::modeName(decision.mode) << " (flow " << decision.flow
+		<< " px, parallax " << decision.parallax << " px, " << decision.points << " points), gated frames: "
+		<< gatedFrames_[MotionGate::SKIP] << " skip, " << gatedFrames_[MotionGate::ROTATION] << " rotation");
+	return pose_;
+}
+
+std::future<MultiViewStereoOdometry::FrameResult> MultiViewStereoOdometry::submit(cv::Mat imgLeft, cv::Mat imgRight, double timestamp)
+{
+	if (!inputQueue_)
+		startPipeline();
+
+	PipelineJob job;
+	job.imgLeft = imgLeft;
+	job.imgRight = imgRight;
+	job.timestamp = timestamp;
+	job.frameId = frameCount_++;
+	std::future<FrameResult> result = job.result.get_future();
+	inFlight_++;
+	Backoff backoff;
+	while (!inputQueue_->tryPush(job))
+		backoff.wait();
+	scheduleStage(ingestScheduled_, &MultiViewStereoOdometry::ingestStage);
+	return result;
+}
+
+void MultiViewStereoOdometry::startPipeline()
+{
+	// imshow belongs to the caller's thread
+	display_ = false;
+	inputQueue_.reset(new SpscQueue<PipelineJob>(pipelineQueueSize_));
+	trackingQueue_.reset(new SpscQueue<PipelineJob>(pipelineQueueSize_));
+	ingestScheduled_ = false;
+	trackingScheduled_ = false;
+	runningStages_ = 0;
+	inFlight_ = 0;
+}
+
+void MultiViewStereoOdometry::stopPipeline()
+{
+	// queued frames are still processed, so every future gets its result
+	Backoff backoff;
+	while (inFlight_.load() > 0 || runningStages_.load() > 0)
+		backoff.wait();
+}
+
+void MultiViewStereoOdometry::scheduleStage(std::atomic<bool>& scheduled, void (MultiViewStereoOdometry::*stage)())
+{
+	// pairs with the fence a stage passes after clearing its flag: either the
+	// stage sees the new item, or this sees the flag cleared
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (scheduled.exchange(true))
+		return;
+	runningStages_++;
+	scheduler_->spawn([this, stage] {
+		(this->*stage)();
+		runningStages_--;
+	});
+}
+
+void MultiViewStereoOdometry::ingestStage()
+{
+	// at most one ingest task runs at a time, so frames are built in order
+	PipelineJob job;
+	while (true)
+	{
+		// a full tracking queue leaves the jobs in the input queue, the tracking
+		// stage reschedules this one as it makes room
+		while (!trackingQueue_->full() && inputQueue_->tryPop(job))
+		{
+			// grayscale, then LK pyramids and FAST candidates of frame t+1 in
+			// parallel, while the tracking stage is still on frame t
+			MVSO_PROFILE_FRAME(&job.stats);
+			job.stats.frameId = job.frameId;
+			job.skipped = consumeSkip();
+			if (!job.skipped)
+			{
+				MVSO_SCOPED_TIMER(Stage::GRAB);
+				job.frame = std::make_shared<Frame>(job.imgLeft, job.imgRight, job.frameId);
+			}
+			job.imgLeft.release();
+			job.imgRight.release();
+			Frame* frame = job.frame.get();
+			if (frame)
+			{
+				MVSO_SCOPED_TIMER(Stage::INGEST);
+				scheduler_->parallelFor(0, 3, [frame](int part) {
+					if (part == 0)
+						frame->getLeftPyramid();
+					else if (part == 1)
+						frame->getRightPyramid();
+					else
+					{
+						std::vector<cv::Point2f> points;
+						frame->featureDetection(points);
+					}
+				});
+			}
+
+			// only this stage pushes, and it checked for room
+			trackingQueue_->tryPush(job);
+			scheduleStage(trackingScheduled_, &MultiViewStereoOdometry::trackingStage);
+		}
+
+		ingestScheduled_.store(false);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (inputQueue_->empty() || trackingQueue_->full() || ingestScheduled_.exchange(true))
+			return;
+	}
+}
+
+void MultiViewStereoOdometry::trackingStage()
+{
+	PipelineJob job;
+	while (true)
+	{
+		while (trackingQueue_->tryPop(job))
+		{
+			// room for the next frame, so ingest it while this one is tracked
+			if (!inputQueue_->empty())
+				scheduleStage(ingestScheduled_, &MultiViewStereoOdometry::ingestStage);
+
+			try
+			{
+				FrameResult result;
+				result.frameId = job.frameId;
+				result.timestamp = job.timestamp;
+				result.skipped = job.skipped;
+				if (result.skipped)
+					skipFrame();
+				result.pose = result.skipped ? pose_.clone()
+					: process(job.frame, std::vector<std::shared_ptr<Frame>>(), job.stats).clone();
+				result.worldPose = getWorldPose();
+				result.stats = job.stats;
+				result.stats.frameId = result.frameId;
+				result.stats.skipped = result.stats.skipped || result.skipped;
+				recordFrame(result.stats);
+				job.result.set_value(result);
+			}
+			catch (...)
+			{
+				job.result.set_exception(std::current_exception());
+			}
+			job.frame.reset();
+			inFlight_--;
+		}
+
+		trackingScheduled_.store(false);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (trackingQueue_->empty() || trackingScheduled_.exchange(true))
+			return;
+	}
+}
+
+MultiViewStereoOdometry::~MultiViewStereoOdometry()
+{
+	if (inputQueue_)
+		stopPipeline();
+	// after the queued lines
+	Logger::flush();
+	Profiler::report(std::cout);
+	if (!tracePath_.empty())
+	{
+		long long spans = Profiler::writeTrace(tracePath_);
+		if (spans < 0)
+			MVSO_LOG_ERROR("cannot write the trace " << tracePath_);
+		else
+			MVSO_LOG_INFO("trace: " << spans << " spans to " << tracePath_ << ", "
+				<< Profiler::droppedSpans() << " dropped (Profiler.traceSpans)");
+		Logger::flush();
+	}
+}
+
+void MultiViewStereoOdometry::insertKeyframe()
+{
+	MVSO_SCOPED_TIMER(Stage::KEYFRAME);
+	currentFrame_->setKeyframe();
+	if (frameStats_)
+		frameStats_->keyframe = true;
+	if (trackKeyframe_)
+		buildReference();
+	map_->addNewFrame(currentFrame_);
+	keyframeSelector_.setKeyframe(currentFrame_);
+	keyframes_++;
+	// a keyframe placed by dead reckoning is no relocalization target
+	if (keyframeIndex_ && state_ != State::LOST)
+		keyframeIndex_->add(currentFrame_);
+}
+
+MultiViewStereoOdometry::State MultiViewStereoOdometry::getState() const
+{
+	return state_;
+}
+
+void MultiViewStereoOdometry::setDisplay(bool display)
+{
+	display_ = display;
+}
+
+bool MultiViewStereoOdometry::trackingHealthy(bool estimated) const
+{
+	if (trackedFeatures_ < lostMinTracked_ || landmarksStarved_)
+		return false;
+	// the static shortcut estimates nothing
+	if (!estimated)
+		return true;
+	if (poseStats_.inliers < lostMinInliers_)
+		return false;
+	const double angle = Eigen::AngleAxisd(lastMotion_.R).angle();
+	return angle <= maxRotation_ && lastMotion_.t.norm() <= maxTranslation_;
+}
+
+void MultiViewStereoOdometry::recoverTracking(bool healthy, const RigidModel& previousMotion)
+{
+	if (state_ != State::LOST)
+	{
+		lostEvents_++;
+		MVSO_LOG_WARN("tracking lost at frame " << currentFrame_->getFrameId() << " (tracked " << trackedFeatures_
+			<< ", inliers " << poseStats_.inliers << ")");
+	}
+	state_ = State::LOST;
+
+	if (keyframeIndex_ && relocalize(previousMotion))
+	{
+		// the relocalized frame anchors tracking, and the next relocalization
+		state_ = State::OK;
+		forceKeyframe_ = true;
+		return;
+	}
+	if (healthy)
+	{
+		// tracking caught up on its own, the pose gap stays dead reckoned
+		state_ = State::OK;
+		MVSO_LOG_INFO("tracking resumed at frame " << currentFrame_->getFrameId() << " without relocalization");
+		return;
+	}
+
+	// dead reckoning: the motion before the loss continues
+	lostFrames_++;
+	lastMotion_ = previousMotion;
+	RigidModel Twl;
+	lastFrame_->getPose(Twl.R, Twl.t);
+	const RigidModel Twc = compose(Twl, lastMotion_);
+	currentFrame_->setPose(Twc.R, Twc.t);
+	pose_ = motionToPose(lastMotion_);
+
+	// start over from this frame: the next frame is tracked against its own
+	// fresh features and stereo points, and the landmarks placed with the lost
+	// poses are dropped
+	if (landmarks_)
+		landmarks_ = std::make_shared<LandmarkMap>(camera_, landmarks_->options_);
+	if (trackKeyframe_)
+		forceKeyframe_ = true;
+	MVSO_LOG_INFO("lost frames: " << lostFrames_ << ", losses: " << lostEvents_);
+}
+
+bool MultiViewStereoOdometry::relocalize(const RigidModel& previousMotion)
+{
+	MVSO_SCOPED_TIMER(Stage::RELOCALIZATION);
+	KeyframeIndex::Match& match = relocMatch_;
+	if (!keyframeIndex_->query(*currentFrame_, match))
+	{
+		MVSO_LOG_INFO("relocalization: no keyframe among " << keyframeIndex_->size() << " matches");
+		return false;
+	}
+
+	RigidModel Twk, Twl;
+	match.keyframe->getPose(Twk.R, Twk.t);
+	lastFrame_->getPose(Twl.R, Twl.t);
+
+	// keyframe points into the current camera, so the model is T_ck; the prior
+	// is the dead reckoned pose
+	estimator_->setMotionPrior(compose(inverse(compose(Twl, previousMotion)), Twk));
+	std::vector<cv::Point2f> noRight(match.points.size(), cv::Point2f(-1.f, -1.f));
+	estimator_->estimatePose(match.keyframePoints, match.points, noRight, match.points3D);
+	const int inliers = estimator_->stats_.inliers;
+	MVSO_LOG_INFO("relocalization against keyframe " << match.keyframe->getFrameId() << ": " << inliers << "/"
+		<< match.points.size() << " inliers");
+	if (inliers < relocMinInliers_)
+		return false;
+
+	RigidModel Tck;
+	estimator_->getRefinedModel(Tck);
+	const RigidModel Twc = compose(Twk, inverse(Tck));
+	currentFrame_->setPose(Twc.R, Twc.t);
+	lastMotion_ = compose(inverse(Twl), Twc);
+	pose_ = motionToPose(lastMotion_);
+	relocalizations_++;
+	MVSO_LOG_INFO("relocalized frame " << currentFrame_->getFrameId() << ", relocalizations: " << relocalizations_
+		<< "/" << lostEvents_);
+	return true;
+}
+
+void MultiViewStereoOdometry::buildReference()
+{
+	Frame* keyframe = currentFrame_.get();
+	keyframe->prepareFeature();
+	keyframe->bucketingFeature(2);
+	std::vector<cv::Point2f> left = keyframe->getKeypoints();
+
+	// 双目光流, 左->右再反向校验; 每个关键帧只做一次
+	std::vector<cv::Point2f> right, leftReturn;
+	std::vector<uchar> status0, status1;
+	cv::Size winSize = cv::Size(21, 21);
+	trackPoints(keyframe->getLeftPyramid(), keyframe->getRightPyramid(), left, right, status0, winSize);
+	trackPoints(keyframe->getRightPyramid(), keyframe->getLeftPyramid(), right, leftReturn, status1, winSize);
+
+	std::vector<bool> status(left.size());
+	for (size_t i = 0; i < left.size(); i++)
+	{
+		// rectified pair: same row, and uR = uL + bf / Z < uL
+		status[i] = status0[i] && status1[i] && right[i].x >= 0 && right[i].y >= 0
+			&& std::abs(right[i].y - left[i].y) <= 1.0 && right[i].x < left[i].x;
+	}
+	checkValidMatch(left, leftReturn, status, 0);
+
+	Reference& ref = reference_;
+	ref.pyramidLeft = keyframe->getLeftPyramid();
+	ref.left.clear();
+	ref.right.clear();
+	ref.keypointIds.clear();
+	for (size_t i = 0; i < left.size(); i++)
+	{
+		if (!status[i])
+			continue;
+		ref.left.push_back(left[i]);
+		ref.right.push_back(right[i]);
+		ref.keypointIds.push_back(static_cast<int>(i));
+	}
+	ref.trackIds = keyframe->getTrackIds(ref.keypointIds);
+
+	ref.points3D.clear();
+	if (!ref.left.empty())
+	{
+		cv::Mat points3D, points4D;
+		cv::triangulatePoints(camera_.getLeftProjectionMatrix(), camera_.getRightProjectionMatrix(),
+			ref.left, ref.right, points4D);
+		cv::convertPointsFromHomogeneous(points4D.t(), points3D);
+		ref.points3D = std::vector<cv::Point3f>(points3D);
+	}
+
+	// the keyframe's observations are exactly its stereo matched tracks
+	keyframe->addObservations(ref.left, ref.right, ref.trackIds);
+	MVSO_LOG_DEBUG("reference keyframe " << keyframe->frameId_ << ": " << ref.left.size() << "/" << left.size()
+		<< " stereo matches");
+}
+
+void MultiViewStereoOdometry::trackingKeyframe()
+{
+	Frame* keyframe = keyframeSelector_.getKeyframe().get();
+	Reference& ref = reference_;
+
+	// 时域光流: 关键帧左图->当前左图, 再反向校验; 不做双目匹配
+	std::vector<cv::Point2f> points, pointsReturn;
+	std::vector<uchar> status0, status1;
+	cv::Size winSize = cv::Size(21, 21);
+	cv::Mat imgLeft = currentFrame_->getLeftImg();
+	const std::vector<cv::Mat>& pyramidLeft = currentFrame_->getLeftPyramid();
+	std::vector<bool> status(ref.left.size(), false);
+	if (!ref.left.empty())
+	{
+		MVSO_SCOPED_TIMER(Stage::MATCHING);
+		trackPoints(ref.pyramidLeft, pyramidLeft, ref.left, points, status0, winSize);
+		trackPoints(pyramidLeft, ref.pyramidLeft, points, pointsReturn, status1, winSize);
+		for (size_t i = 0; i < ref.left.size(); i++)
+		{
+			status[i] = status0[i] && status1[i] && points[i].x >= 0 && points[i].y >= 0
+				&& points[i].x < imgLeft.cols && points[i].y < imgLeft.rows;
+		}
+		checkValidMatch(ref.left, pointsReturn, status, 0);
+	}
+
+	std::vector<cv::Point2f> keyframeKpts, currentKpts;
+	std::vector<cv::Point3f> keyframeKpts3D;
+	std::vector<int> matchId;
+	for (size_t i = 0; i < status.size(); i++)
+	{
+		if (!status[i])
+			continue;
+		keyframeKpts.push_back(ref.left[i]);
+		currentKpts.push_back(points[i]);
+		keyframeKpts3D.push_back(ref.points3D[i]);
+		matchId.push_back(ref.keypointIds[i]);
+	}
+	currentFrame_->setFeature(currentKpts);
+	currentFrame_->setInterframeMatching(matchId, keyframe);
+	trackedFeatures_ = static_cast<int>(currentKpts.size());
+	if (frameStats_)
+		frameStats_->matched = trackedFeatures_;
+	MVSO_LOG_DEBUG("track keyframe " << keyframe->frameId_ << "->" << currentFrame_->frameId_ << ": "
+		<< trackedFeatures_ << "/" << ref.left.size());
+	if (trackedFeatures_ < lostMinTracked_)
+		return;
+
+	RigidModel Twk, Twl;
+	keyframe->getPose(Twk.R, Twk.t);
+	lastFrame_->getPose(Twl.R, Twl.t);
+
+	// keyframe points into the current camera, so the model is T_ck; the
+	// constant-velocity prior is T_kl * T_lc continued by one more step
+	estimator_->setMotionPrior(inverse(compose(compose(inverse(Twk), Twl), lastMotion_)));
+	std::vector<cv::Point2f> noRight(currentKpts.size(), cv::Point2f(-1.f, -1.f));
+	estimator_->estimatePose(keyframeKpts, currentKpts, noRight, keyframeKpts3D);
+	reportPoseEstimate();
+
+	RigidModel Tck;
+	estimator_->getRefinedModel(Tck);
+	RigidModel Twc = compose(Twk, inverse(Tck));
+	currentFrame_->setPose(Twc.R, Twc.t);
+	lastMotion_ = compose(inverse(Twl), Twc);
+
+	pose_ = motionToPose(lastMotion_);
+}
+
+void MultiViewStereoOdometry::updateSkipInterval()
+{
+	// image motion per processed frame since the keyframe
+	float motion = keyframeDecision_.frames > 0 ? keyframeDecision_.parallax / keyframeDecision_.frames : 0.f;
+	if (maxSkip_ <= 1 || trackedFeatures_ < skipMinTracked_)
+		skipInterval_ = 1;
+	else if (motion < skipParallax_)
+		skipInterval_ = std::min(skipInterval_ + 1, maxSkip_);
+	else
+		skipInterval_ = std::max(skipInterval_ - 1, 1);
+	framesToSkip_ = skipInterval_ - 1;
+	if (maxSkip_ > 1)
+		MVSO_LOG_DEBUG("skip interval: " << skipInterval_ << " (" << motion << " px/frame, tracked "
+			<< trackedFeatures_ << "), skipped frames: " << skippedFrames_);
+}
+
+cv::Mat MultiViewStereoOdometry::getWorldPose() const
+{
+	Eigen::Matrix3d Rwc;
+	Eigen::Vector3d twc;
+	currentFrame_->getPose(Rwc, twc);
+	// frames gated since the reference
+	twc = Rwc * refToOutput_.t + twc;
+	Rwc = Rwc * refToOutput_.R;
+	Eigen::Matrix4d Twc = Eigen::Matrix4d::Identity();
+	Twc.topLeftCorner<3, 3>() = Rwc;
+	Twc.topRightCorner<3, 1>() = twc;
+	cv::Mat pose;
+	cv::eigen2cv(Twc, pose);
+	return pose;
+}
+
+bool MultiViewStereoOdometry::localBAEnabled() const
+{
+	return localBAWindow_ >= 2;
+}
+
+void MultiViewStereoOdometry::submitLocalBA()
+{
+	// one window in flight at a time; tracking never waits for the solver
+	if (!localBA_->idle())
+		return;
+
+	std::vector<std::shared_ptr<Frame>> frames = map_->getNewestFrames(localBAWindow_);
+	if (frames.size() < 2)
+		return;
+	std::sort(frames.begin(), frames.end(), [](const std::shared_ptr<Frame>& a, const std::shared_ptr<Frame>& b) {
+		return a->getFrameId() < b->getFrameId();
+	});
+
+	std::vector<LocalBundleAdjuster::WindowFrame> window(frames.size());
+	for (size_t i = 0; i < frames.size(); i++)
+	{
+		window[i].frameId = frames[i]->getFrameId();
+		frames[i]->getPose(window[i].Rwc, window[i].twc);
+		window[i].observations = frames[i]->getObservations();
+	}
+	localBA_->submit(std::move(window));
+}
+
+void MultiViewStereoOdometry::mergeLocalBA()
+{
+	MVSO_SCOPED_TIMER(Stage::LOCAL_BA);
+	LocalBundleAdjuster::Result& result = localBAResult_;
+	if (!localBA_->fetchResult(result) || result.frameIds.empty())
+		return;
+	localBARuns_++;
+
+	// keyframes inserted while the solver ran, and the current frame, follow
+	// the newest optimized keyframe
+	const int newest = static_cast<int>(result.frameIds.size()) - 1;
+	Eigen::Matrix3d Rold = result.Rwc[newest];
+	Eigen::Vector3d told = result.twc[newest];
+	std::vector<std::shared_ptr<Frame>> frames = map_->getNewestFrames(localBAWindow_);
+	for (const std::shared_ptr<Frame>& frame : frames)
+		if (frame->getFrameId() == result.frameIds[newest])
+			frame->getPose(Rold, told);
+	if (!currentFrame_->isKeyframe())
+		frames.push_back(currentFrame_);
+	const Eigen::Matrix3d Rcorr = result.Rwc[newest] * Rold.transpose();
+	const Eigen::Vector3d tcorr = result.twc[newest] - Rcorr * told;
+
+	for (const std::shared_ptr<Frame>& frame : frames)
+	{
+		const int id = frame->getFrameId();
+		if (id > result.frameIds[newest])
+		{
+			Eigen::Matrix3d Rwc;
+			Eigen::Vector3d twc;
+			frame->getPose(Rwc, twc);
+			frame->setPose(Rcorr * Rwc, Rcorr * twc + tcorr);
+			continue;
+		}
+		for (size_t i = 0; i < result.frameIds.size(); i++)
+			if (result.frameIds[i] == id)
+				frame->setPose(result.Rwc[i], result.twc[i]);
+	}
+
+	MVSO_LOG_INFO("local BA #" << localBARuns_ << ": frames " << result.frameIds.front() << "-" << result.frameIds.back()
+		<< ", landmarks " << result.landmarks << ", observations " << result.observations
+		<< ", " << result.iterations << " iterations, cost " << result.initialCost << " -> " << result.finalCost
+		<< ", " << result.solveTimeMs << " ms");
+}
+
 cv::Mat MultiViewStereoOdometry::tracking()
 {
 	// 特征匹配+三角化
 
 	std::vector<cv::Point2f> lastFrameKpts;
-	matchingFeatures2(lastFrame_.get(), currentFrame_.get(), lastFrameKpts);
+	std::vector<cv::Point3f> lastFrameKpts3D;
+	std::vector<cv::Point2f> lastFrameKptsRight;
+	std::vector<cv::Point2f> currentFrameKptsRight;
+	matchingFeatures2(lastFrame_.get(), currentFrame_.get(), lastFrameKpts,
+		poseMethod_ == PoseMethod::ICP ? &lastFrameKpts3D : nullptr,
+		poseMethod_ == PoseMethod::ICP ? nullptr : &lastFrameKptsRight,
+		landmarks_ ? &currentFrameKptsRight : nullptr);
+	if (landmarks_)
+		fuseLandmarks(lastFrameKpts, lastFrameKptsRight);
 
 
 	std::vector<cv::Point2f> currentFrameKpts = currentFrame_->getKeypoints();
 	std::vector<cv::Point3f> currentFrameKpts3D = currentFrame_->getKeypoints3D();
+	trackedFeatures_ = static_cast<int>(lastFrameKpts.size());
+	landmarksStarved_ = false;
+	// too few tracks for any estimate, process() takes over
+	if (trackedFeatures_ < lostMinTracked_)
+		return pose_.clone();
 
-	std::cout << "lastFrameKpts size: " << lastFrameKpts.size() << std::endl;
-	std::cout << "currnetFrameKpts size: " << currentFrameKpts.size() << std::endl;
-	std::cout << "currnetFrameKpts3D size: " << currentFrameKpts3D.size() << std::endl;
-	std::cout << "track " << lastFrame_->frameId_ << "->" << currentFrame_->frameId_ << std::endl;
+	MVSO_LOG_DEBUG("lastFrameKpts size: " << lastFrameKpts.size());
+	MVSO_LOG_DEBUG("currnetFrameKpts size: " << currentFrameKpts.size());
+	MVSO_LOG_DEBUG("currnetFrameKpts3D size: " << currentFrameKpts3D.size());
+	MVSO_LOG_DEBUG("track " << lastFrame_->frameId_ << "->" << currentFrame_->frameId_);
 	
 	
 	// 位姿估计
@@ -444,7 +1562,7 @@ cv::Mat MultiViewStereoOdometry::tracking()
 	{
 		auto& p0 = lastFrameKpts[i];
 		auto& p1 = currentFrameKpts[i];
-		float tdiff = abs(p0.x - p1.x) + abs(p0.y - p0.y);
+		float tdiff = abs(p0.x - p1.x) + abs(p0.y - p1.y);
 		if (tdiff < 1.0)
 		{
 			staticCount++;
@@ -455,7 +1573,9 @@ cv::Mat MultiViewStereoOdometry::tracking()
 	if (diff < 2.0)
 	{
 		pose_ = (cv::Mat_<double>(3, 4) << 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0);
-		displayTracking(currentFrame_->getLeftImg(), lastFrameKpts, currentFrameKpts, cv::Point2f(currentFrame_->getLeftImg().cols/2, currentFrame_->getLeftImg().rows/2));
+		lastMotion_ = RigidModel();
+		if (display_)
+			displayTracking(currentFrame_->getLeftImg(), lastFrameKpts, currentFrameKpts, cv::Point2f(currentFrame_->getLeftImg().cols/2, currentFrame_->getLeftImg().rows/2));
 		return pose_.clone();
 	}
 
@@ -463,20 +1583,31 @@ cv::Mat MultiViewStereoOdometry::tracking()
 	// ---------------------
 	// estimate pose.
 	// ---------------------
-	PoseEstimator estimator(camera_);
-
-	// 2D-3D
-	pose_ = estimator.estimatePose(currentFrameKpts, lastFrameKpts, currentFrameKpts3D);
+	// 2D-3D on the landmarks of the last frame, frame to frame without enough of them
+	if (!landmarks_ || !estimateWithLandmarks(lastFrameKpts, currentFrameKpts, currentFrameKptsRight))
 	{
-		cv::Mat r = pose_.colRange(0, 3);
-		cv::Mat t = pose_.col(3);
-		r = r.t();
-		t = -r * t;
-	}
-
-	// 3D-3D
-	//pose_ = estimator.estimatePose(ptsleft_0, ptsleft_1, points3d_t0, points3d_t1);
+		// constant velocity: the previous refined motion, in the RANSAC model convention
+		estimator_->setMotionPrior(lastMotion_);
 
+		if (poseMethod_ == PoseMethod::ICP)
+		{
+			// 3D-3D
+			pose_ = estimator_->estimatePose(currentFrameKpts, lastFrameKpts, lastFrameKpts3D, currentFrameKpts3D);
+		}
+		else
+		{
+			// 2D-3D, refined on the left and right observations of the last frame
+			pose_ = estimator_->estimatePose(currentFrameKpts, lastFrameKpts, lastFrameKptsRight, currentFrameKpts3D);
+		}
+		estimator_->getRefinedModel(lastMotion_);
+		reportPoseEstimate();
+		{
+			cv::Mat r = pose_.colRange(0, 3);
+			cv::Mat t = pose_.col(3);
+			r = r.t();
+			t = -r * t;
+		}
+	}
 
 	cv::Mat r = pose_.colRange(0, 3);
 	cv::Mat t = pose_.col(3);
@@ -489,19 +1620,59 @@ cv::Mat MultiViewStereoOdometry::tracking()
 	epipoint.x = camera_.fx_*camera_center.x / camera_center.z + camera_.cx_;
 	epipoint.y = camera_.fy_*camera_center.y / camera_center.z + camera_.cy_;
 
-	displayTracking(currentFrame_->getLeftImg(), lastFrameKpts, currentFrameKpts, epipoint);
+	if (display_)
+		displayTracking(currentFrame_->getLeftImg(), lastFrameKpts, currentFrameKpts, epipoint);
 
 	return pose_.clone();
 }
 
-void MultiViewStereoOdometry::matchingFeatures2(Frame * lastFrame, Frame * currentFrame, std::vector<cv::Point2f>& lasfFrameKpts)
+void MultiViewStereoOdometry::reportPoseEstimate()
+{
+	poseStats_ = estimator_->stats_;
+	poseEstimates_++;
+	if (frameStats_)
+	{
+		frameStats_->ransacIterations = poseStats_.ransacIterations;
+		frameStats_->inliers = poseStats_.inliers;
+		frameStats_->inlierRatio = trackedFeatures_ > 0 ? float(poseStats_.inliers) / trackedFeatures_ : 0.f;
+		frameStats_->optimizerIterations = poseStats_.refinement.iterations;
+	}
+	if (poseStats_.motionPriorUsed)
+		motionPriorShortcuts_++;
+	MVSO_LOG_DEBUG("motion prior " << (poseStats_.motionPriorUsed ? "accepted" : "rejected")
+		<< " (inlier ratio " << poseStats_.motionPriorInlierRatio << "), ransac iterations: " << poseStats_.ransacIterations
+		<< ", shortcut frames: " << motionPriorShortcuts_ << "/" << poseEstimates_);
+	const PoseOptimizer::Result& refinement = poseStats_.refinement;
+	refineIterations_ += refinement.iterations;
+	MVSO_LOG_DEBUG("refinement: " << refinement.iterations << " iterations ("
+		<< PoseSolver::terminationName(refinement.termination) << "), cost " << refinement.initialCost
+		<< " -> " << refinement.finalCost << ", inliers " << refinement.inliers << "/" << refinement.observations
+		<< ", " << refinement.solveTimeUs / 1000.0 << " ms, mean iterations: "
+		<< double(refineIterations_) / poseEstimates_);
+}
+
+void MultiViewStereoOdometry::matchingFeatures2(Frame * lastFrame, Frame * currentFrame, std::vector<cv::Point2f>& lasfFrameKpts,
+	std::vector<cv::Point3f>* lastFrameKpts3D, std::vector<cv::Point2f>* lastFrameKptsRight,
+	std::vector<cv::Point2f>* currentFrameKptsRight, const CameraModel* camera)
 {
+	const CameraModel& pairCamera = camera ? *camera : camera_;
 
 	int features_per_bucket = 2;
-	std::cout << "extrack featrue" << std::endl;
-	lastFrame->prepareFeature();
-	std::cout << "bucketing feature" << std::endl;
-	lastFrame->bucketingFeature(features_per_bucket);
+	{
+		MVSO_SCOPED_TIMER(Stage::FEATURES);
+		MVSO_LOG_TRACE("extrack featrue");
+		const size_t tracked = lastFrame->keyPoints_.size();
+		lastFrame->prepareFeature();
+		const size_t features = lastFrame->keyPoints_.size();
+		MVSO_LOG_TRACE("bucketing feature");
+		lastFrame->bucketingFeature(features_per_bucket);
+		if (frameStats_ && !camera)
+		{
+			frameStats_->detected = static_cast<int>(features - tracked);
+			frameStats_->features = static_cast<int>(features);
+			frameStats_->bucketed = static_cast<int>(lastFrame->keyPoints_.size());
+		}
+	}
 	// --------------------------------------------------------
 	// Feature tracking using KLT tracker, bucketing and circular matching
 	// --------------------------------------------------------
@@ -509,17 +1680,25 @@ void MultiViewStereoOdometry::matchingFeatures2(Frame * lastFrame, Frame * curre
 	lasfFrameKpts = lastFrame->getKeypoints();
 	std::vector<cv::Point2f> pointsRight_t0, pointsLeft_t1, pointsRight_t1;
 
-	std::cout << "circular match" << std::endl;
+	MVSO_LOG_TRACE("circular match");
 	std::vector<bool> matchStatus;
-	circularMatching(lasfFrameKpts, pointsRight_t0, pointsLeft_t1, pointsRight_t1, matchStatus);
+	{
+		MVSO_SCOPED_TIMER(Stage::MATCHING);
+		if (landmarks_ && !camera)
+			landmarkMatching(lastFrame, lasfFrameKpts, pointsRight_t0, pointsLeft_t1, pointsRight_t1, matchStatus);
+		else
+			circularMatching(lastFrame, currentFrame, lasfFrameKpts, pointsRight_t0, pointsLeft_t1, pointsRight_t1, matchStatus);
+	}
 	std::vector<bool> featureReserved = matchStatus;
 	lastFrame->removeInvalidNewFeature(featureReserved);
 	removeInvalidElement(lasfFrameKpts, matchStatus);
 	removeInvalidElement(pointsRight_t0, matchStatus);
 	removeInvalidElement(pointsLeft_t1, matchStatus);
 	removeInvalidElement(pointsRight_t1, matchStatus);
+	if (frameStats_ && !camera)
+		frameStats_->matched = static_cast<int>(pointsLeft_t1.size());
 
-	std::cout << "store match result" << std::endl;
+	MVSO_LOG_TRACE("store match result");
 	std::vector<int> matchInv(lasfFrameKpts.size());
 	int zero0 = 0, zero1 = 0;
 	for (int i = 0; i < matchStatus.size(); i++)
@@ -536,18 +1715,202 @@ void MultiViewStereoOdometry::matchingFeatures2(Frame * lastFrame, Frame * curre
 		}
 	}
 	
-	// 只三角化t1时刻的特征点
-	cv::Mat points3D_t1, points4D_t1;
-
-	cv::triangulatePoints(
-		camera_.getLeftProjectionMatrix(),
-		camera_.getRightProjectionMatrix(),
-		pointsLeft_t1, pointsRight_t1, points4D_t1);
-	cv::convertPointsFromHomogeneous(points4D_t1.t(), points3D_t1);
-	//std::vector<cv::Point3f> points3d_t1(points3D_t1);
+	// 轨迹观测, 供局部BA使用: 上一帧只补充本帧新检测的轨迹
+	std::vector<long> trackIds = lastFrame->getTrackIds(matchInv);
+	lastFrame->addObservations(lasfFrameKpts, pointsRight_t0, trackIds, lastFrame->getNewTrackIdBegin());
+	currentFrame->addObservations(pointsLeft_t1, pointsRight_t1, trackIds);
+
+	// 只三角化t1时刻的特征点, and only those with a right match: tracks of
+	// established landmarks have none and keep a NaN point
+	std::vector<cv::Point3f> points3D_t1;
+	{
+		MVSO_SCOPED_TIMER(Stage::TRIANGULATION);
+		std::vector<cv::Point2f> stereoLeft_t1, stereoRight_t1;
+		std::vector<int> stereoIds;
+		stereoLeft_t1.reserve(pointsLeft_t1.size());
+		stereoRight_t1.reserve(pointsLeft_t1.size());
+		stereoIds.reserve(pointsLeft_t1.size());
+		for (int i = 0; i < pointsLeft_t1.size(); i++)
+		{
+			if (pointsRight_t1[i].x < 0)
+				continue;
+			stereoLeft_t1.push_back(pointsLeft_t1[i]);
+			stereoRight_t1.push_back(pointsRight_t1[i]);
+			stereoIds.push_back(i);
+		}
+		const float nan = std::numeric_limits<float>::quiet_NaN();
+		points3D_t1.assign(pointsLeft_t1.size(), cv::Point3f(nan, nan, nan));
+		if (!stereoIds.empty())
+		{
+			cv::Mat points3D, points4D;
+			cv::triangulatePoints(
+				pairCamera.getLeftProjectionMatrix(),
+				pairCamera.getRightProjectionMatrix(),
+				stereoLeft_t1, stereoRight_t1, points4D);
+			cv::convertPointsFromHomogeneous(points4D.t(), points3D);
+			for (int k = 0; k < stereoIds.size(); k++)
+				points3D_t1[stereoIds[k]] = points3D.at<cv::Point3f>(k);
+		}
+		if (frameStats_ && !camera)
+			frameStats_->triangulated = static_cast<int>(stereoIds.size());
+	}
 	// 存到当前帧
 	currentFrame->addStereoMatch(pointsLeft_t1, points3D_t1);
 	currentFrame->setInterframeMatching(matchInv, lastFrame);
+
+	// t0时刻的三维点, 仅ICP需要
+	if (lastFrameKpts3D)
+	{
+		MVSO_SCOPED_TIMER(Stage::TRIANGULATION);
+		cv::Mat points3D_t0, points4D_t0;
+		cv::triangulatePoints(
+			pairCamera.getLeftProjectionMatrix(),
+			pairCamera.getRightProjectionMatrix(),
+			lasfFrameKpts, pointsRight_t0, points4D_t0);
+		cv::convertPointsFromHomogeneous(points4D_t0.t(), points3D_t0);
+		*lastFrameKpts3D = std::vector<cv::Point3f>(points3D_t0);
+	}
+
+	// t0时刻右图的匹配点, 双目联合优化需要
+	if (lastFrameKptsRight)
+		*lastFrameKptsRight = pointsRight_t0;
+	if (currentFrameKptsRight)
+		*currentFrameKptsRight = pointsRight_t1;
+}
+
+void MultiViewStereoOdometry::landmarkMatching(Frame * lastFrame, std::vector<cv::Point2f>& pointsLeft_t0,
+	std::vector<cv::Point2f>& pointsRight_t0, std::vector<cv::Point2f>& pointsLeft_t1,
+	std::vector<cv::Point2f>& pointsRight_t1, std::vector<bool>& matchStatus)
+{
+	// 已稳定的路标点只做时域光流, 其余的做环形匹配; stale ones are matched
+	// in stereo again, so their depth is re-fused and re-gated
+	std::vector<cv::Point2f> stereoPoints, temporalPoints;
+	std::vector<int> stereoIds, temporalIds;
+	const int frameId = lastFrame->getFrameId();
+	for (int i = 0; i < pointsLeft_t0.size(); i++)
+	{
+		if (!landmarks_->needsStereo(lastFrame->trackIds_[i], frameId))
+		{
+			temporalPoints.push_back(pointsLeft_t0[i]);
+			temporalIds.push_back(i);
+		}
+		else
+		{
+			stereoPoints.push_back(pointsLeft_t0[i]);
+			stereoIds.push_back(i);
+		}
+	}
+
+	std::vector<cv::Point2f> stereoRight_t0, stereoLeft_t1, stereoRight_t1;
+	std::vector<bool> stereoStatus;
+	if (!stereoPoints.empty())
+		circularMatching(stereoPoints, stereoRight_t0, stereoLeft_t1, stereoRight_t1, stereoStatus);
+
+	std::vector<cv::Point2f> temporalLeft_t1, temporalReturn;
+	std::vector<bool> temporalStatus(temporalPoints.size(), false);
+	if (!temporalPoints.empty())
+	{
+		std::vector<uchar> status0, status1;
+		cv::Size winSize = cv::Size(21, 21);
+		const std::vector<cv::Mat>& pyramidLeft_t0 = lastFrame_->getLeftPyramid();
+		const std::vector<cv::Mat>& pyramidLeft_t1 = currentFrame_->getLeftPyramid();
+		cv::Mat imgLeft_t1 = currentFrame_->getLeftImg();
+		trackPoints(pyramidLeft_t0, pyramidLeft_t1, temporalPoints, temporalLeft_t1, status0, winSize);
+		trackPoints(pyramidLeft_t1, pyramidLeft_t0, temporalLeft_t1, temporalReturn, status1, winSize);
+		for (size_t k = 0; k < temporalPoints.size(); k++)
+		{
+			const cv::Point2f& pt = temporalLeft_t1[k];
+			temporalStatus[k] = status0[k] && status1[k] && pt.x >= 0 && pt.y >= 0
+				&& pt.x < imgLeft_t1.cols && pt.y < imgLeft_t1.rows;
+		}
+		checkValidMatch(temporalPoints, temporalReturn, temporalStatus, 0);
+	}
+
+	const size_t n = pointsLeft_t0.size();
+	pointsRight_t0.assign(n, cv::Point2f(-1.f, -1.f));
+	pointsLeft_t1.assign(n, cv::Point2f(-1.f, -1.f));
+	pointsRight_t1.assign(n, cv::Point2f(-1.f, -1.f));
+	matchStatus.assign(n, false);
+	for (size_t k = 0; k < stereoIds.size(); k++)
+	{
+		const int i = stereoIds[k];
+		pointsRight_t0[i] = stereoRight_t0[k];
+		pointsLeft_t1[i] = stereoLeft_t1[k];
+		pointsRight_t1[i] = stereoRight_t1[k];
+		matchStatus[i] = stereoStatus[k];
+	}
+	for (size_t k = 0; k < temporalIds.size(); k++)
+	{
+		const int i = temporalIds[k];
+		pointsLeft_t1[i] = temporalLeft_t1[k];
+		matchStatus[i] = temporalStatus[k];
+	}
+	MVSO_LOG_DEBUG("landmark matching: " << temporalPoints.size() << " temporal, " << stereoPoints.size()
+		<< " circular, landmarks " << landmarks_->numEstablished() << "/" << landmarks_->size());
+}
+
+void MultiViewStereoOdometry::fuseLandmarks(const std::vector<cv::Point2f>& lastFrameKpts,
+	const std::vector<cv::Point2f>& lastFrameKptsRight)
+{
+	MVSO_SCOPED_TIMER(Stage::LANDMARKS);
+	// tracks are aligned with the current frame's keypoints
+	const std::vector<long>& trackIds = currentFrame_->trackIds_;
+	const int frameId = lastFrame_->getFrameId();
+	Eigen::Matrix3d Rwl;
+	Eigen::Vector3d twl;
+	lastFrame_->getPose(Rwl, twl);
+	for (size_t i = 0; i < lastFrameKpts.size(); i++)
+	{
+		if (lastFrameKptsRight[i].x >= 0)
+			landmarks_->fuse(trackIds[i], lastFrameKpts[i].x, lastFrameKpts[i].y, lastFrameKptsRight[i].x, Rwl, twl, frameId);
+		else
+			landmarks_->touch(trackIds[i], frameId);
+	}
+	landmarks_->cull(frameId);
+}
+
+bool MultiViewStereoOdometry::estimateWithLandmarks(const std::vector<cv::Point2f>& lastFrameKpts,
+	const std::vector<cv::Point2f>& currentFrameKpts, const std::vector<cv::Point2f>& currentFrameKptsRight)
+{
+	const std::vector<long>& trackIds = currentFrame_->trackIds_;
+	RigidModel Twl;
+	lastFrame_->getPose(Twl.R, Twl.t);
+	const RigidModel Tlw = inverse(Twl);
+
+	std::vector<cv::Point2f> pointsLeft_t0, pointsLeft_t1, pointsRight_t1;
+	std::vector<cv::Point3f> points3D_t0;
+	for (size_t i = 0; i < currentFrameKpts.size(); i++)
+	{
+		const LandmarkMap::Landmark* landmark = landmarks_->find(trackIds[i]);
+		if (!landmark)
+			continue;
+		const Eigen::Vector3d X = Tlw.R * landmark->position + Tlw.t;
+		if (X.z() <= 0)
+			continue;
+		pointsLeft_t0.push_back(lastFrameKpts[i]);
+		pointsLeft_t1.push_back(currentFrameKpts[i]);
+		pointsRight_t1.push_back(currentFrameKptsRight[i]);
+		points3D_t0.push_back(cv::Point3f(X.x(), X.y(), X.z()));
+	}
+	// neither the essential matrix nor PnP RANSAC can work on a handful
+	if (static_cast<int>(points3D_t0.size()) < lostMinTracked_)
+	{
+		MVSO_LOG_WARN("landmarks: " << points3D_t0.size() << " correspondences at frame " << currentFrame_->getFrameId()
+			<< ", frame to frame instead");
+		landmarksStarved_ = true;
+		return false;
+	}
+
+	// last frame landmarks into the current camera, so the model is T_cl
+	estimator_->setMotionPrior(inverse(lastMotion_));
+	estimator_->estimatePose(pointsLeft_t0, pointsLeft_t1, pointsRight_t1, points3D_t0);
+	reportPoseEstimate();
+
+	RigidModel Tcl;
+	estimator_->getRefinedModel(Tcl);
+	lastMotion_ = inverse(Tcl);
+	pose_ = motionToPose(lastMotion_);
+	return true;
 }
 
 void MultiViewStereoOdometry::circularMatching(
@@ -556,29 +1919,49 @@ void MultiViewStereoOdometry::circularMatching(
 	std::vector<cv::Point2f>& pointsLeft_t1,
 	std::vector<cv::Point2f>& pointsRight_t1,
 	std::vector<bool>& matchStatus)
+{
+	circularMatching(lastFrame_.get(), currentFrame_.get(), pointsLeft_t0, pointsRight_t0, pointsLeft_t1, pointsRight_t1, matchStatus);
+}
+
+void MultiViewStereoOdometry::circularMatching(Frame* lastFrame, Frame* currentFrame,
+	std::vector<cv::Point2f>& pointsLeft_t0,
+	std::vector<cv::Point2f>& pointsRight_t0,
+	std::vector<cv::Point2f>& pointsLeft_t1,
+	std::vector<cv::Point2f>& pointsRight_t1,
+	std::vector<bool>& matchStatus)
 {
 	//this function automatically gets rid of points for which tracking fails
 
-	std::vector<float> err;
 	cv::Size winSize = cv::Size(21, 21);
 	//cv::Size winSizeStereo = cv::Size(31, 15);
 	cv::Size winSizeStereo = cv::Size(31, 21);
 
-	cv::TermCriteria termcrit = cv::TermCriteria(cv::TermCriteria::COUNT + cv::TermCriteria::EPS, 30, 0.01);
-
 	std::vector<uchar> status0;
 	std::vector<uchar> status1;
 	std::vector<uchar> status2;
 	std::vector<uchar> status3;
 	std::vector<cv::Point2f> pointsLeft_t0_return;
 
-	TicTok tic;
-	calcOpticalFlowPyrLK(lastFrame_->getLeftImg(), lastFrame_->getRightImg(), pointsLeft_t0, pointsRight_t0, status0, err, winSize, 3, termcrit, 0, 0.001);
-	calcOpticalFlowPyrLK(lastFrame_->getRightImg(), currentFrame_->getRightImg(), pointsRight_t0, pointsRight_t1, status1, err, winSizeStereo, 3, termcrit, 0, 0.001);
-	calcOpticalFlowPyrLK(currentFrame_->getRightImg(), currentFrame_->getLeftImg(), pointsRight_t1, pointsLeft_t1, status2, err, winSize, 3, termcrit, 0, 0.001);
-	calcOpticalFlowPyrLK(currentFrame_->getLeftImg(), lastFrame_->getLeftImg(), pointsLeft_t1, pointsLeft_t0_return, status3, err, winSizeStereo, 3, termcrit, 0, 0.001);
-
-	std::cerr << "calcOpticalFlowPyrLK time: " << tic.tok() << "ms" << std::endl;
+	// each image's pyramid is built once and shared by its two legs
+	const std::vector<cv::Mat>& left_t0 = lastFrame->getLeftPyramid();
+	const std::vector<cv::Mat>& right_t0 = lastFrame->getRightPyramid();
+	const std::vector<cv::Mat>& left_t1 = currentFrame->getLeftPyramid();
+	const std::vector<cv::Mat>& right_t1 = currentFrame->getRightPyramid();
+	trackPoints(left_t0, right_t0, pointsLeft_t0, pointsRight_t0, status0, winSize);
+	trackPoints(right_t0, right_t1, pointsRight_t0, pointsRight_t1, status1, winSizeStereo);
+	trackPoints(right_t1, left_t1, pointsRight_t1, pointsLeft_t1, status2, winSize);
+	trackPoints(left_t1, left_t0, pointsLeft_t1, pointsLeft_t0_return, status3, winSizeStereo);
+
+	// the landmark path runs the circle on its stereo points only
+	if (frameStats_ && lastFrame == lastFrame_.get())
+	{
+		for (size_t i = 0; i < status0.size(); i++)
+		{
+			const int legs = !status0[i] ? 0 : !status1[i] ? 1 : !status2[i] ? 2 : !status3[i] ? 3 : 4;
+			for (int k = 0; k < legs; k++)
+				frameStats_->circleLegs[k]++;
+		}
+	}
 
 	matchStatus.resize(pointsLeft_t0.size(), false);
 
@@ -590,6 +1973,29 @@ void MultiViewStereoOdometry::circularMatching(
 }
 
 
+void MultiViewStereoOdometry::trackPoints(const std::vector<cv::Mat>& from, const std::vector<cv::Mat>& to,
+	const std::vector<cv::Point2f>& points, std::vector<cv::Point2f>& tracked, std::vector<uchar>& status, cv::Size winSize)
+{
+	MVSO_SCOPED_TIMER(Stage::LK);
+	// LK tracks every point independently, so chunks give the same result as
+	// one call; the pyramids are built already and shared read-only
+	static const int chunkSize = 128;
+	const cv::TermCriteria termcrit = cv::TermCriteria(cv::TermCriteria::COUNT + cv::TermCriteria::EPS, 30, 0.01);
+	const int n = static_cast<int>(points.size());
+	tracked.resize(n);
+	status.resize(n);
+	scheduler_->parallelFor(0, (n + chunkSize - 1) / chunkSize, [&](int chunk) {
+		const int begin = chunk * chunkSize;
+		const int end = std::min(n, begin + chunkSize);
+		std::vector<cv::Point2f> in(points.begin() + begin, points.begin() + end), out;
+		std::vector<uchar> st;
+		std::vector<float> err;
+		calcOpticalFlowPyrLK(from, to, in, out, st, err, winSize, 3, termcrit, 0, 0.001);
+		std::copy(out.begin(), out.end(), tracked.begin() + begin);
+		std::copy(st.begin(), st.end(), status.begin() + begin);
+	});
+}
+
 void MultiViewStereoOdometry::deleteUnmatchFeaturesCircle(
 	std::vector<cv::Point2f>& points0,
 	std::vector<cv::Point2f>& points1,
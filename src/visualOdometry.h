@@ -5,6 +5,8 @@
 
 #include <iostream>
 #include <ctype.h>
+#include <cerrno>
+#include <cstdlib>
 #include <algorithm>
 #include <iterator>
 #include <vector>
@@ -13,6 +15,9 @@
 #include <fstream>
 #include <string>
 #include <memory>
+#include <future>
+#include <atomic>
+#include <limits>
 #include <Eigen/Dense>
 #include <unsupported/Eigen/NonLinearOptimization>
 #include <unsupported/Eigen/NumericalDiff>
@@ -24,6 +29,19 @@
 #include "Frame.h"
 #include "cameramodel.h"
 #include "Map.h"
+#include "Ransac.h"
+#include "PoseEstimator.h"
+#include "LocalBundleAdjuster.h"
+#include "KeyframeSelector.h"
+#include "MotionGate.h"
+#include "MultiRigPoseSolver.h"
+#include "KeyframeIndex.h"
+#include "LandmarkMap.h"
+#include "SpscQueue.h"
+#include "TaskScheduler.h"
+#include "Profiler.h"
+#include "FrameStatsWriter.h"
+#include "Logger.h"
 
 void visualOdometry(int current_frame_id, std::string filepath,
                     cv::Mat& projMatrl, cv::Mat& projMatrr,
@@ -74,11 +92,75 @@ namespace MVSO
     public:
         enum class State { INVALID, OK, LOST};
         MultiViewStereoOdometry(const std::string& settingPath);
+        ~MultiViewStereoOdometry();
 
+		// The motion since the last frame returned, [R | R t] for x_last = R * x + t.
+		// A frame dropped by the skip interval returns the constant-velocity
+		// prediction rather than the identity, so the trajectory does not stall.
         cv::Mat grabImage(cv::Mat imgLeft, cv::Mat imgRight);
+
+		// same, and the stage timings of the frame, see Profiler.h
+		cv::Mat grabImage(cv::Mat imgLeft, cv::Mat imgRight, FrameStats& stats);
+
+		// INVALID before the first frame; LOST from a frame whose tracking
+		// collapsed until a frame is relocalized or tracked well again
+		State getState() const;
+
+		// imshow of the tracks from tracking(), on by default; headless runs
+		// turn it off. The pipelined submit() never shows them.
+		void setDisplay(bool display);
+
+		struct FrameResult
+		{
+			int frameId = -1;
+			double timestamp = 0.0;
+			bool skipped = false;
+			cv::Mat pose;          // what grabImage returns for the frame
+			cv::Mat worldPose;     // 4x4 camera to world
+			FrameStats stats;      // ingest and tracking stage timings
+		};
+
+		// The skip interval is taken at ingest, before the frame is built, so a
+		// skipped frame costs no more than in grabImage. A new interval reaches
+		// ingest one frame later than in grabImage when the next frame was
+		// ingested while the current one was tracked.
+
+		// Pipelined alternative to grabImage. An ingest task converts the
+		// images, builds the LK pyramids and detects the features of frame t+1
+		// while the tracking task estimates frame t; both run on the
+		// instance's TaskScheduler and are connected by bounded lock-free
+		// queues, so the throughput is set by the slower stage. Blocks only
+		// while the input queue is full. Call it from a single thread, do not
+		// mix it with grabImage, and do not write into the images afterwards:
+		// they are shared, not copied.
+		std::future<FrameResult> submit(cv::Mat imgLeft, cv::Mat imgRight, double timestamp);
        
 
-		void matchingFeatures2(Frame* lastFrame, Frame* currentFrame, std::vector<cv::Point2f>& lastFrameKpts);
+		// Several stereo rigs (Rigs.count): rig 0 is the primary pair, whose left
+		// camera is the body frame; imgLefts[k], imgRights[k] is the pair of
+		// rig k. Every auxiliary rig is tracked frame to frame on its own task
+		// while the primary one is, and the RANSAC inliers of all of them are
+		// refined into one body motion, see MultiRigPoseSolver.h. Needs
+		// frame-to-frame PnP tracking without landmarks; submit() feeds the
+		// primary rig only.
+		cv::Mat grabImages(const std::vector<cv::Mat>& imgLefts, const std::vector<cv::Mat>& imgRights);
+		cv::Mat grabImages(const std::vector<cv::Mat>& imgLefts, const std::vector<cv::Mat>& imgRights,
+			FrameStats& stats);
+
+		// camera is the pair's, camera_ when null
+		void matchingFeatures2(Frame* lastFrame, Frame* currentFrame, std::vector<cv::Point2f>& lastFrameKpts,
+			std::vector<cv::Point3f>* lastFrameKpts3D = nullptr,
+			std::vector<cv::Point2f>* lastFrameKptsRight = nullptr,
+			std::vector<cv::Point2f>* currentFrameKptsRight = nullptr,
+			const CameraModel* camera = nullptr);
+
+		// circular matching for new and unsettled tracks, temporal LK only for
+		// tracks on established landmarks (their right points are (-1, -1))
+		void landmarkMatching(Frame* lastFrame, std::vector<cv::Point2f>& pointsLeft_t0,
+			std::vector<cv::Point2f>& pointsRight_t0,
+			std::vector<cv::Point2f>& pointsLeft_t1,
+			std::vector<cv::Point2f>& pointsRight_t1,
+			std::vector<bool>& matchStatus);
 
 
 
@@ -87,6 +169,14 @@ namespace MVSO
 			std::vector<cv::Point2f> &pointsLeft_t1,
 			std::vector<cv::Point2f> &pointsRight_t1,
 			std::vector<bool>& matchStatus);
+
+		// same between any two frames of one rig
+		void circularMatching(Frame* lastFrame, Frame* currentFrame,
+			std::vector<cv::Point2f> &pointsLeft_t0,
+			std::vector<cv::Point2f> &pointsRight_t0,
+			std::vector<cv::Point2f> &pointsLeft_t1,
+			std::vector<cv::Point2f> &pointsRight_t1,
+			std::vector<bool>& matchStatus);
 		
 
 		void deleteUnmatchFeaturesCircle(std::vector<cv::Point2f>& points0, std::vector<cv::Point2f>& points1,
@@ -120,7 +210,202 @@ namespace MVSO
 		cv::Mat tracking();
 		std::shared_ptr<Map> map_;
 
-		std::queue<std::shared_ptr<Frame>> frames_;
+
+		// pose RANSAC configuration, see Ransac.h
+		PoseMethod poseMethod_;
+		RansacMode ransacMode_;
+		double ransacBudgetUs_;
+		float motionPriorInlierRatio_;
+		std::shared_ptr<PoseEstimator> estimator_;
+
+		// per-frame pose estimation statistics and motion-prior shortcut counters
+		PoseEstimator::Stats poseStats_;
+		int poseEstimates_;
+		int motionPriorShortcuts_;
+		long long refineIterations_;
+
+		// refined motion of the last estimate, x_last = R * x_cur + t; the
+		// constant-velocity prior of the next one
+		RigidModel lastMotion_;
+
+		// camera to world pose of the current frame, 4x4 CV_64F
+		cv::Mat getWorldPose() const;
+
+		// sliding-window bundle adjustment as a scheduler task, see LocalBundleAdjuster.h
+		bool localBAEnabled() const;
+		void submitLocalBA();
+		void mergeLocalBA();
+
+		// only keyframes enter the map and the local BA
+		void insertKeyframe();
+
+		// Frame-to-keyframe tracking (Tracking.reference: "keyframe"): incoming
+		// frames are tracked on the left image only, against the features and
+		// stereo points of the reference keyframe. The stereo legs run once per
+		// keyframe.
+		struct Reference
+		{
+			std::vector<cv::Mat> pyramidLeft;
+			std::vector<cv::Point2f> left, right;
+			std::vector<cv::Point3f> points3D;
+			std::vector<int> keypointIds;      // into the keyframe's keypoints
+			std::vector<long> trackIds;
+		};
+		void buildReference();
+		void trackingKeyframe();
+		void reportPoseEstimate();
+		bool trackKeyframe_;
+		Reference reference_;
+
+		// Frame skipping: while the image motion per processed frame stays under
+		// Tracking.skipParallax and at least Tracking.skipMinTracked features are
+		// tracked, the skip interval grows by one frame up to Tracking.maxSkip;
+		// it shrinks again as the motion per processed frame exceeds the budget.
+		void updateSkipInterval();
+		int maxSkip_;
+		float skipParallax_;
+		int skipMinTracked_;
+		int skipInterval_;
+		std::atomic<int> framesToSkip_;   // taken by the ingest stage when pipelined
+		int skippedFrames_;
+		// A skipped frame returns the constant-velocity motion: lastMotion_,
+		// which spanned lastMotionFrames_ input frames, scaled to the frames
+		// since the reference. The next processed frame returns the rest.
+		int framesSinceReference_;
+		int lastMotionFrames_;
+		int trackedFeatures_;
+
+		// Landmarks with fused depth (Tracking.landmarks, frame-to-frame PnP
+		// only): the last frame's stereo observations are fused into them, and
+		// the pose is estimated from the landmarks seen by the last frame.
+		// With fewer than Tracking.lostMinTracked of them nothing is estimated
+		// (false): the frame falls back to frame-to-frame PnP and is lost.
+		void fuseLandmarks(const std::vector<cv::Point2f>& lastFrameKpts,
+			const std::vector<cv::Point2f>& lastFrameKptsRight);
+		bool estimateWithLandmarks(const std::vector<cv::Point2f>& lastFrameKpts,
+			const std::vector<cv::Point2f>& currentFrameKpts,
+			const std::vector<cv::Point2f>& currentFrameKptsRight);
+		std::shared_ptr<LandmarkMap> landmarks_;
+		bool landmarksStarved_;
+
+		// Work-stealing pool behind the pipeline stages, the LK chunks and the
+		// local BA; declared before everything that spawns tasks on it, so it
+		// is destroyed after them.
+		std::shared_ptr<TaskScheduler> scheduler_;
+
+		// calcOpticalFlowPyrLK on prebuilt pyramids, split into chunks across
+		// the scheduler
+		void trackPoints(const std::vector<cv::Mat>& from, const std::vector<cv::Mat>& to,
+			const std::vector<cv::Point2f>& points, std::vector<cv::Point2f>& tracked,
+			std::vector<uchar>& status, cv::Size winSize);
+
+		// Motion gate (MotionGate.enabled): a frame the probe classifies as SKIP
+		// or ROTATION is dropped before detection and matching, and the last
+		// fully processed frame stays the reference. refToOutput_ is the motion
+		// from the reference to the last frame returned, x_ref = R * x_out + t,
+		// gated or skipped.
+		cv::Mat gatedFrame(const MotionGate::Decision& decision);
+		bool motionGateEnabled_;
+		MotionGate motionGate_;
+		MotionGate::Decision motionDecision_;
+		RigidModel refToOutput_;
+		bool gatedSinceReference_;
+		int gatedFrames_[3];           // per MotionGate::Mode
+
+		// an auxiliary stereo rig, with its own frames and estimator
+		struct StereoRig
+		{
+			CameraModel camera;
+			RigidModel bodyFromCamera;     // x_body = R * x_cam + t
+			std::shared_ptr<PoseEstimator> estimator;
+			std::shared_ptr<Frame> lastFrame, currentFrame;
+			bool estimated = false;        // the estimator holds this timestep's inliers
+		};
+		void trackRig(StereoRig& rig, const RigidModel& prior);
+		void fuseRigs();
+		std::vector<std::shared_ptr<StereoRig>> rigs_;
+		MultiRigPoseSolver rigSolver_;
+		MultiRigPoseSolver::Summary rigFusion_;
+
+		// Tracking loss: a frame with fewer than Tracking.lostMinTracked tracks,
+		// fewer than Tracking.lostMinInliers RANSAC inliers, or a motion over
+		// Tracking.maxRotation rad / Tracking.maxTranslation m is lost, as is
+		// one with too few landmark correspondences to estimate from. It is
+		// relocalized against the newest keyframes (Relocalization.enabled) or,
+		// failing that, dead reckoned with the previous motion while tracking
+		// restarts from its features.
+		bool trackingHealthy(bool estimated) const;
+		void recoverTracking(bool healthy, const RigidModel& previousMotion);
+		bool relocalize(const RigidModel& previousMotion);
+		State state_;
+		int lostMinTracked_;
+		int lostMinInliers_;
+		double maxRotation_;
+		double maxTranslation_;
+		bool forceKeyframe_;
+		int lostEvents_;
+		int lostFrames_;
+		int relocalizations_;
+		std::shared_ptr<KeyframeIndex> keyframeIndex_;
+		KeyframeIndex::Match relocMatch_;
+		int relocMinInliers_;
+
+		// Chrome trace written by the destructor, empty: none
+		std::string tracePath_;
+
+		// counters of the frame in process(), null outside it; the rigs and
+		// the scheduler tasks leave them alone
+		FrameStats* frameStats_;
+		std::shared_ptr<FrameStatsWriter> statsWriter_;
+		void recordFrame(const FrameStats& stats);
+
+		// everything grabImage does after the frames are built; the timers of
+		// this thread add to stats meanwhile
+		cv::Mat process(std::shared_ptr<Frame> frame, const std::vector<std::shared_ptr<Frame>>& rigFrames,
+			FrameStats& stats);
+		// takes one frame of the skip interval, if any is left; skipFrame()
+		// then dead reckons the frame
+		bool consumeSkip();
+		void skipFrame();
+
+		// index of the next image pair grabbed or submitted, skipped or not
+		int frameCount_;
+
+		struct PipelineJob
+		{
+			cv::Mat imgLeft, imgRight;
+			double timestamp = 0.0;
+			int frameId = -1;
+			bool skipped = false;  // by the ingest stage, frame stays null
+			std::shared_ptr<Frame> frame;
+			FrameStats stats;
+			std::promise<FrameResult> result;
+		};
+		void startPipeline();
+		void stopPipeline();
+
+		// A stage is a task that drains its input queue and exits; the flag
+		// keeps at most one task per stage scheduled, so each queue keeps a
+		// single consumer and frames stay in order.
+		void scheduleStage(std::atomic<bool>& scheduled, void (MultiViewStereoOdometry::*stage)());
+		void ingestStage();
+		void trackingStage();
+		int pipelineQueueSize_;
+		std::unique_ptr<SpscQueue<PipelineJob>> inputQueue_;
+		std::unique_ptr<SpscQueue<PipelineJob>> trackingQueue_;
+		std::atomic<bool> ingestScheduled_;
+		std::atomic<bool> trackingScheduled_;
+		std::atomic<int> runningStages_;
+		std::atomic<int> inFlight_;    // submitted, result not set yet
+		bool display_;             // imshow from tracking(), off when pipelined
+		KeyframeSelector keyframeSelector_;
+		KeyframeSelector::Decision keyframeDecision_;
+		int keyframes_;
+
+		int localBAWindow_;
+		std::shared_ptr<LocalBundleAdjuster> localBA_;
+		LocalBundleAdjuster::Result localBAResult_;
+		int localBARuns_;
     };
 }
 